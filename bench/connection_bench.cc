@@ -0,0 +1,422 @@
+/*
+ * Load test of tnt::Connection against the in-process MockServer: worker
+ * threads, each with its own connection (or all sharing the I/O threads
+ * with --io-threads), run a mix of selects, inserts, replaces, deletes and
+ * evals for a fixed time while the server injects latency and faults.
+ *
+ * Prints one JSON object per operation type and a summary line:
+ *   {"bench":"connection","op":"select","ops":...,"ops_per_s":...,
+ *    "p50_us":...,"p99_us":...,"p999_us":...,"max_us":...,"errors":...}
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "connection.h"
+#include "io_loop.h"
+#include "iterator.h"
+#include "row.h"
+#include "stats.h"
+#include "tuple_builder.h"
+
+#include "mock_server.h"
+
+namespace {
+
+enum op_t {
+	OP_SELECT,
+	OP_INSERT,
+	OP_REPLACE,
+	OP_DELETE,
+	OP_EVAL,
+	OPS_NUMBER
+};
+
+const char *op_names[OPS_NUMBER] = {"select", "insert", "replace", "delete", "eval"};
+
+const int space_id = 512;
+
+struct options_t {
+	unsigned threads = 8;
+	uint64_t duration_ms = 2000;
+	uint64_t rows = 10000;
+	unsigned width = 4;
+	unsigned str_len = 32;
+	unsigned mix[OPS_NUMBER] = {70, 10, 10, 5, 5}; // weights
+	unsigned pipeline = 1; // selects sent before the first reply is read
+	unsigned io_threads = 0;
+	tnt::bench::MockServer::options_t server;
+};
+
+struct worker_result_t {
+	std::vector<uint32_t> samples[OPS_NUMBER]; // microseconds
+	uint64_t errors[OPS_NUMBER] = {};
+	uint64_t reconnects = 0;
+	uint64_t rows_read = 0;
+};
+
+int64_t nowUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+}
+
+void fillTuple(tnt::TupleBuilder &tuple, const options_t &options, int64_t id, std::mt19937_64 &random)
+{
+	tuple.push(id);
+	std::string value(options.str_len, 'a');
+	for (unsigned field = 1; field < options.width; ++field) {
+		for (char &c: value) {
+			c = static_cast<char>('a' + random() % 26);
+		}
+		tuple.push(value);
+	}
+}
+
+std::size_t drain(const std::shared_ptr<tnt::Iterator> &it)
+{
+	std::size_t rows = 0;
+	while (it && *it) {
+		it->nextRow();
+		++rows;
+	}
+	return rows;
+}
+
+void runWorker(const options_t &options, const std::string &uri, unsigned number,
+		const std::atomic<bool> &stop, worker_result_t &result)
+{
+	std::mt19937_64 random(options.server.seed * 7919 + number);
+	unsigned total_weight = 0;
+	for (unsigned weight: options.mix) {
+		total_weight += weight;
+	}
+	// ids of this worker's inserts, so deletes hit rows that exist
+	std::vector<int64_t> inserted;
+	int64_t next_insert = static_cast<int64_t>(options.rows) + (static_cast<int64_t>(number) << 32);
+
+	tnt::Connection conn;
+	conn.connect(uri);
+	auto reconnect = [&]() {
+		if (!stop && !conn.connected()) {
+			conn.connect(uri);
+			++result.reconnects;
+		}
+	};
+	// resolving the name goes through _vspace/_vindex like the engine does
+	conn.resolveSpace("bench");
+
+	while (!stop) {
+		unsigned draw = total_weight ? static_cast<unsigned>(random() % total_weight) : 0;
+		op_t op = OP_SELECT;
+		for (unsigned n = 0; n < OPS_NUMBER; ++n) {
+			if (draw < options.mix[n]) {
+				op = static_cast<op_t>(n);
+				break;
+			}
+			draw -= options.mix[n];
+		}
+
+		if (op == OP_SELECT && options.pipeline > 1) {
+			std::vector<std::pair<int64_t, int64_t>> sent; // sync, start
+			for (unsigned n = 0; n < options.pipeline; ++n) {
+				tnt::TupleBuilder key(1);
+				key.push(static_cast<int64_t>(random() % std::max<uint64_t>(options.rows, 1)));
+				int64_t start_us = nowUs();
+				int64_t sync = conn.sendSelect(space_id, 0, key);
+				if (sync == -1) {
+					break;
+				}
+				sent.emplace_back(sync, start_us);
+			}
+			if (sent.size() < options.pipeline) {
+				result.errors[OP_SELECT] += options.pipeline - sent.size();
+			}
+			for (const auto &request: sent) {
+				auto it = conn.receiveSelect(request.first);
+				if (!it) {
+					++result.errors[OP_SELECT];
+					continue;
+				}
+				result.rows_read += drain(it);
+				result.samples[OP_SELECT].push_back(static_cast<uint32_t>(nowUs() - request.second));
+			}
+			reconnect();
+			continue;
+		}
+
+		int64_t start_us = nowUs();
+		bool ok = false;
+		switch (op) {
+		case OP_SELECT: {
+			tnt::TupleBuilder key(1);
+			key.push(static_cast<int64_t>(random() % std::max<uint64_t>(options.rows, 1)));
+			auto it = conn.select(space_id, key);
+			ok = it != nullptr;
+			result.rows_read += drain(it);
+			break;
+		}
+		case OP_INSERT: {
+			tnt::TupleBuilder tuple(options.width);
+			fillTuple(tuple, options, next_insert, random);
+			ok = conn.insert(space_id, tuple);
+			if (ok) {
+				inserted.push_back(next_insert);
+			}
+			++next_insert;
+			break;
+		}
+		case OP_REPLACE: {
+			tnt::TupleBuilder tuple(options.width);
+			fillTuple(tuple, options, static_cast<int64_t>(random() % std::max<uint64_t>(options.rows, 1)), random);
+			ok = conn.replace(space_id, tuple);
+			break;
+		}
+		case OP_DELETE: {
+			tnt::TupleBuilder key(1);
+			if (inserted.empty()) {
+				key.push(next_insert); // a miss, still a round trip
+			} else {
+				key.push(inserted.back());
+				inserted.pop_back();
+			}
+			ok = conn.del(space_id, key);
+			break;
+		}
+		case OP_EVAL: {
+			static const char arguments[] = { '\x91', '\x01' }; // [1]
+			auto it = conn.eval("return ...", arguments, sizeof arguments);
+			ok = it != nullptr;
+			drain(it);
+			break;
+		}
+		default:
+			break;
+		}
+		if (ok) {
+			result.samples[op].push_back(static_cast<uint32_t>(nowUs() - start_us));
+		} else {
+			++result.errors[op];
+			reconnect();
+		}
+	}
+}
+
+uint32_t percentile(const std::vector<uint32_t> &sorted, double share)
+{
+	if (sorted.empty()) {
+		return 0;
+	}
+	std::size_t at = static_cast<std::size_t>(share * (sorted.size() - 1) + 0.5);
+	return sorted[std::min(at, sorted.size() - 1)];
+}
+
+void report(const options_t &options, const char *op, std::vector<uint32_t> &samples,
+		uint64_t errors, double seconds)
+{
+	std::sort(samples.begin(), samples.end());
+	printf("{\"bench\":\"connection\",\"op\":\"%s\",\"threads\":%u,\"io_threads\":%u,"
+		"\"pipeline\":%u,\"latency_us\":%llu,\"jitter_us\":%llu,"
+		"\"ops\":%zu,\"ops_per_s\":%.1f,\"p50_us\":%u,\"p90_us\":%u,\"p99_us\":%u,"
+		"\"p999_us\":%u,\"max_us\":%u,\"errors\":%llu}\n",
+		op, options.threads, options.io_threads, options.pipeline,
+		(unsigned long long) options.server.latency_us,
+		(unsigned long long) options.server.jitter_us,
+		samples.size(), samples.size() / seconds,
+		percentile(samples, 0.5), percentile(samples, 0.9), percentile(samples, 0.99),
+		percentile(samples, 0.999), samples.empty() ? 0 : samples.back(),
+		(unsigned long long) errors);
+}
+
+bool parseMix(const char *value, unsigned *mix)
+{
+	std::fill(mix, mix + OPS_NUMBER, 0u);
+	std::string list(value);
+	std::size_t begin = 0;
+	while (begin < list.size()) {
+		std::size_t end = list.find(',', begin);
+		if (end == std::string::npos) {
+			end = list.size();
+		}
+		std::string item = list.substr(begin, end - begin);
+		std::size_t colon = item.find(':');
+		if (colon == std::string::npos) {
+			return false;
+		}
+		std::string name = item.substr(0, colon);
+		unsigned n = 0;
+		while (n < OPS_NUMBER && name != op_names[n]) {
+			++n;
+		}
+		if (n == OPS_NUMBER) {
+			return false;
+		}
+		mix[n] = static_cast<unsigned>(strtoul(item.c_str() + colon + 1, nullptr, 10));
+		begin = end + 1;
+	}
+	return true;
+}
+
+void usage(const char *program)
+{
+	fprintf(stderr,
+		"usage: %s [--threads=N] [--duration-ms=N] [--rows=N] [--width=N] [--str-len=N]\n"
+		"  [--mix=select:70,insert:10,replace:10,delete:5,eval:5] [--pipeline=N] [--io-threads=N]\n"
+		"  [--latency-us=N] [--jitter-us=N] [--padding=N] [--error-rate=F]\n"
+		"  [--disconnect-rate=F] [--stall-rate=F] [--unix=PATH] [--seed=N]\n",
+		program);
+	exit(1);
+}
+
+options_t parseOptions(int argc, char **argv)
+{
+	options_t options;
+	for (int n = 1; n < argc; ++n) {
+		const char *arg = argv[n];
+		const char *equals = strchr(arg, '=');
+		if (strncmp(arg, "--", 2) != 0 || !equals) {
+			usage(argv[0]);
+		}
+		std::string name(arg + 2, equals);
+		const char *value = equals + 1;
+		if (name == "threads") {
+			options.threads = static_cast<unsigned>(strtoul(value, nullptr, 10));
+		} else if (name == "duration-ms") {
+			options.duration_ms = strtoull(value, nullptr, 10);
+		} else if (name == "rows") {
+			options.rows = strtoull(value, nullptr, 10);
+		} else if (name == "width") {
+			options.width = static_cast<unsigned>(strtoul(value, nullptr, 10));
+		} else if (name == "str-len") {
+			options.str_len = static_cast<unsigned>(strtoul(value, nullptr, 10));
+		} else if (name == "mix") {
+			if (!parseMix(value, options.mix)) {
+				usage(argv[0]);
+			}
+		} else if (name == "pipeline") {
+			options.pipeline = static_cast<unsigned>(strtoul(value, nullptr, 10));
+		} else if (name == "io-threads") {
+			options.io_threads = static_cast<unsigned>(strtoul(value, nullptr, 10));
+		} else if (name == "latency-us") {
+			options.server.latency_us = strtoull(value, nullptr, 10);
+		} else if (name == "jitter-us") {
+			options.server.jitter_us = strtoull(value, nullptr, 10);
+		} else if (name == "padding") {
+			options.server.reply_padding = strtoull(value, nullptr, 10);
+		} else if (name == "error-rate") {
+			options.server.error_rate = strtod(value, nullptr);
+		} else if (name == "disconnect-rate") {
+			options.server.disconnect_rate = strtod(value, nullptr);
+		} else if (name == "stall-rate") {
+			options.server.stall_rate = strtod(value, nullptr);
+		} else if (name == "unix") {
+			options.server.unix_path = value;
+		} else if (name == "seed") {
+			options.server.seed = strtoull(value, nullptr, 10);
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if (options.threads == 0 || options.width == 0 || options.pipeline == 0) {
+		usage(argv[0]);
+	}
+	// TupleBuilder has a fixed 1024 byte buffer
+	if (5 + options.width * (options.str_len + 9) > 1000) {
+		fprintf(stderr, "--width times --str-len doesn't fit a TupleBuilder\n");
+		exit(1);
+	}
+	return options;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	options_t options = parseOptions(argc, argv);
+
+	tnt::bench::MockServer server(options.server);
+	std::string error;
+	if (!server.start(error)) {
+		fprintf(stderr, "can't start the mock server: %s\n", error.c_str());
+		return 1;
+	}
+	std::vector<std::pair<std::string, std::string>> format = {{"id", "unsigned"}};
+	for (unsigned field = 1; field < options.width; ++field) {
+		format.emplace_back("f" + std::to_string(field), "string");
+	}
+	server.createSpace(space_id, "bench", format);
+	server.populate(space_id, 0, options.rows, options.width, options.str_len);
+
+	if (options.io_threads > 0 && !tnt::IoLoop::start(options.io_threads, 0)) {
+		fprintf(stderr, "can't start %u I/O threads\n", options.io_threads);
+		return 1;
+	}
+
+	std::atomic<bool> stop(false);
+	std::atomic<unsigned> running(options.threads);
+	std::vector<worker_result_t> results(options.threads);
+	std::vector<std::thread> workers;
+	int64_t start_us = nowUs();
+	for (unsigned n = 0; n < options.threads; ++n) {
+		workers.emplace_back([&, n]() {
+			runWorker(options, server.uri(), n, stop, results[n]);
+			--running;
+		});
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(options.duration_ms));
+	stop = true;
+	// stalled requests never get a reply: cut their connections until all workers are out
+	while (running > 0) {
+		server.dropConnections();
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+	for (std::thread &worker: workers) {
+		worker.join();
+	}
+	double seconds = (nowUs() - start_us) / 1e6;
+	tnt::IoLoop::stop();
+
+	std::vector<uint32_t> all;
+	uint64_t all_errors = 0, reconnects = 0, rows_read = 0;
+	for (unsigned op = 0; op < OPS_NUMBER; ++op) {
+		std::vector<uint32_t> samples;
+		uint64_t errors = 0;
+		for (worker_result_t &result: results) {
+			samples.insert(samples.end(), result.samples[op].begin(), result.samples[op].end());
+			errors += result.errors[op];
+		}
+		all.insert(all.end(), samples.begin(), samples.end());
+		all_errors += errors;
+		if (!samples.empty() || errors > 0) {
+			report(options, op_names[op], samples, errors, seconds);
+		}
+	}
+	report(options, "all", all, all_errors, seconds);
+	for (const worker_result_t &result: results) {
+		reconnects += result.reconnects;
+		rows_read += result.rows_read;
+	}
+
+	tnt::bench::MockServer::counters_t counters = server.counters();
+	printf("{\"bench\":\"connection\",\"op\":\"summary\",\"seconds\":%.3f,\"reconnects\":%llu,"
+		"\"rows_read\":%llu,\"bytes_sent\":%llu,\"bytes_received\":%llu,"
+		"\"server_connections\":%llu,\"server_requests\":%llu,\"injected_errors\":%llu,"
+		"\"injected_disconnects\":%llu,\"injected_stalls\":%llu}\n",
+		seconds, (unsigned long long) reconnects, (unsigned long long) rows_read,
+		(unsigned long long) tnt::Stats::get(tnt::Stats::BYTES_SENT),
+		(unsigned long long) tnt::Stats::get(tnt::Stats::BYTES_RECEIVED),
+		(unsigned long long) counters.connections, (unsigned long long) counters.requests,
+		(unsigned long long) counters.errors, (unsigned long long) counters.disconnects,
+		(unsigned long long) counters.stalls);
+	server.stop();
+	return 0;
+}
@@ -0,0 +1,667 @@
+/*
+ * Concurrency scaling of the storage engine as a whole: client threads
+ * run PK lookups, range scans, inserts and updates through a mysqld that
+ * has the plugin loaded, so every request goes through the handler API,
+ * THR_LOCK and the engine's pools on its way to Tarantool. The table is
+ * backed by an in-process MockServer (the default, mysqld has to run on
+ * this host) or by a local Tarantool with --tarantool.
+ *
+ * The same mix is run at each thread count of --threads. Every step prints
+ * one JSON object per operation type and one for all of them:
+ *   {"bench":"handler","threads":16,"op":"pk","ops":...,"ops_per_s":...,
+ *    "p50_us":...,"p99_us":...,"p999_us":...,"max_us":...,"errors":...}
+ * The "all" line adds the CPU spent per operation by this process and by
+ * mysqld, and the growth of the lock and pool counters over the step:
+ *   Table_locks_waited and Tarantool_pool_waits from SHOW GLOBAL STATUS, and
+ *   with --waits=N the N synchronisation and table lock events of
+ *   performance_schema that waited longest (their instruments have to be
+ *   enabled in setup_instruments).
+ */
+
+#include <errmsg.h>
+#include <mysql.h>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mock_server.h"
+
+namespace {
+
+enum op_t {
+	OP_PK,
+	OP_RANGE,
+	OP_INSERT,
+	OP_UPDATE,
+	OPS_NUMBER
+};
+
+const char *op_names[OPS_NUMBER] = {"pk", "range", "insert", "update"};
+
+const int space_id = 512;
+
+struct options_t {
+	std::string host = "127.0.0.1";
+	unsigned port = 3306;
+	std::string socket;
+	std::string user = "root";
+	std::string password;
+	std::string database = "test";
+	std::string table = "handler_bench";
+	std::string tarantool; // host:port of a local Tarantool instead of the mock
+	std::vector<unsigned> threads = {1, 2, 4, 8, 16, 32, 64, 128, 256};
+	uint64_t duration_ms = 5000;
+	uint64_t warmup_ms = 1000;
+	uint64_t rows = 10000;
+	unsigned width = 4;
+	unsigned str_len = 32;
+	unsigned range_rows = 100;
+	unsigned mix[OPS_NUMBER] = {60, 10, 15, 15}; // weights
+	unsigned waits = 0;
+	long mysqld_pid = 0; // read from @@pid_file when 0
+	tnt::bench::MockServer::options_t server;
+};
+
+struct worker_result_t {
+	std::vector<uint32_t> samples[OPS_NUMBER]; // microseconds
+	uint64_t errors[OPS_NUMBER] = {};
+	std::string error; // the first one, reported once per step
+	bool connected = false;
+};
+
+/// What each step is measured by, taken when it starts and when it ends
+struct snapshot_t {
+	double client_cpu_us = 0;
+	double server_cpu_us = 0;
+	std::map<std::string, uint64_t> status;
+	std::map<std::string, std::pair<uint64_t, uint64_t>> waits; // event: count, picoseconds
+};
+
+int64_t nowUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+}
+
+MYSQL *connect(const options_t &options, std::string &error)
+{
+	MYSQL *mysql = mysql_init(nullptr);
+	if (!mysql) {
+		error = "out of memory";
+		return nullptr;
+	}
+	if (!mysql_real_connect(mysql, options.host.c_str(), options.user.c_str(),
+			options.password.c_str(), nullptr, options.port,
+			options.socket.empty() ? nullptr : options.socket.c_str(), 0)) {
+		error = mysql_error(mysql);
+		mysql_close(mysql);
+		return nullptr;
+	}
+	return mysql;
+}
+
+/// Runs a statement and reads its whole result; returns false with the error set
+bool query(MYSQL *mysql, const std::string &sql, std::string *error = nullptr,
+		std::vector<std::vector<std::string>> *rows = nullptr)
+{
+	if (mysql_real_query(mysql, sql.data(), sql.size()) != 0) {
+		if (error) {
+			*error = mysql_error(mysql);
+		}
+		return false;
+	}
+	MYSQL_RES *result = mysql_store_result(mysql);
+	if (!result) {
+		if (mysql_field_count(mysql) == 0) {
+			return true; // no result set, e.g. an insert
+		}
+		if (error) {
+			*error = mysql_error(mysql);
+		}
+		return false;
+	}
+	if (rows) {
+		unsigned fields = mysql_num_fields(result);
+		while (MYSQL_ROW row = mysql_fetch_row(result)) {
+			rows->emplace_back();
+			for (unsigned field = 0; field < fields; ++field) {
+				rows->back().push_back(row[field] ? row[field] : "");
+			}
+		}
+	}
+	mysql_free_result(result);
+	return true;
+}
+
+std::string randomString(const options_t &options, std::mt19937_64 &random)
+{
+	std::string value(options.str_len, 'a');
+	for (char &c: value) {
+		c = static_cast<char>('a' + random() % 26);
+	}
+	return value;
+}
+
+std::string tuple(const options_t &options, uint64_t id, std::mt19937_64 &random)
+{
+	std::string values = "(" + std::to_string(id);
+	for (unsigned field = 1; field < options.width; ++field) {
+		values += ",'" + randomString(options, random) + "'";
+	}
+	return values + ")";
+}
+
+void runWorker(const options_t &options, unsigned number, std::atomic<uint64_t> &next_insert,
+		std::atomic<unsigned> &ready, const std::atomic<bool> &measuring,
+		const std::atomic<bool> &stop, worker_result_t &result)
+{
+	mysql_thread_init();
+	MYSQL *mysql = connect(options, result.error);
+	if (mysql && !query(mysql, "USE " + options.database, &result.error)) {
+		mysql_close(mysql);
+		mysql = nullptr;
+	}
+	result.connected = mysql != nullptr;
+	++ready;
+	if (!mysql) {
+		mysql_thread_end();
+		return;
+	}
+
+	std::mt19937_64 random(options.server.seed * 7919 + number);
+	unsigned total_weight = 0;
+	for (unsigned weight: options.mix) {
+		total_weight += weight;
+	}
+	uint64_t rows = std::max<uint64_t>(options.rows, 1);
+	std::string sql;
+	while (!stop) {
+		unsigned draw = total_weight ? static_cast<unsigned>(random() % total_weight) : 0;
+		op_t op = OP_PK;
+		for (unsigned n = 0; n < OPS_NUMBER; ++n) {
+			if (draw < options.mix[n]) {
+				op = static_cast<op_t>(n);
+				break;
+			}
+			draw -= options.mix[n];
+		}
+
+		uint64_t id = random() % rows;
+		switch (op) {
+		case OP_PK:
+			sql = "SELECT * FROM " + options.table + " WHERE id = " + std::to_string(id);
+			break;
+		case OP_RANGE:
+			sql = "SELECT * FROM " + options.table + " WHERE id >= " + std::to_string(id) +
+				" AND id < " + std::to_string(id + options.range_rows);
+			break;
+		case OP_INSERT:
+			sql = "INSERT INTO " + options.table + " VALUES " + tuple(options, next_insert++, random);
+			break;
+		case OP_UPDATE:
+			sql = "UPDATE " + options.table + " SET " +
+				(options.width > 1 ? "f1 = '" + randomString(options, random) + "'" : "id = id") +
+				" WHERE id = " + std::to_string(id);
+			break;
+		default:
+			break;
+		}
+
+		int64_t start_us = nowUs();
+		std::string error;
+		bool ok = query(mysql, sql, &error);
+		uint32_t elapsed_us = static_cast<uint32_t>(nowUs() - start_us);
+		if (!measuring) {
+			continue;
+		}
+		if (ok) {
+			result.samples[op].push_back(elapsed_us);
+		} else {
+			++result.errors[op];
+			if (result.error.empty()) {
+				result.error = error;
+			}
+			if (mysql_errno(mysql) == CR_SERVER_GONE_ERROR || mysql_errno(mysql) == CR_SERVER_LOST) {
+				break;
+			}
+		}
+	}
+	mysql_close(mysql);
+	mysql_thread_end();
+}
+
+double clientCpuUs()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6 +
+		usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/// utime + stime of mysqld from /proc, or 0 when it isn't on this host
+double serverCpuUs(long pid)
+{
+	if (pid <= 0) {
+		return 0;
+	}
+	std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+	std::string line;
+	if (!std::getline(stat, line)) {
+		return 0;
+	}
+	// the command name may have spaces, fields are counted after its ')'
+	std::size_t close = line.rfind(')');
+	if (close == std::string::npos) {
+		return 0;
+	}
+	const char *p = line.c_str() + close + 1;
+	unsigned long long utime = 0, stime = 0;
+	// state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt utime stime
+	if (sscanf(p, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) {
+		return 0;
+	}
+	return (utime + stime) * 1e6 / sysconf(_SC_CLK_TCK);
+}
+
+snapshot_t takeSnapshot(MYSQL *control, const options_t &options, long mysqld_pid)
+{
+	snapshot_t snapshot;
+	snapshot.client_cpu_us = clientCpuUs();
+	snapshot.server_cpu_us = serverCpuUs(mysqld_pid);
+
+	std::vector<std::vector<std::string>> rows;
+	query(control, "SHOW GLOBAL STATUS WHERE Variable_name IN "
+		"('Table_locks_waited', 'Table_locks_immediate', 'Tarantool_pool_waits', "
+		"'Tarantool_reconnects', 'Threads_running')", nullptr, &rows);
+	for (const auto &row: rows) {
+		if (row.size() == 2) {
+			snapshot.status[row[0]] = strtoull(row[1].c_str(), nullptr, 10);
+		}
+	}
+
+	if (options.waits > 0) {
+		rows.clear();
+		query(control, "SELECT EVENT_NAME, COUNT_STAR, SUM_TIMER_WAIT "
+			"FROM performance_schema.events_waits_summary_global_by_event_name "
+			"WHERE (EVENT_NAME LIKE 'wait/synch/%' OR EVENT_NAME LIKE 'wait/lock/table/%') "
+			"AND COUNT_STAR > 0", nullptr, &rows);
+		for (const auto &row: rows) {
+			if (row.size() == 3) {
+				snapshot.waits[row[0]] = {strtoull(row[1].c_str(), nullptr, 10),
+					strtoull(row[2].c_str(), nullptr, 10)};
+			}
+		}
+	}
+	return snapshot;
+}
+
+uint32_t percentile(const std::vector<uint32_t> &sorted, double share)
+{
+	if (sorted.empty()) {
+		return 0;
+	}
+	std::size_t at = static_cast<std::size_t>(share * (sorted.size() - 1) + 0.5);
+	return sorted[std::min(at, sorted.size() - 1)];
+}
+
+/// Prints a line of a step without its closing brace, so more can be added
+void reportOp(unsigned threads, const char *op, std::vector<uint32_t> &samples,
+		uint64_t errors, double seconds)
+{
+	std::sort(samples.begin(), samples.end());
+	printf("{\"bench\":\"handler\",\"threads\":%u,\"op\":\"%s\","
+		"\"ops\":%zu,\"ops_per_s\":%.1f,\"p50_us\":%u,\"p90_us\":%u,\"p99_us\":%u,"
+		"\"p999_us\":%u,\"max_us\":%u,\"errors\":%llu",
+		threads, op, samples.size(), samples.size() / seconds,
+		percentile(samples, 0.5), percentile(samples, 0.9), percentile(samples, 0.99),
+		percentile(samples, 0.999), samples.empty() ? 0 : samples.back(),
+		(unsigned long long) errors);
+}
+
+void reportStep(const options_t &options, unsigned threads, std::vector<worker_result_t> &results,
+		double seconds, const snapshot_t &before, const snapshot_t &after)
+{
+	std::vector<uint32_t> all;
+	uint64_t all_errors = 0;
+	for (unsigned op = 0; op < OPS_NUMBER; ++op) {
+		std::vector<uint32_t> samples;
+		uint64_t errors = 0;
+		for (worker_result_t &result: results) {
+			samples.insert(samples.end(), result.samples[op].begin(), result.samples[op].end());
+			errors += result.errors[op];
+		}
+		all.insert(all.end(), samples.begin(), samples.end());
+		all_errors += errors;
+		if (!samples.empty() || errors > 0) {
+			reportOp(threads, op_names[op], samples, errors, seconds);
+			printf("}\n");
+		}
+	}
+
+	double ops = std::max<double>(all.size(), 1);
+	reportOp(threads, "all", all, all_errors, seconds);
+	printf(",\"client_cpu_us_per_op\":%.1f",
+		(after.client_cpu_us - before.client_cpu_us) / ops);
+	if (after.server_cpu_us > 0) {
+		printf(",\"server_cpu_us_per_op\":%.1f,\"server_cpu_cores\":%.2f",
+			(after.server_cpu_us - before.server_cpu_us) / ops,
+			(after.server_cpu_us - before.server_cpu_us) / (seconds * 1e6));
+	}
+	for (const auto &counter: after.status) {
+		auto was = before.status.find(counter.first);
+		uint64_t delta = was == before.status.end() ? counter.second : counter.second - was->second;
+		printf(",\"%s\":%llu", counter.first.c_str(), (unsigned long long) delta);
+	}
+
+	if (options.waits > 0) {
+		// event, count, microseconds waited over the step
+		std::vector<std::pair<std::string, std::pair<uint64_t, double>>> waits;
+		for (const auto &event: after.waits) {
+			std::pair<uint64_t, uint64_t> was = {0, 0};
+			auto found = before.waits.find(event.first);
+			if (found != before.waits.end()) {
+				was = found->second;
+			}
+			if (event.second.second > was.second) {
+				waits.push_back({event.first, {event.second.first - was.first,
+					(event.second.second - was.second) / 1e6}});
+			}
+		}
+		std::sort(waits.begin(), waits.end(), [](const decltype(waits)::value_type &a,
+				const decltype(waits)::value_type &b) {
+			return a.second.second > b.second.second;
+		});
+		waits.resize(std::min<std::size_t>(waits.size(), options.waits));
+		printf(",\"waits\":[");
+		for (std::size_t n = 0; n < waits.size(); ++n) {
+			printf("%s{\"event\":\"%s\",\"count\":%llu,\"wait_us\":%.1f}", n ? "," : "",
+				waits[n].first.c_str(), (unsigned long long) waits[n].second.first,
+				waits[n].second.second);
+		}
+		printf("]");
+	}
+	printf("}\n");
+	fflush(stdout);
+}
+
+/// Creates the table and its rows; the ids of inserts start right after them
+bool setUp(MYSQL *control, const options_t &options, const std::string &endpoint, std::string &error)
+{
+	std::string columns = "id INT NOT NULL";
+	for (unsigned field = 1; field < options.width; ++field) {
+		columns += ", f" + std::to_string(field) + " VARCHAR(" + std::to_string(options.str_len) + ")";
+	}
+	std::string connection = "tnt://" + endpoint + "/bench";
+	if (!query(control, "CREATE DATABASE IF NOT EXISTS " + options.database, &error) ||
+			!query(control, "USE " + options.database, &error) ||
+			!query(control, "DROP TABLE IF EXISTS " + options.table, &error) ||
+			!query(control, "CREATE TABLE " + options.table + " (" + columns + ", PRIMARY KEY (id)) "
+				"ENGINE=TARANTOOL CONNECTION='" + connection + "'", &error)) {
+		return false;
+	}
+	if (options.tarantool.empty()) {
+		return true; // the mock has been populated already
+	}
+	// a real space is refilled through the engine, a batch at a time
+	if (!query(control, "DELETE FROM " + options.table, &error)) {
+		return false;
+	}
+	std::mt19937_64 random(options.server.seed);
+	for (uint64_t first = 0; first < options.rows; first += 1000) {
+		std::string sql = "INSERT INTO " + options.table + " VALUES ";
+		for (uint64_t id = first; id < std::min<uint64_t>(first + 1000, options.rows); ++id) {
+			sql += (id == first ? "" : ",") + tuple(options, id, random);
+		}
+		if (!query(control, sql, &error)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool parseList(const char *value, std::vector<unsigned> &list)
+{
+	list.clear();
+	for (const char *p = value; *p; ) {
+		char *end = nullptr;
+		unsigned long n = strtoul(p, &end, 10);
+		if (end == p || n == 0) {
+			return false;
+		}
+		list.push_back(static_cast<unsigned>(n));
+		p = *end == ',' ? end + 1 : end;
+		if (*end && *end != ',') {
+			return false;
+		}
+	}
+	return !list.empty();
+}
+
+bool parseMix(const char *value, unsigned *mix)
+{
+	std::fill(mix, mix + OPS_NUMBER, 0u);
+	std::string list(value);
+	std::size_t begin = 0;
+	while (begin < list.size()) {
+		std::size_t end = list.find(',', begin);
+		if (end == std::string::npos) {
+			end = list.size();
+		}
+		std::string item = list.substr(begin, end - begin);
+		std::size_t colon = item.find(':');
+		if (colon == std::string::npos) {
+			return false;
+		}
+		std::string name = item.substr(0, colon);
+		unsigned n = 0;
+		while (n < OPS_NUMBER && name != op_names[n]) {
+			++n;
+		}
+		if (n == OPS_NUMBER) {
+			return false;
+		}
+		mix[n] = static_cast<unsigned>(strtoul(item.c_str() + colon + 1, nullptr, 10));
+		begin = end + 1;
+	}
+	return true;
+}
+
+void usage(const char *program)
+{
+	fprintf(stderr,
+		"usage: %s [--host=H] [--port=N] [--socket=PATH] [--user=U] [--password=P]\n"
+		"  [--database=DB] [--table=NAME] [--tarantool=HOST:PORT]\n"
+		"  [--threads=1,2,4,8,16,32,64,128,256] [--duration-ms=N] [--warmup-ms=N]\n"
+		"  [--rows=N] [--width=N] [--str-len=N] [--range-rows=N]\n"
+		"  [--mix=pk:60,range:10,insert:15,update:15] [--waits=N] [--mysqld-pid=N]\n"
+		"  [--latency-us=N] [--jitter-us=N] [--seed=N]\n",
+		program);
+	exit(1);
+}
+
+options_t parseOptions(int argc, char **argv)
+{
+	options_t options;
+	for (int n = 1; n < argc; ++n) {
+		const char *arg = argv[n];
+		const char *equals = strchr(arg, '=');
+		if (strncmp(arg, "--", 2) != 0 || !equals) {
+			usage(argv[0]);
+		}
+		std::string name(arg + 2, equals);
+		const char *value = equals + 1;
+		if (name == "host") {
+			options.host = value;
+		} else if (name == "port") {
+			options.port = static_cast<unsigned>(strtoul(value, nullptr, 10));
+		} else if (name == "socket") {
+			options.socket = value;
+		} else if (name == "user") {
+			options.user = value;
+		} else if (name == "password") {
+			options.password = value;
+		} else if (name == "database") {
+			options.database = value;
+		} else if (name == "table") {
+			options.table = value;
+		} else if (name == "tarantool") {
+			options.tarantool = value;
+		} else if (name == "threads") {
+			if (!parseList(value, options.threads)) {
+				usage(argv[0]);
+			}
+		} else if (name == "duration-ms") {
+			options.duration_ms = strtoull(value, nullptr, 10);
+		} else if (name == "warmup-ms") {
+			options.warmup_ms = strtoull(value, nullptr, 10);
+		} else if (name == "rows") {
+			options.rows = strtoull(value, nullptr, 10);
+		} else if (name == "width") {
+			options.width = static_cast<unsigned>(strtoul(value, nullptr, 10));
+		} else if (name == "str-len") {
+			options.str_len = static_cast<unsigned>(strtoul(value, nullptr, 10));
+		} else if (name == "range-rows") {
+			options.range_rows = static_cast<unsigned>(strtoul(value, nullptr, 10));
+		} else if (name == "mix") {
+			if (!parseMix(value, options.mix)) {
+				usage(argv[0]);
+			}
+		} else if (name == "waits") {
+			options.waits = static_cast<unsigned>(strtoul(value, nullptr, 10));
+		} else if (name == "mysqld-pid") {
+			options.mysqld_pid = strtol(value, nullptr, 10);
+		} else if (name == "latency-us") {
+			options.server.latency_us = strtoull(value, nullptr, 10);
+		} else if (name == "jitter-us") {
+			options.server.jitter_us = strtoull(value, nullptr, 10);
+		} else if (name == "seed") {
+			options.server.seed = strtoull(value, nullptr, 10);
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if (options.width == 0 || options.duration_ms == 0) {
+		usage(argv[0]);
+	}
+	return options;
+}
+
+/// mysqld's pid from its pid file, when both run on this host
+long findMysqldPid(MYSQL *control)
+{
+	std::vector<std::vector<std::string>> rows;
+	if (!query(control, "SELECT @@pid_file", nullptr, &rows) || rows.empty() || rows[0].empty()) {
+		return 0;
+	}
+	std::ifstream pid_file(rows[0][0]);
+	long pid = 0;
+	pid_file >> pid;
+	return pid;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	options_t options = parseOptions(argc, argv);
+	if (mysql_library_init(0, nullptr, nullptr) != 0) {
+		fprintf(stderr, "can't initialize the MySQL client library\n");
+		return 1;
+	}
+
+	tnt::bench::MockServer server(options.server);
+	std::string endpoint = options.tarantool;
+	std::string error;
+	if (endpoint.empty()) {
+		// tnt:// strings take host:port only, so the mock listens on 127.0.0.1
+		if (!server.start(error)) {
+			fprintf(stderr, "can't start the mock server: %s\n", error.c_str());
+			return 1;
+		}
+		std::vector<std::pair<std::string, std::string>> format = {{"id", "unsigned"}};
+		for (unsigned field = 1; field < options.width; ++field) {
+			format.emplace_back("f" + std::to_string(field), "string");
+		}
+		server.createSpace(space_id, "bench", format);
+		server.populate(space_id, 0, options.rows, options.width, options.str_len);
+		endpoint = server.uri();
+	}
+
+	MYSQL *control = connect(options, error);
+	if (!control) {
+		fprintf(stderr, "can't connect to mysqld: %s\n", error.c_str());
+		return 1;
+	}
+	if (!setUp(control, options, endpoint, error)) {
+		fprintf(stderr, "can't set up %s.%s: %s\n", options.database.c_str(),
+			options.table.c_str(), error.c_str());
+		return 1;
+	}
+	long mysqld_pid = options.mysqld_pid ? options.mysqld_pid : findMysqldPid(control);
+
+	for (unsigned threads: options.threads) {
+		std::atomic<uint64_t> next_insert(options.rows);
+		std::atomic<unsigned> ready(0);
+		std::atomic<bool> measuring(false);
+		std::atomic<bool> stop(false);
+		std::vector<worker_result_t> results(threads);
+		std::vector<std::thread> workers;
+		for (unsigned n = 0; n < threads; ++n) {
+			workers.emplace_back(runWorker, std::cref(options), n, std::ref(next_insert),
+				std::ref(ready), std::cref(measuring), std::cref(stop), std::ref(results[n]));
+		}
+		while (ready < threads) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(options.warmup_ms));
+
+		snapshot_t before = takeSnapshot(control, options, mysqld_pid);
+		int64_t start_us = nowUs();
+		measuring = true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(options.duration_ms));
+		measuring = false;
+		double seconds = (nowUs() - start_us) / 1e6;
+		snapshot_t after = takeSnapshot(control, options, mysqld_pid);
+		stop = true;
+		for (std::thread &worker: workers) {
+			worker.join();
+		}
+
+		unsigned connected = 0;
+		for (const worker_result_t &result: results) {
+			connected += result.connected;
+			if (!result.error.empty()) {
+				fprintf(stderr, "%u threads: %s\n", threads, result.error.c_str());
+				break;
+			}
+		}
+		reportStep(options, threads, results, seconds, before, after);
+		if (connected < threads) {
+			// e.g. max_connections: larger steps won't connect either
+			fprintf(stderr, "only %u of %u threads connected, stopping\n", connected, threads);
+			break;
+		}
+		// the next step starts from the same table
+		query(control, "DELETE FROM " + options.table + " WHERE id >= " +
+			std::to_string(options.rows), &error);
+	}
+
+	mysql_close(control);
+	server.stop();
+	mysql_library_end();
+	return 0;
+}
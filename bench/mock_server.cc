@@ -0,0 +1,1156 @@
+#include "mock_server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <random>
+
+#include <msgpuck.h>
+
+namespace tnt {
+namespace bench {
+
+namespace {
+
+// iproto header and body keys
+const uint64_t key_code = 0x00;
+const uint64_t key_sync = 0x01;
+const uint64_t key_schema_version = 0x05;
+const uint64_t key_space_id = 0x10;
+const uint64_t key_index_id = 0x11;
+const uint64_t key_limit = 0x12;
+const uint64_t key_offset = 0x13;
+const uint64_t key_iterator = 0x14;
+const uint64_t key_index_base = 0x15;
+const uint64_t key_key = 0x20;
+const uint64_t key_tuple = 0x21;
+const uint64_t key_function_name = 0x22;
+const uint64_t key_user_name = 0x23;
+const uint64_t key_expr = 0x27;
+const uint64_t key_ops = 0x28;
+const uint64_t key_data = 0x30;
+const uint64_t key_error = 0x31;
+const uint64_t key_padding = 0x7f; // unassigned, clients skip it
+
+// request types
+const uint32_t request_select = 1;
+const uint32_t request_insert = 2;
+const uint32_t request_replace = 3;
+const uint32_t request_update = 4;
+const uint32_t request_delete = 5;
+const uint32_t request_call_16 = 6;
+const uint32_t request_auth = 7;
+const uint32_t request_eval = 8;
+const uint32_t request_upsert = 9;
+const uint32_t request_call = 10;
+const uint32_t request_ping = 64;
+
+const uint32_t reply_error_flag = 0x8000;
+
+// Tarantool error codes
+const uint32_t er_illegal_params = 1;
+const uint32_t er_tuple_found = 3;
+const uint32_t er_unsupported = 5;
+const uint32_t er_invalid_msgpack = 20;
+const uint32_t er_unknown_update_op = 28;
+const uint32_t er_proc_lua = 32;
+const uint32_t er_no_such_index = 35;
+const uint32_t er_no_such_space = 36;
+const uint32_t er_password_mismatch = 47;
+const uint32_t er_unknown_request_type = 48;
+const uint32_t er_cant_update_primary_key = 94;
+
+const int vspace_id = 281;
+const int vindex_id = 289;
+
+// index iterator types
+const uint64_t iter_eq = 0;
+const uint64_t iter_req = 1;
+const uint64_t iter_all = 2;
+const uint64_t iter_lt = 3;
+const uint64_t iter_le = 4;
+const uint64_t iter_ge = 5;
+const uint64_t iter_gt = 6;
+
+/// Appends msgpack values to a string
+struct encoder_t {
+	std::string out;
+
+	void array(uint32_t size)
+	{
+		char buffer[8];
+		out.append(buffer, mp_encode_array(buffer, size) - buffer);
+	}
+	void map(uint32_t size)
+	{
+		char buffer[8];
+		out.append(buffer, mp_encode_map(buffer, size) - buffer);
+	}
+	void unsignedInt(uint64_t value)
+	{
+		char buffer[16];
+		out.append(buffer, mp_encode_uint(buffer, value) - buffer);
+	}
+	void integer(int64_t value)
+	{
+		char buffer[16];
+		char *end = value < 0 ? mp_encode_int(buffer, value) : mp_encode_uint(buffer, value);
+		out.append(buffer, end - buffer);
+	}
+	void number(double value)
+	{
+		char buffer[16];
+		out.append(buffer, mp_encode_double(buffer, value) - buffer);
+	}
+	void boolean(bool value)
+	{
+		char buffer[4];
+		out.append(buffer, mp_encode_bool(buffer, value) - buffer);
+	}
+	void string(const char *value, std::size_t size)
+	{
+		std::size_t at = out.size();
+		out.resize(at + mp_sizeof_str(size));
+		mp_encode_str(&out[at], value, size);
+	}
+	void string(const std::string &value)
+	{
+		string(value.data(), value.size());
+	}
+	void raw(const char *begin, const char *end)
+	{
+		out.append(begin, end);
+	}
+};
+
+std::string encodedValue(const char *p)
+{
+	const char *end = p;
+	mp_next(&end);
+	return std::string(p, end);
+}
+
+// bytes taken by the msgpack uint prefix starting with this byte, 0 if invalid
+std::size_t lengthPrefixSize(unsigned char first)
+{
+	if (first <= 0x7f) {
+		return 1;
+	}
+	switch (first) {
+	case 0xcc: return 2;
+	case 0xcd: return 3;
+	case 0xce: return 5;
+	case 0xcf: return 9;
+	default: return 0;
+	}
+}
+
+bool readNumber(const char *&p, double &value)
+{
+	switch (mp_typeof(*p)) {
+	case MP_UINT:
+		value = static_cast<double>(mp_decode_uint(&p));
+		return true;
+	case MP_INT:
+		value = static_cast<double>(mp_decode_int(&p));
+		return true;
+	case MP_FLOAT:
+		value = mp_decode_float(&p);
+		return true;
+	case MP_DOUBLE:
+		value = mp_decode_double(&p);
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool isInteger(const char *p)
+{
+	return mp_typeof(*p) == MP_UINT || mp_typeof(*p) == MP_INT;
+}
+
+int64_t readInteger(const char *p)
+{
+	return mp_typeof(*p) == MP_UINT ? static_cast<int64_t>(mp_decode_uint(&p)) : mp_decode_int(&p);
+}
+
+/**
+ * Applies update operations ([op, field_no, argument...]) to a tuple:
+ * '=' assigns, '+' and '-' add, '!' inserts before and '#' deletes fields.
+ * Negative field numbers count from the end, as in Tarantool.
+ */
+bool applyOps(const std::string &tuple, const char *ops, uint64_t index_base,
+		std::string &updated, uint32_t &error_code, std::string &error)
+{
+	std::vector<std::string> fields;
+	const char *p = tuple.data();
+	uint32_t fields_number = mp_decode_array(&p);
+	for (uint32_t i = 0; i < fields_number; ++i) {
+		fields.push_back(encodedValue(p));
+		mp_next(&p);
+	}
+
+	if (mp_typeof(*ops) != MP_ARRAY) {
+		error_code = er_illegal_params;
+		error = "Update operations must be an array";
+		return false;
+	}
+	uint32_t ops_number = mp_decode_array(&ops);
+	for (uint32_t n = 0; n < ops_number; ++n) {
+		if (mp_typeof(*ops) != MP_ARRAY) {
+			error_code = er_illegal_params;
+			error = "Update operation must be an array {op,..}";
+			return false;
+		}
+		const char *op = ops;
+		uint32_t args_number = mp_decode_array(&op);
+		mp_next(&ops);
+		if (args_number < 3 || mp_typeof(*op) != MP_STR) {
+			error_code = er_illegal_params;
+			error = "Update operation must be {op, field_no, argument}";
+			return false;
+		}
+		uint32_t name_size;
+		const char *name = mp_decode_str(&op, &name_size);
+		if (!isInteger(op)) {
+			error_code = er_illegal_params;
+			error = "Field number must be an integer";
+			return false;
+		}
+		int64_t field_no = readInteger(op);
+		mp_next(&op);
+		int64_t field = field_no < 0 ? static_cast<int64_t>(fields.size()) + field_no
+				: field_no - static_cast<int64_t>(index_base);
+		char code = name_size == 1 ? name[0] : '\0';
+		int64_t limit = static_cast<int64_t>(fields.size()) + (code == '=' || code == '!' ? 1 : 0);
+		if (field < 0 || field >= limit) {
+			error_code = er_illegal_params;
+			error = "Field " + std::to_string(field_no) + " was not found in the tuple";
+			return false;
+		}
+		std::size_t at = static_cast<std::size_t>(field);
+		switch (code) {
+		case '=':
+			if (at == fields.size()) {
+				fields.push_back(encodedValue(op));
+			} else {
+				fields[at] = encodedValue(op);
+			}
+			break;
+		case '!':
+			fields.insert(fields.begin() + at, encodedValue(op));
+			break;
+		case '#': {
+			int64_t count = isInteger(op) ? readInteger(op) : 0;
+			if (count <= 0) {
+				error_code = er_illegal_params;
+				error = "Delete count must be positive";
+				return false;
+			}
+			std::size_t last = std::min(fields.size(), at + static_cast<std::size_t>(count));
+			fields.erase(fields.begin() + at, fields.begin() + last);
+			break;
+		}
+		case '+':
+		case '-': {
+			const char *current = fields[at].data();
+			encoder_t result;
+			if (isInteger(current) && isInteger(op)) {
+				int64_t a = readInteger(current), b = readInteger(op);
+				result.integer(code == '+' ? a + b : a - b);
+			} else {
+				double a, b;
+				if (!readNumber(current, a) || !readNumber(op, b)) {
+					error_code = er_illegal_params;
+					error = "Argument of arithmetic operation must be a number";
+					return false;
+				}
+				result.number(code == '+' ? a + b : a - b);
+			}
+			fields[at] = result.out;
+			break;
+		}
+		default:
+			error_code = er_unknown_update_op;
+			error = "Unknown UPDATE operation";
+			return false;
+		}
+	}
+
+	encoder_t result;
+	result.array(static_cast<uint32_t>(fields.size()));
+	for (const std::string &field: fields) {
+		result.out += field;
+	}
+	updated = result.out;
+	return true;
+}
+
+}
+
+/// What the request body carries; absent keys keep their defaults
+struct MockServer::body_t {
+	uint64_t space_id = 0;
+	uint64_t index_id = 0;
+	uint64_t limit = UINT32_MAX;
+	uint64_t offset = 0;
+	uint64_t iterator = iter_eq;
+	uint64_t index_base = 0;
+	const char *key = nullptr;
+	const char *tuple = nullptr;
+	const char *ops = nullptr;
+	std::string function_name;
+	std::string user_name;
+	std::string expr;
+};
+
+bool MockServer::key_t::operator<(const key_t &other) const
+{
+	// numbers sort before strings, as in Tarantool's scalar type
+	if (is_string != other.is_string) {
+		return !is_string;
+	}
+	return is_string ? string < other.string : number < other.number;
+}
+
+class MockServer::Client
+{
+public:
+	Client(MockServer &server, int fd, uint64_t seed):
+		server(server),
+		fd(fd),
+		random(seed),
+		finished(false)
+	{
+		reader = std::thread(&Client::readLoop, this);
+		writer = std::thread(&Client::writeLoop, this);
+	}
+
+	~Client()
+	{
+		close();
+		reader.join();
+		writer.join();
+		::close(fd);
+	}
+
+	/// Both threads see the socket fail and exit
+	void close()
+	{
+		shutdown(fd, SHUT_RDWR);
+	}
+
+	bool done() const
+	{
+		return finished;
+	}
+private:
+	using clock_t = std::chrono::steady_clock;
+	struct reply_t {
+		clock_t::time_point due;
+		std::string packet;
+		bool disconnect; // close the connection instead of sending
+	};
+
+	MockServer &server;
+	int fd;
+	std::mt19937_64 random;
+	std::atomic<bool> finished;
+	std::thread reader;
+	std::thread writer;
+
+	std::mutex mutex;
+	std::condition_variable ready;
+	std::deque<reply_t> replies;
+	clock_t::time_point last_due;
+	bool closing = false;
+
+	bool send(const char *data, std::size_t size)
+	{
+		while (size > 0) {
+			ssize_t written = ::send(fd, data, size, MSG_NOSIGNAL);
+			if (written < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return false;
+			}
+			data += written;
+			size -= static_cast<std::size_t>(written);
+		}
+		return true;
+	}
+
+	void greet()
+	{
+		// version line and base64 salt, each padded to 63 bytes and a newline
+		std::string greeting = "Tarantool 1.10.0 (Binary) 00000000-0000-0000-0000-000000000000";
+		greeting.resize(63, ' ');
+		greeting += '\n';
+		std::string salt(43, 'A');
+		salt += '=';
+		salt.resize(63, ' ');
+		greeting += salt + '\n';
+		send(greeting.data(), greeting.size());
+	}
+
+	void enqueue(std::string packet, bool disconnect)
+	{
+		uint64_t delay_us = server.latency_us.load(std::memory_order_relaxed);
+		uint64_t jitter_us = server.jitter_us.load(std::memory_order_relaxed);
+		if (jitter_us > 0) {
+			delay_us += random() % (jitter_us + 1);
+		}
+		std::lock_guard<std::mutex> guard(mutex);
+		// replies leave in request order even when jitter would reorder them
+		last_due = std::max(last_due, clock_t::now() + std::chrono::microseconds(delay_us));
+		replies.push_back({last_due, std::move(packet), disconnect});
+		ready.notify_one();
+	}
+
+	// false when the connection is to be closed
+	bool handle(const char *packet, const char *end)
+	{
+		const char *check = packet;
+		if (mp_check(&check, end) != 0 || mp_typeof(*packet) != MP_MAP) {
+			return false;
+		}
+		uint64_t code = 0, sync = 0;
+		const char *p = packet;
+		uint32_t keys_number = mp_decode_map(&p);
+		for (uint32_t k = 0; k < keys_number; ++k) {
+			uint64_t key = mp_typeof(*p) == MP_UINT ? mp_decode_uint(&p) : (mp_next(&p), UINT64_MAX);
+			if (key == key_code && mp_typeof(*p) == MP_UINT) {
+				code = mp_decode_uint(&p);
+			} else if (key == key_sync && mp_typeof(*p) == MP_UINT) {
+				sync = mp_decode_uint(&p);
+			} else {
+				mp_next(&p);
+			}
+		}
+		const char *body = p;
+		if (body != end) {
+			check = body;
+			if (mp_check(&check, end) != 0) {
+				return false;
+			}
+		}
+
+		server.requests_count.fetch_add(1, std::memory_order_relaxed);
+		std::string data;
+		uint32_t error_code = 0;
+		std::string error;
+		// connecting is left alone, faults hit the requests that follow
+		if (code != request_auth) {
+			double disconnect = server.disconnect_rate.load(std::memory_order_relaxed);
+			double stall = server.stall_rate.load(std::memory_order_relaxed);
+			double failure = server.error_rate.load(std::memory_order_relaxed);
+			double draw = std::uniform_real_distribution<double>(0, 1)(random);
+			if (draw < disconnect) {
+				server.disconnects_count.fetch_add(1, std::memory_order_relaxed);
+				enqueue(std::string(), true);
+				return true;
+			} else if (draw < disconnect + stall) {
+				server.stalls_count.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			} else if (draw < disconnect + stall + failure) {
+				server.errors_count.fetch_add(1, std::memory_order_relaxed);
+				error_code = er_proc_lua;
+				error = "Injected error";
+			}
+		}
+		if (error_code == 0) {
+			server.execute(static_cast<uint32_t>(code), body, end, data, error_code, error);
+		}
+		enqueue(encodeReply(sync, server.schema_version.load(), error_code, error, data,
+				server.options.reply_padding), false);
+		return true;
+	}
+
+	void readLoop()
+	{
+		greet();
+		std::string input;
+		char chunk[64 * 1024];
+		bool ok = true;
+		while (ok) {
+			ssize_t got = ::recv(fd, chunk, sizeof chunk, 0);
+			if (got < 0 && errno == EINTR) {
+				continue;
+			}
+			if (got <= 0) {
+				break;
+			}
+			input.append(chunk, static_cast<std::size_t>(got));
+
+			std::size_t offset = 0;
+			while (ok && offset < input.size()) {
+				const char *begin = input.data() + offset;
+				const char *end = input.data() + input.size();
+				std::size_t prefix = lengthPrefixSize(static_cast<unsigned char>(*begin));
+				if (prefix == 0) {
+					ok = false;
+					break;
+				}
+				if (static_cast<std::size_t>(end - begin) < prefix) {
+					break;
+				}
+				const char *p = begin;
+				uint64_t length = mp_decode_uint(&p);
+				if (static_cast<uint64_t>(end - p) < length) {
+					break;
+				}
+				ok = handle(p, p + length);
+				offset += prefix + length;
+			}
+			input.erase(0, offset);
+		}
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			closing = true;
+		}
+		ready.notify_one();
+		finished = true;
+	}
+
+	void writeLoop()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;) {
+			ready.wait(lock, [this] { return closing || !replies.empty(); });
+			if (closing) {
+				break; // the client is gone, nobody reads the rest
+			}
+			clock_t::time_point due = replies.front().due;
+			if (ready.wait_until(lock, due, [this] { return closing; })) {
+				break;
+			}
+			reply_t reply = std::move(replies.front());
+			replies.pop_front();
+			lock.unlock();
+			bool ok = !reply.disconnect && send(reply.packet.data(), reply.packet.size());
+			lock.lock();
+			if (!ok) {
+				break;
+			}
+		}
+		lock.unlock();
+		close();
+	}
+};
+
+MockServer::MockServer(const options_t &options):
+	options(options),
+	latency_us(options.latency_us),
+	jitter_us(options.jitter_us),
+	error_rate(options.error_rate),
+	disconnect_rate(options.disconnect_rate),
+	stall_rate(options.stall_rate),
+	stopping(false),
+	schema_version(1),
+	connections_count(0),
+	requests_count(0),
+	errors_count(0),
+	disconnects_count(0),
+	stalls_count(0)
+{
+}
+
+MockServer::~MockServer()
+{
+	stop();
+}
+
+bool MockServer::start(std::string &error)
+{
+	if (options.unix_path.empty()) {
+		listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+		int on = 1;
+		setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+		struct sockaddr_in address;
+		memset(&address, 0, sizeof address);
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = 0;
+		socklen_t size = sizeof address;
+		if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&address), sizeof address) != 0 ||
+		    getsockname(listen_fd, reinterpret_cast<struct sockaddr*>(&address), &size) != 0) {
+			error = std::string("bind: ") + strerror(errno);
+			stop();
+			return false;
+		}
+		port = ntohs(address.sin_port);
+	} else {
+		listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		struct sockaddr_un address;
+		memset(&address, 0, sizeof address);
+		address.sun_family = AF_UNIX;
+		if (options.unix_path.size() >= sizeof address.sun_path) {
+			error = "unix socket path is too long";
+			stop();
+			return false;
+		}
+		strcpy(address.sun_path, options.unix_path.c_str());
+		unlink(options.unix_path.c_str());
+		if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&address), sizeof address) != 0) {
+			error = std::string("bind: ") + strerror(errno);
+			stop();
+			return false;
+		}
+	}
+	if (listen(listen_fd, 128) != 0) {
+		error = std::string("listen: ") + strerror(errno);
+		stop();
+		return false;
+	}
+	stopping = false;
+	acceptor = std::thread(&MockServer::acceptLoop, this);
+	return true;
+}
+
+void MockServer::stop()
+{
+	stopping = true;
+	if (acceptor.joinable()) {
+		acceptor.join();
+	}
+	if (listen_fd != -1) {
+		close(listen_fd);
+		listen_fd = -1;
+		if (!options.unix_path.empty()) {
+			unlink(options.unix_path.c_str());
+		}
+	}
+	std::lock_guard<std::mutex> guard(clients_mutex);
+	clients.clear(); // closes and joins
+}
+
+std::string MockServer::uri() const
+{
+	if (!options.unix_path.empty()) {
+		return "unix/:" + options.unix_path;
+	}
+	return "127.0.0.1:" + std::to_string(port);
+}
+
+void MockServer::acceptLoop()
+{
+	uint64_t accepted = 0;
+	while (!stopping) {
+		struct pollfd pfd = { listen_fd, POLLIN, 0 };
+		if (poll(&pfd, 1, 100) <= 0) {
+			continue;
+		}
+		int fd = accept(listen_fd, nullptr, nullptr);
+		if (fd < 0) {
+			continue;
+		}
+		if (options.unix_path.empty()) {
+			int on = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+		}
+		connections_count.fetch_add(1, std::memory_order_relaxed);
+		std::lock_guard<std::mutex> guard(clients_mutex);
+		// reap the connections that have been closed
+		clients.erase(std::remove_if(clients.begin(), clients.end(),
+				[](const std::unique_ptr<Client> &client) { return client->done(); }),
+			clients.end());
+		clients.emplace_back(new Client(*this, fd, options.seed + accepted++));
+	}
+}
+
+void MockServer::createSpace(int id, const std::string &name,
+		const std::vector<std::pair<std::string, std::string>> &format)
+{
+	std::lock_guard<std::mutex> guard(data_mutex);
+	space_t &space = spaces[id];
+	space.id = id;
+	space.name = name;
+	space.format = format;
+	space.tuples.clear();
+	schema_version.fetch_add(1);
+}
+
+void MockServer::populate(int space_id, uint64_t first_id, uint64_t rows,
+		unsigned width, std::size_t str_len)
+{
+	std::mt19937_64 random(options.seed);
+	std::lock_guard<std::mutex> guard(data_mutex);
+	auto found = spaces.find(space_id);
+	if (found == spaces.end()) {
+		return;
+	}
+	for (uint64_t id = first_id; id < first_id + rows; ++id) {
+		encoder_t tuple;
+		tuple.array(std::max(width, 1u));
+		tuple.unsignedInt(id);
+		for (unsigned field = 1; field < width; ++field) {
+			std::string value(str_len, 'a');
+			for (char &c: value) {
+				c = static_cast<char>('a' + random() % 26);
+			}
+			tuple.string(value);
+		}
+		key_t key;
+		key.is_string = false;
+		key.number = static_cast<long double>(id);
+		found->second.tuples[key] = tuple.out;
+	}
+}
+
+void MockServer::dropConnections()
+{
+	std::lock_guard<std::mutex> guard(clients_mutex);
+	for (auto &client: clients) {
+		client->close();
+	}
+}
+
+void MockServer::setFaults(double error_rate, double disconnect_rate, double stall_rate)
+{
+	this->error_rate = error_rate;
+	this->disconnect_rate = disconnect_rate;
+	this->stall_rate = stall_rate;
+}
+
+void MockServer::setLatency(uint64_t latency_us, uint64_t jitter_us)
+{
+	this->latency_us = latency_us;
+	this->jitter_us = jitter_us;
+}
+
+MockServer::counters_t MockServer::counters() const
+{
+	return {
+		connections_count.load(),
+		requests_count.load(),
+		errors_count.load(),
+		disconnects_count.load(),
+		stalls_count.load()
+	};
+}
+
+bool MockServer::decodeKey(const char *&p, key_t &key)
+{
+	key.is_string = false;
+	key.number = 0;
+	switch (mp_typeof(*p)) {
+	case MP_UINT:
+		key.number = static_cast<long double>(mp_decode_uint(&p));
+		return true;
+	case MP_INT:
+		key.number = static_cast<long double>(mp_decode_int(&p));
+		return true;
+	case MP_FLOAT:
+		key.number = mp_decode_float(&p);
+		return true;
+	case MP_DOUBLE:
+		key.number = mp_decode_double(&p);
+		return true;
+	case MP_STR: {
+		uint32_t size;
+		const char *value = mp_decode_str(&p, &size);
+		key.is_string = true;
+		key.string.assign(value, size);
+		return true;
+	}
+	default:
+		mp_next(&p);
+		return false;
+	}
+}
+
+void MockServer::execute(uint32_t code, const char *p, const char *end,
+		std::string &data, uint32_t &error_code, std::string &error)
+{
+	body_t body;
+	if (p != end) {
+		if (mp_typeof(*p) != MP_MAP) {
+			error_code = er_invalid_msgpack;
+			error = "Invalid MsgPack - request body";
+			return;
+		}
+		uint32_t keys_number = mp_decode_map(&p);
+		for (uint32_t k = 0; k < keys_number; ++k) {
+			if (mp_typeof(*p) != MP_UINT) {
+				mp_next(&p);
+				mp_next(&p);
+				continue;
+			}
+			uint64_t key = mp_decode_uint(&p);
+			bool is_uint = mp_typeof(*p) == MP_UINT;
+			bool is_str = mp_typeof(*p) == MP_STR;
+			uint32_t size = 0;
+			switch (key) {
+			case key_space_id: if (is_uint) body.space_id = mp_decode_uint(&p); else mp_next(&p); break;
+			case key_index_id: if (is_uint) body.index_id = mp_decode_uint(&p); else mp_next(&p); break;
+			case key_limit: if (is_uint) body.limit = mp_decode_uint(&p); else mp_next(&p); break;
+			case key_offset: if (is_uint) body.offset = mp_decode_uint(&p); else mp_next(&p); break;
+			case key_iterator: if (is_uint) body.iterator = mp_decode_uint(&p); else mp_next(&p); break;
+			case key_index_base: if (is_uint) body.index_base = mp_decode_uint(&p); else mp_next(&p); break;
+			case key_key: body.key = p; mp_next(&p); break;
+			case key_tuple: body.tuple = p; mp_next(&p); break;
+			case key_ops: body.ops = p; mp_next(&p); break;
+			case key_function_name:
+			case key_user_name:
+			case key_expr:
+				if (is_str) {
+					const char *value = mp_decode_str(&p, &size);
+					std::string &target = key == key_function_name ? body.function_name
+							: key == key_user_name ? body.user_name : body.expr;
+					target.assign(value, size);
+				} else {
+					mp_next(&p);
+				}
+				break;
+			default:
+				mp_next(&p);
+			}
+		}
+	}
+
+	encoder_t result;
+	switch (code) {
+	case request_select:
+		select(body, data, error_code, error);
+		break;
+	case request_insert:
+	case request_replace:
+	case request_update:
+	case request_delete:
+	case request_upsert:
+		write(code, body, data, error_code, error);
+		break;
+	case request_call_16:
+	case request_call: {
+		// every function echoes its arguments, as a tuple for the old call
+		const char *args = body.tuple;
+		std::string echoed = args && mp_typeof(*args) == MP_ARRAY ? encodedValue(args) : "\x90";
+		if (code == request_call_16) {
+			result.array(1);
+		}
+		result.out += echoed;
+		data = result.out;
+		break;
+	}
+	case request_eval:
+		if (body.expr.find("box.info.replication") != std::string::npos) {
+			// the replication lag probe of tnt::Connection: a master that lags 0s
+			result.array(1);
+			result.number(0);
+		} else {
+			const char *args = body.tuple;
+			result.out = args && mp_typeof(*args) == MP_ARRAY ? encodedValue(args) : "\x90";
+		}
+		data = result.out;
+		break;
+	case request_auth:
+		if (options.reject_auth) {
+			error_code = er_password_mismatch;
+			error = "Incorrect password supplied for user '" + body.user_name + "'";
+		}
+		break;
+	case request_ping:
+		break;
+	default:
+		error_code = er_unknown_request_type;
+		error = "Unknown request type " + std::to_string(code);
+	}
+}
+
+void MockServer::select(const body_t &body, std::string &data,
+		uint32_t &error_code, std::string &error)
+{
+	key_t key;
+	bool has_key = false;
+	if (body.key && mp_typeof(*body.key) == MP_ARRAY) {
+		const char *p = body.key;
+		if (mp_decode_array(&p) > 0) {
+			if (!decodeKey(p, key)) {
+				error_code = er_illegal_params;
+				error = "Supplied key type is invalid";
+				return;
+			}
+			has_key = true;
+		}
+	}
+
+	std::lock_guard<std::mutex> guard(data_mutex);
+	int space_id = static_cast<int>(body.space_id);
+	if (space_id == vspace_id || space_id == vindex_id) {
+		systemSelect(space_id, static_cast<int>(body.index_id), has_key ? &key : nullptr, data);
+		return;
+	}
+	auto found = spaces.find(space_id);
+	if (found == spaces.end()) {
+		error_code = er_no_such_space;
+		error = "Space '" + std::to_string(space_id) + "' does not exist";
+		return;
+	}
+	const space_t &space = found->second;
+	if (body.index_id != 0) {
+		error_code = er_no_such_index;
+		error = "No index #" + std::to_string(body.index_id) + " is defined in space '" + space.name + "'";
+		return;
+	}
+
+	std::vector<const std::string*> matches;
+	uint64_t skipped = 0;
+	auto take = [&](const std::string &tuple) {
+		if (skipped < body.offset) {
+			++skipped;
+			return true;
+		}
+		if (matches.size() >= body.limit) {
+			return false;
+		}
+		matches.push_back(&tuple);
+		return true;
+	};
+	uint64_t iterator = body.iterator;
+	if (!has_key && iterator != iter_lt && iterator != iter_le) {
+		iterator = iter_all;
+	}
+	switch (iterator) {
+	case iter_eq:
+	case iter_req: {
+		auto it = space.tuples.find(key);
+		if (it != space.tuples.end()) {
+			take(it->second);
+		}
+		break;
+	}
+	case iter_all:
+		for (auto it = space.tuples.begin(); it != space.tuples.end() && take(it->second); ++it) {
+		}
+		break;
+	case iter_ge:
+	case iter_gt: {
+		auto it = iterator == iter_ge ? space.tuples.lower_bound(key) : space.tuples.upper_bound(key);
+		for (; it != space.tuples.end() && take(it->second); ++it) {
+		}
+		break;
+	}
+	case iter_le:
+	case iter_lt: {
+		auto it = !has_key ? space.tuples.end()
+				: iterator == iter_le ? space.tuples.upper_bound(key) : space.tuples.lower_bound(key);
+		while (it != space.tuples.begin()) {
+			--it;
+			if (!take(it->second)) {
+				break;
+			}
+		}
+		break;
+	}
+	default:
+		error_code = er_unsupported;
+		error = "Index 'primary' does not support iterator " + std::to_string(iterator);
+		return;
+	}
+
+	encoder_t result;
+	result.array(static_cast<uint32_t>(matches.size()));
+	for (const std::string *tuple: matches) {
+		result.out += *tuple;
+	}
+	data = result.out;
+}
+
+void MockServer::write(uint32_t code, const body_t &body, std::string &data,
+		uint32_t &error_code, std::string &error)
+{
+	// inserts, replaces and upserts are keyed by the tuple, the others by the key
+	bool by_tuple = code == request_insert || code == request_replace || code == request_upsert;
+	const char *source = by_tuple ? body.tuple : body.key;
+	key_t key;
+	const char *p = source;
+	if (!p || mp_typeof(*p) != MP_ARRAY || mp_decode_array(&p) == 0 || !decodeKey(p, key)) {
+		error_code = er_illegal_params;
+		error = by_tuple ? "Tuple field 1 type does not match one required by operation"
+				: "Supplied key type is invalid";
+		return;
+	}
+
+	std::lock_guard<std::mutex> guard(data_mutex);
+	auto found = spaces.find(static_cast<int>(body.space_id));
+	if (found == spaces.end()) {
+		error_code = body.space_id == vspace_id || body.space_id == vindex_id ? er_unsupported
+				: er_no_such_space;
+		error = "Space '" + std::to_string(body.space_id) + "' can't be modified here";
+		return;
+	}
+	space_t &space = found->second;
+	auto existing = space.tuples.find(key);
+	encoder_t result;
+	switch (code) {
+	case request_insert:
+		if (existing != space.tuples.end()) {
+			error_code = er_tuple_found;
+			error = "Duplicate key exists in unique index 'primary' in space '" + space.name + "'";
+			return;
+		}
+		// fall through
+	case request_replace:
+		space.tuples[key] = encodedValue(body.tuple);
+		result.array(1);
+		result.out += encodedValue(body.tuple);
+		break;
+	case request_delete:
+		if (existing == space.tuples.end()) {
+			result.array(0);
+		} else {
+			result.array(1);
+			result.out += existing->second;
+			space.tuples.erase(existing);
+		}
+		break;
+	case request_update:
+	case request_upsert: {
+		const char *ops = code == request_update ? body.tuple : body.ops;
+		if (existing == space.tuples.end()) {
+			if (code == request_upsert) {
+				space.tuples[key] = encodedValue(body.tuple);
+			}
+			result.array(0);
+			break;
+		}
+		if (!ops) {
+			error_code = er_illegal_params;
+			error = "Missing update operations";
+			return;
+		}
+		std::string updated;
+		if (!applyOps(existing->second, ops, body.index_base, updated, error_code, error)) {
+			return;
+		}
+		const char *first = updated.data();
+		key_t updated_key;
+		if (mp_decode_array(&first) == 0 || !decodeKey(first, updated_key) ||
+		    key < updated_key || updated_key < key) {
+			error_code = er_cant_update_primary_key;
+			error = "Attempt to modify a tuple field which is part of index 'primary' in space '" + space.name + "'";
+			return;
+		}
+		existing->second = updated;
+		// upsert returns nothing
+		if (code == request_update) {
+			result.array(1);
+			result.out += updated;
+		} else {
+			result.array(0);
+		}
+		break;
+	}
+	}
+	data = result.out;
+}
+
+// _vspace: [id, owner, name, engine, field_count, flags, format]
+// _vindex: [space_id, index_id, name, type, opts, parts]
+void MockServer::systemSelect(int space_id, int index_id, const key_t *key, std::string &data) const
+{
+	std::vector<const space_t*> matches;
+	for (const auto &space: spaces) {
+		if (!key) {
+			matches.push_back(&space.second);
+		} else if (space_id == vspace_id && index_id == 2) {
+			if (key->is_string && key->string == space.second.name) {
+				matches.push_back(&space.second);
+			}
+		} else if (!key->is_string && key->number == space.first) {
+			matches.push_back(&space.second);
+		}
+	}
+
+	encoder_t result;
+	result.array(static_cast<uint32_t>(matches.size()));
+	for (const space_t *space: matches) {
+		if (space_id == vspace_id) {
+			result.array(7);
+			result.unsignedInt(space->id);
+			result.unsignedInt(1);
+			result.string(space->name);
+			result.string("memtx");
+			result.unsignedInt(0);
+			result.map(0);
+			result.array(static_cast<uint32_t>(space->format.size()));
+			for (const auto &field: space->format) {
+				result.map(2);
+				result.string("name");
+				result.string(field.first);
+				result.string("type");
+				result.string(field.second);
+			}
+		} else {
+			result.array(6);
+			result.unsignedInt(space->id);
+			result.unsignedInt(0);
+			result.string("primary");
+			result.string("tree");
+			result.map(1);
+			result.string("unique");
+			result.boolean(true);
+			result.array(1);
+			result.array(2);
+			result.unsignedInt(0);
+			result.string(space->format.empty() ? "scalar" : space->format.front().second);
+		}
+	}
+	data = result.out;
+}
+
+std::string MockServer::encodeReply(uint64_t sync, uint64_t schema_version,
+		uint32_t error_code, const std::string &error, const std::string &data,
+		std::size_t padding)
+{
+	encoder_t packet;
+	packet.map(3);
+	packet.unsignedInt(key_code);
+	packet.unsignedInt(error_code ? reply_error_flag | error_code : 0);
+	packet.unsignedInt(key_sync);
+	packet.unsignedInt(sync);
+	packet.unsignedInt(key_schema_version);
+	packet.unsignedInt(schema_version);
+
+	uint32_t body_keys = (error_code || !data.empty() ? 1 : 0) + (padding ? 1 : 0);
+	packet.map(body_keys);
+	if (error_code) {
+		packet.unsignedInt(key_error);
+		packet.string(error);
+	} else if (!data.empty()) {
+		packet.unsignedInt(key_data);
+		packet.out += data;
+	}
+	if (padding) {
+		packet.unsignedInt(key_padding);
+		packet.string(std::string(padding, 'x'));
+	}
+
+	// Tarantool always sends the length as a 5 byte uint32
+	uint32_t length = static_cast<uint32_t>(packet.out.size());
+	char prefix[5] = {
+		static_cast<char>(0xce),
+		static_cast<char>(length >> 24),
+		static_cast<char>(length >> 16),
+		static_cast<char>(length >> 8),
+		static_cast<char>(length)
+	};
+	return std::string(prefix, sizeof prefix) + packet.out;
+}
+
+}
+}
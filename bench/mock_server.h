@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace tnt {
+namespace bench {
+
+/**
+ * In-process stand-in for a Tarantool instance speaking iproto.
+ *
+ * It sends the greeting, accepts any credentials, and serves select,
+ * insert, replace, update, delete, call, eval and ping. Spaces live in
+ * memory with one primary index on their first field. The _vspace and
+ * _vindex views are generated from them, so tnt::Connection resolves names
+ * as it would against a real server.
+ *
+ * Every client connection has a reader thread, which executes requests in
+ * arrival order, and a writer thread, which sends the replies once the
+ * injected latency has passed. Replies keep their order, as Tarantool's do
+ * on one connection. The fault rates draw from a generator seeded per
+ * connection, so a run can be repeated exactly.
+ */
+class MockServer
+{
+public:
+	struct options_t {
+		std::string unix_path;      // 127.0.0.1 on an ephemeral port when empty
+		uint64_t latency_us = 0;    // added to every reply
+		uint64_t jitter_us = 0;     // plus up to this much, uniformly
+		std::size_t reply_padding = 0; // bytes of an unknown body key clients skip
+		double error_rate = 0;      // share of requests answered with an error
+		double disconnect_rate = 0; // share of requests that close the connection instead
+		double stall_rate = 0;      // share of requests never answered
+		bool reject_auth = false;
+		uint64_t seed = 1;
+	};
+
+	/// Fault injection counters since start()
+	struct counters_t {
+		uint64_t connections;
+		uint64_t requests;
+		uint64_t errors;
+		uint64_t disconnects;
+		uint64_t stalls;
+	};
+
+	explicit MockServer(const options_t &options);
+	~MockServer();
+
+	bool start(std::string &error);
+	void stop();
+	/// What tnt::Connection::connect() takes: "127.0.0.1:port" or "unix/:path"
+	std::string uri() const;
+
+	/// A space with a primary index on field 0; bumps the schema version
+	void createSpace(int id, const std::string &name,
+			const std::vector<std::pair<std::string, std::string>> &format);
+	/// Replaces rows [first_id, first_id + rows) with [id, "str"...] tuples of the given width
+	void populate(int space_id, uint64_t first_id, uint64_t rows,
+			unsigned width, std::size_t str_len);
+
+	/// Closes every client connection now, e.g. to measure reconnects
+	void dropConnections();
+	/// Takes effect for the requests received from now on
+	void setFaults(double error_rate, double disconnect_rate, double stall_rate);
+	void setLatency(uint64_t latency_us, uint64_t jitter_us);
+
+	counters_t counters() const;
+private:
+	class Client;
+	struct body_t; // the fields of a request body
+	struct key_t {
+		bool is_string;
+		long double number;
+		std::string string;
+		bool operator<(const key_t &other) const;
+	};
+	struct space_t {
+		int id;
+		std::string name;
+		std::vector<std::pair<std::string, std::string>> format; // name, type
+		std::map<key_t, std::string> tuples; // by field 0
+	};
+
+	options_t options;
+	std::atomic<uint64_t> latency_us;
+	std::atomic<uint64_t> jitter_us;
+	std::atomic<double> error_rate;
+	std::atomic<double> disconnect_rate;
+	std::atomic<double> stall_rate;
+
+	int listen_fd = -1;
+	int port = 0;
+	std::atomic<bool> stopping;
+	std::thread acceptor;
+
+	mutable std::mutex clients_mutex;
+	std::vector<std::unique_ptr<Client>> clients;
+
+	mutable std::mutex data_mutex;
+	std::map<int, space_t> spaces;
+	std::atomic<uint64_t> schema_version;
+
+	std::atomic<uint64_t> connections_count;
+	std::atomic<uint64_t> requests_count;
+	std::atomic<uint64_t> errors_count;
+	std::atomic<uint64_t> disconnects_count;
+	std::atomic<uint64_t> stalls_count;
+
+	void acceptLoop();
+	/// Runs one request; data is the msgpack array of the reply, empty for none
+	void execute(uint32_t code, const char *body, const char *body_end,
+			std::string &data, uint32_t &error_code, std::string &error);
+	void select(const body_t &body, std::string &data,
+			uint32_t &error_code, std::string &error);
+	void write(uint32_t code, const body_t &body, std::string &data,
+			uint32_t &error_code, std::string &error);
+	void systemSelect(int space_id, int index_id, const key_t *key, std::string &data) const;
+
+	static bool decodeKey(const char *&p, key_t &key);
+	static std::string encodeReply(uint64_t sync, uint64_t schema_version,
+			uint32_t error_code, const std::string &error, const std::string &data,
+			std::size_t padding);
+};
+
+}
+}
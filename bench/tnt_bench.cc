@@ -0,0 +1,358 @@
+/*
+ * Micro-benchmarks of the tnt:: encode/decode hot paths: TupleBuilder
+ * encoding, Row::eatData decoding and Iterator traversal of replies, over
+ * synthetic tuples of varying width, field types and string lengths.
+ *
+ * Every case prints one JSON object per line:
+ *   {"bench":"decode","types":"mixed","width":8,"str_len":64,"rows":...,
+ *    "ns_per_row":...,"mb_per_s":...,"allocs_per_row":...,"alloc_bytes_per_row":...}
+ *
+ * Usage: tnt_bench [--min-time-ms=N] [--rows=N] [--filter=SUBSTRING]
+ * where the filter matches "bench/types/wWIDTH/sSTR_LEN".
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <msgpuck.h>
+
+#include "buffer_pool.h"
+#include "iterator.h"
+#include "row.h"
+#include "tuple_builder.h"
+
+namespace {
+
+// single-threaded, so plain counters will do
+uint64_t allocations = 0;
+uint64_t allocated_bytes = 0;
+
+// keeps the optimizer from dropping the measured work
+volatile uint64_t sink = 0;
+
+enum field_types_t {
+	TYPES_INT,
+	TYPES_STR,
+	TYPES_MIXED // int, string, bool, nil in turn
+};
+
+const char *typesName(field_types_t types)
+{
+	switch (types) {
+	case TYPES_INT: return "int";
+	case TYPES_STR: return "str";
+	default: return "mixed";
+	}
+}
+
+struct shape_t {
+	field_types_t types;
+	unsigned width;
+	unsigned str_len;
+
+	field_types_t fieldType(unsigned field) const
+	{
+		if (types != TYPES_MIXED) {
+			return types;
+		}
+		return field % 4 == 1 ? TYPES_STR : TYPES_INT;
+	}
+	bool fieldIsBool(unsigned field) const { return types == TYPES_MIXED && field % 4 == 2; }
+	bool fieldIsNil(unsigned field) const { return types == TYPES_MIXED && field % 4 == 3; }
+
+	/// Upper bound of one encoded tuple
+	std::size_t maxTupleSize() const
+	{
+		return 5 + width * (str_len + 9);
+	}
+};
+
+struct options_t {
+	uint64_t min_time_ms = 200;
+	unsigned rows = 1000;
+	std::string filter;
+};
+
+struct result_t {
+	uint64_t rows = 0;
+	uint64_t bytes = 0;
+	uint64_t ns = 0;
+	uint64_t allocations = 0;
+	uint64_t allocated_bytes = 0;
+};
+
+/// Values the tuples are made of, generated once so generation isn't measured
+struct dataset_t {
+	shape_t shape;
+	std::vector<int64_t> ints;
+	std::vector<std::string> strings;
+	std::string reply; // msgpack array of all the tuples, as a select returns it
+
+	dataset_t(const shape_t &shape, unsigned rows):
+		shape(shape)
+	{
+		uint64_t state = 0x9e3779b97f4a7c15ULL;
+		auto next = [&state]() {
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			return state;
+		};
+		std::size_t values = static_cast<std::size_t>(rows) * shape.width;
+		ints.reserve(values);
+		strings.reserve(values);
+		for (std::size_t n = 0; n < values; ++n) {
+			// a spread of msgpack int widths, negative ones included
+			int64_t value = static_cast<int64_t>((next() >> 1) >> (next() % 63));
+			ints.push_back(n % 5 == 0 ? -value : value);
+			std::string s(shape.str_len, 'a');
+			for (char &c: s) {
+				c = static_cast<char>('a' + next() % 26);
+			}
+			strings.push_back(s);
+		}
+
+		std::vector<char> buffer(5 + static_cast<std::size_t>(rows) * shape.maxTupleSize());
+		char *p = mp_encode_array(buffer.data(), rows);
+		for (unsigned row = 0; row < rows; ++row) {
+			p = mp_encode_array(p, shape.width);
+			for (unsigned field = 0; field < shape.width; ++field) {
+				std::size_t n = static_cast<std::size_t>(row) * shape.width + field;
+				if (shape.fieldIsBool(field)) {
+					p = mp_encode_bool(p, ints[n] & 1);
+				} else if (shape.fieldIsNil(field)) {
+					p = mp_encode_nil(p);
+				} else if (shape.fieldType(field) == TYPES_STR) {
+					p = mp_encode_str(p, strings[n].data(), strings[n].size());
+				} else if (ints[n] < 0) {
+					p = mp_encode_int(p, ints[n]);
+				} else {
+					p = mp_encode_uint(p, ints[n]);
+				}
+			}
+		}
+		reply.assign(buffer.data(), p);
+	}
+};
+
+uint64_t nowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+}
+
+/// Runs pass() (one pass over all rows) until min_time_ms has elapsed
+result_t measure(const options_t &options, unsigned rows, uint64_t bytes_per_pass,
+		const std::function<void()> &pass)
+{
+	pass(); // warm up the caches and the buffer pool
+
+	result_t result;
+	uint64_t allocations_before = allocations;
+	uint64_t allocated_bytes_before = allocated_bytes;
+	uint64_t start = nowNs();
+	uint64_t deadline = start + options.min_time_ms * 1000000;
+	uint64_t now = start;
+	do {
+		pass();
+		result.rows += rows;
+		result.bytes += bytes_per_pass;
+		now = nowNs();
+	} while (now < deadline);
+	result.ns = now - start;
+	result.allocations = allocations - allocations_before;
+	result.allocated_bytes = allocated_bytes - allocated_bytes_before;
+	return result;
+}
+
+void report(const char *bench, const shape_t &shape, const result_t &result)
+{
+	double rows = static_cast<double>(result.rows);
+	printf("{\"bench\":\"%s\",\"types\":\"%s\",\"width\":%u,\"str_len\":%u,"
+		"\"rows\":%llu,\"ns_per_row\":%.2f,\"mb_per_s\":%.2f,"
+		"\"allocs_per_row\":%.3f,\"alloc_bytes_per_row\":%.1f}\n",
+		bench, typesName(shape.types), shape.width, shape.str_len,
+		(unsigned long long) result.rows, result.ns / rows,
+		result.ns ? result.bytes * 1000.0 / result.ns : 0.0,
+		result.allocations / rows, result.allocated_bytes / rows);
+	fflush(stdout);
+}
+
+bool selected(const options_t &options, const char *bench, const shape_t &shape)
+{
+	if (options.filter.empty()) {
+		return true;
+	}
+	char name[128];
+	snprintf(name, sizeof name, "%s/%s/w%u/s%u",
+			bench, typesName(shape.types), shape.width, shape.str_len);
+	return strstr(name, options.filter.c_str()) != nullptr;
+}
+
+// the engine's write_row()/update_row() path
+void benchEncode(const options_t &options, const dataset_t &data, unsigned rows)
+{
+	const shape_t &shape = data.shape;
+	// TupleBuilder has a fixed 1024 byte buffer
+	if (shape.maxTupleSize() > 1000 || !selected(options, "encode", shape)) {
+		return;
+	}
+	uint64_t bytes = 0;
+	auto pass = [&]() {
+		bytes = 0;
+		for (unsigned row = 0; row < rows; ++row) {
+			tnt::TupleBuilder builder(shape.width);
+			for (unsigned field = 0; field < shape.width; ++field) {
+				std::size_t n = static_cast<std::size_t>(row) * shape.width + field;
+				if (shape.fieldIsBool(field)) {
+					builder.push(static_cast<bool>(data.ints[n] & 1));
+				} else if (shape.fieldIsNil(field)) {
+					builder.pushNull();
+				} else if (shape.fieldType(field) == TYPES_STR) {
+					builder.push(data.strings[n].data(), data.strings[n].size());
+				} else {
+					builder.push(data.ints[n]);
+				}
+			}
+			bytes += builder.size();
+			sink = sink + static_cast<unsigned char>(builder.ptr()[builder.size() - 1]);
+		}
+	};
+	pass();
+	report("encode", shape, measure(options, rows, bytes, pass));
+}
+
+// Row::eatData() alone, straight over the msgpack of a reply
+void benchDecode(const options_t &options, const dataset_t &data, unsigned rows)
+{
+	if (!selected(options, "decode", data.shape)) {
+		return;
+	}
+	auto pass = [&]() {
+		const char *p = data.reply.data();
+		uint32_t count = mp_decode_array(&p);
+		for (uint32_t row = 0; row < count; ++row) {
+			std::shared_ptr<tnt::Row> decoded = tnt::Row::eatData(p);
+			sink = sink + decoded->getFieldNum();
+		}
+	};
+	report("decode", data.shape, measure(options, rows, data.reply.size(), pass));
+}
+
+// what rnd_next() does: a reply-backed Iterator, then every field read back
+void benchIterate(const options_t &options, const dataset_t &data, unsigned rows)
+{
+	if (!selected(options, "iterate", data.shape)) {
+		return;
+	}
+	auto pass = [&]() {
+		std::shared_ptr<tnt::Iterator> it = tnt::Iterator::makeFromData(data.reply);
+		while (*it) {
+			std::shared_ptr<tnt::Row> row = it->nextRow();
+			for (int field = 0; field < row->getFieldNum(); ++field) {
+				if (row->isInt(field)) {
+					sink = sink + row->getInt(field);
+				} else if (row->isString(field)) {
+					sink = sink + row->getString(field).size();
+				} else if (row->isBool(field)) {
+					sink = sink + row->getBool(field);
+				}
+			}
+		}
+	};
+	report("iterate", data.shape, measure(options, rows, data.reply.size(), pass));
+}
+
+options_t parseOptions(int argc, char **argv)
+{
+	options_t options;
+	for (int n = 1; n < argc; ++n) {
+		const char *arg = argv[n];
+		if (strncmp(arg, "--min-time-ms=", 14) == 0) {
+			options.min_time_ms = strtoull(arg + 14, nullptr, 10);
+		} else if (strncmp(arg, "--rows=", 7) == 0) {
+			options.rows = static_cast<unsigned>(strtoul(arg + 7, nullptr, 10));
+		} else if (strncmp(arg, "--filter=", 9) == 0) {
+			options.filter = arg + 9;
+		} else {
+			fprintf(stderr, "usage: %s [--min-time-ms=N] [--rows=N] [--filter=SUBSTRING]\n", argv[0]);
+			exit(1);
+		}
+	}
+	if (options.rows == 0) {
+		options.rows = 1;
+	}
+	return options;
+}
+
+}
+
+void *operator new(std::size_t size)
+{
+	++allocations;
+	allocated_bytes += size;
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void *operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept
+{
+	free(ptr);
+}
+
+int main(int argc, char **argv)
+{
+	options_t options = parseOptions(argc, argv);
+	// as in the plugin: replies come from the pool, not from malloc
+	tnt::BufferPool::install();
+
+	const unsigned widths[] = {1, 8, 32, 128};
+	const unsigned str_lens[] = {8, 64, 512};
+	std::vector<shape_t> shapes;
+	for (unsigned width: widths) {
+		shapes.push_back({TYPES_INT, width, 0});
+		for (unsigned str_len: str_lens) {
+			shapes.push_back({TYPES_STR, width, str_len});
+			shapes.push_back({TYPES_MIXED, width, str_len});
+		}
+	}
+
+	for (const shape_t &shape: shapes) {
+		dataset_t data(shape, options.rows);
+		benchEncode(options, data, options.rows);
+		benchDecode(options, data, options.rows);
+		benchIterate(options, data, options.rows);
+	}
+	return 0;
+}
@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stdarg.h>
 #include "mysqld_error.h"   // ER_INVALID_JSON_TEXT
 #include "sql_class.h"      // MYSQL_HANDLERTON_INTERFACE_VERSION
 #include "ha_mysqloluene.h"
@@ -8,6 +9,26 @@
 #include "tnt/iterator.h"
 #include "tnt/row.h"
 #include "tnt/tuple_builder.h"
+#include "tnt/buffer_pool.h"
+#include "tnt/schema_cache.h"
+#include "tnt/cluster.h"
+#include "tnt/hedging.h"
+#include "tnt/io_loop.h"
+#include "tnt/group_commit.h"
+#include "tnt/transaction.h"
+#include "tnt/session.h"
+#include "tnt/single_flight.h"
+#include "tnt/mirror.h"
+#include "tnt/offline_scan.h"
+#include "tnt/stats.h"
+#include "tnt/latency.h"
+#include "sql_show.h"       // schema_table_store_record
+#include "tnt/probes.h"
+#include "tnt/slow_log.h"
+#include "tnt/trace.h"
+#include "tnt/replica_set.h"
+#include "mysql/psi/mysql_stage.h"
+#include "mysql/psi/mysql_socket.h"
 
 static handler *create_handler(handlerton *hton,
                                        TABLE_SHARE *table,
@@ -15,32 +36,511 @@ static handler *create_handler(handlerton *hton,
 
 handlerton *example_hton;
 
+/* Read routing, see tnt::ReplicaSet */
+static my_bool srv_read_from_replicas= TRUE;
+static double srv_replica_max_lag= 1.0;
+static ulong srv_replica_retry_interval= 1000;
+
+/* Hedged point reads, see tnt::HedgePolicy */
+static my_bool srv_hedged_reads= FALSE;
+static double srv_hedge_percentile= 95.0;
+static ulong srv_hedge_min_delay= 1000;
+static ulong srv_hedge_timeout= 30000;
+
+/* Shared socket threads, see tnt::IoLoop; 0 means a socket per handler */
+static ulong srv_io_threads= 0;
+static ulong srv_io_request_timeout= 30000;
+
+/* Batching of concurrent autocommit writes, see tnt::GroupCommit */
+static my_bool srv_group_commit= FALSE;
+static ulong srv_group_commit_window= 200;
+static ulong srv_group_commit_max_batch= 64;
+
+/* Sharing of identical concurrent point reads, see tnt::SingleFlight */
+static my_bool srv_coalesce_reads= FALSE;
+
+/* Per-table cache of primary key lookups, see tnt::RowCache; 0 disables it */
+static ulonglong srv_row_cache_size= 0;
+static ulong srv_row_cache_ttl= 1000;
+
+/* Replication mirrors (?mirror=1), see tnt::Mirror */
+static ulong srv_mirror_max_staleness= 1000;
+
+/* Requests slower than the threshold (ms, 0 disables) go to the log, see tnt::SlowLog */
+static ulong srv_slow_request_threshold= 0;
+static char *srv_slow_request_log= const_cast<char*>("tarantool-slow.log");
+
+/* Setting it clears the histograms of INFORMATION_SCHEMA.TARANTOOL_LATENCY */
+static my_bool srv_latency_reset= FALSE;
+
+/* Level of the in-memory trace dumped by SHOW ENGINE TARANTOOL STATUS, see tnt::Trace */
+static ulong srv_trace_level= tnt::TRACE_OFF;
+
+/* Paged table scans, see tnt::PagedScan; a page size of 0 reads a space in one reply */
+static ulong srv_scan_page_size= 0;
+static ulong srv_scan_prefetch_depth= 2;
+static ulong srv_scan_prefetch_threads= 16;
+
 /* Interface to mysqld, to check system tables supported by SE */
 static const char* example_system_database();
 static bool example_is_supported_system_table(const char *db,
                                       const char *table_name,
                                       bool is_sql_layer_system_table);
 
-Mysqloluene_share::Mysqloluene_share()
+/* Partition of a "./db/t#P#p0" or "./db/t#P#p0#SP#s0" name, empty for a table */
+static std::string partitionOf(const char *name)
+{
+ std::string path(name);
+ size_t begin= path.find("#P#");
+ if (begin == std::string::npos)
+	 return std::string();
+ std::string partition= path.substr(begin + 3);
+ /* intermediate names of ALTER TABLE ... REORGANIZE PARTITION */
+ size_t suffix= partition.find("#TMP#");
+ if (suffix == std::string::npos)
+	 suffix= partition.find("#REN#");
+ if (suffix != std::string::npos)
+	 partition.erase(suffix);
+ return partition;
+}
+
+/* Replaces every "{name}" in text by value */
+static std::string expandPlaceholder(std::string text, const std::string &name,
+                                     const std::string &value)
+{
+ const std::string placeholder= "{" + name + "}";
+ for (size_t pos= text.find(placeholder); pos != std::string::npos;
+      pos= text.find(placeholder, pos + value.size()))
+	 text.replace(pos, placeholder.size(), value);
+ return text;
+}
+
+/* Splits "a,b,c"; an empty string yields one empty element */
+static std::vector<std::string> splitList(const std::string &list, char separator)
+{
+ std::vector<std::string> result;
+ for (size_t begin = 0; begin <= list.size(); ) {
+	 size_t end = list.find(separator, begin);
+	 if (end == std::string::npos) {
+		 end = list.size();
+	 }
+	 result.push_back(list.substr(begin, end - begin));
+	 begin = end + 1;
+ }
+ return result;
+}
+
+/* Per-session engine state, attached to the THD with thd_set_ha_data() */
+struct tarantool_thd_t
+{
+  tnt::Session session;         // connections shared by the session's handlers
+  tnt::Transaction transaction;
+};
+
+static tarantool_thd_t *get_thd_data(THD *thd)
+{
+  tarantool_thd_t *data=
+    static_cast<tarantool_thd_t*>(thd_get_ha_data(thd, example_hton));
+  if (!data) {
+    data= new tarantool_thd_t;
+    thd_set_ha_data(thd, example_hton, data);
+  }
+  return data;
+}
+
+static bool in_transaction(THD *thd)
+{
+  return thd_test_options(thd, OPTION_NOT_AUTOCOMMIT | OPTION_BEGIN);
+}
+
+/*
+  Statement ends call this with all == false; inside a multi-statement
+  transaction only the final COMMIT (all == true) applies the write set.
+*/
+static int tarantool_commit(handlerton *hton, THD *thd, bool all)
+{
+  DBUG_ENTER("tarantool_commit");
+  tarantool_thd_t *data= static_cast<tarantool_thd_t*>(thd_get_ha_data(thd, hton));
+  if (!data || (!all && in_transaction(thd))) {
+    DBUG_RETURN(0);
+  }
+  std::string error;
+  if (!data->transaction.commit(data->session, error)) {
+    /* the server adds its own ER_ERROR_DURING_COMMIT, this one says why */
+    my_printf_error(ER_ERROR_DURING_COMMIT, "Tarantool: commit failed: %s",
+                    MYF(0), error.c_str());
+    DBUG_RETURN(HA_ERR_GENERIC);
+  }
+  DBUG_RETURN(0);
+}
+
+static int tarantool_rollback(handlerton *hton, THD *thd, bool all)
+{
+  DBUG_ENTER("tarantool_rollback");
+  tarantool_thd_t *data= static_cast<tarantool_thd_t*>(thd_get_ha_data(thd, hton));
+  if (!data) {
+    DBUG_RETURN(0);
+  }
+  if (all || !in_transaction(thd)) {
+    data->transaction.rollback();
+  } else {
+    /* a failed statement inside a transaction: only its own writes go */
+    data->transaction.rollbackStatement();
+  }
+  DBUG_RETURN(0);
+}
+
+static int tarantool_close_connection(handlerton *hton, THD *thd)
+{
+  DBUG_ENTER("tarantool_close_connection");
+  delete static_cast<tarantool_thd_t*>(thd_get_ha_data(thd, hton));
+  thd_set_ha_data(thd, hton, NULL);
+  DBUG_RETURN(0);
+}
+
+/*
+  PARTITION BY goes through the server's generic partition handler: one
+  handler per partition, each mapped to its own space or instance, see
+  ha_mysqloluene::configure().
+*/
+static uint tarantool_partition_flags()
+{
+  return HA_CAN_PARTITION;
+}
+
+static void append_format(std::string &out, const char *format, ...)
+{
+  char line[512];
+  va_list args;
+  va_start(args, format);
+  int length= vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if (length > 0)
+    out.append(line, std::min<size_t>(length, sizeof(line) - 1));
+}
+
+static double hit_rate(uint64_t hits, uint64_t misses)
+{
+  return hits + misses ? 100.0 * hits / (hits + misses) : 0.0;
+}
+
+/* Endpoints with their connections and the requests they wait for, by age */
+static std::string endpoints_status()
+{
+  static const int64_t age_limits_us[]= { 1000, 10000, 100000, 1000000 };
+  static const char *age_names[]= { "<1ms", "<10ms", "<100ms", "<1s", ">=1s" };
+  struct endpoint_t {
+    std::shared_ptr<tnt::EndpointState> state;
+    size_t connections= 0, connected= 0, in_flight= 0;
+    uint64_t by_age[5]= { 0, 0, 0, 0, 0 };
+    int64_t oldest_us= -1;
+    tnt::latency_op_t oldest_op= tnt::LATENCY_SELECT;
+  };
+  std::map<std::string, endpoint_t> endpoints;
+  for (auto &state : tnt::EndpointState::all())
+    endpoints[state->uri].state= state;
+  for (const tnt::Connection::status_t &conn : tnt::Connection::status())
+  {
+    if (conn.endpoint.empty())
+      continue;
+    endpoint_t &e= endpoints[conn.endpoint];
+    e.connections++;
+    e.connected+= conn.connected;
+    for (const auto &pending : conn.pending)
+    {
+      size_t bucket= 0;
+      while (bucket < 4 && pending.second >= age_limits_us[bucket])
+        bucket++;
+      e.by_age[bucket]++;
+      e.in_flight++;
+      if (pending.second > e.oldest_us)
+      {
+        e.oldest_us= pending.second;
+        e.oldest_op= pending.first;
+      }
+    }
+  }
+
+  std::string out;
+  for (const auto &e : endpoints)
+  {
+    append_format(out, "%s: %zu connection(s), %zu connected",
+                  e.first.c_str(), e.second.connections, e.second.connected);
+    if (e.second.state)
+      append_format(out, ", %d outstanding, down for %lld ms, lag %.3f s",
+                    e.second.state->outstanding.load(),
+                    (long long) e.second.state->downForMs(),
+                    e.second.state->lag.load());
+    append_format(out, "\n  in flight %zu:", e.second.in_flight);
+    for (int bucket= 0; bucket < 5; bucket++)
+      append_format(out, " %s %llu", age_names[bucket],
+                    (unsigned long long) e.second.by_age[bucket]);
+    if (e.second.oldest_us >= 0)
+      append_format(out, ", oldest %.3f ms (%s)", e.second.oldest_us / 1000.0,
+                    tnt::latencyOpName(e.second.oldest_op));
+    out+= '\n';
+  }
+  return out;
+}
+
+static std::string io_threads_status()
+{
+  tnt::IoLoop *loop= tnt::IoLoop::instance();
+  if (!loop)
+    return "not running\n";
+  std::string out;
+  std::vector<tnt::IoLoop::worker_status_t> workers= loop->status();
+  for (size_t n= 0; n < workers.size(); n++)
+  {
+    append_format(out, "thread %zu: %zu queued\n", n, workers[n].queued);
+    for (const auto &up : workers[n].upstreams)
+      append_format(out, "  %s: %zu waiting for a reply, %zu bytes unsent\n",
+                    up.endpoint.c_str(), up.waiting, up.output_bytes);
+  }
+  return out;
+}
+
+static std::string schema_cache_status()
+{
+  tnt::SchemaCache &cache= tnt::SchemaCache::instance();
+  std::string out;
+  append_format(out, "%llu reload(s)\n", (unsigned long long) cache.reloads());
+  for (const auto &e : cache.status())
+    append_format(out, "%s: version %llu, %zu space(s) fetched\n",
+                  e.endpoint.c_str(), (unsigned long long) e.version, e.spaces);
+  return out;
+}
+
+static std::string caches_status()
+{
+  std::string out;
+  uint64_t hits= tnt::RowCache::totalHits(), misses= tnt::RowCache::totalMisses();
+  append_format(out, "row cache: %llu hit(s), %llu miss(es), hit rate %.1f%%, "
+                "%zu bytes, at most %llu per table\n",
+                (unsigned long long) hits, (unsigned long long) misses,
+                hit_rate(hits, misses), tnt::RowCache::totalBytes(),
+                (unsigned long long) srv_row_cache_size);
+  append_format(out, "buffer pool: %zu bytes allocated, peak %zu\n",
+                tnt::BufferPool::bytesAllocated(), tnt::BufferPool::peakBytes());
+  return out;
+}
+
+/* Tables with open shares: what their space id was resolved under and when */
+static std::string tables_status()
+{
+  tnt::SchemaCache &cache= tnt::SchemaCache::instance();
+  time_t now= time(NULL);
+  std::string out;
+  Mysqloluene_share::each([&](const Mysqloluene_share &share) {
+    append_format(out, "%s: ", share.name.c_str());
+    std::shared_ptr<const Mysqloluene_share::resolved_space_t> resolved=
+      std::atomic_load(&share.resolved);
+    if (!resolved)
+      out+= "space not resolved";
+    else
+    {
+      uint64_t version= resolved->schema_version;
+      append_format(out, "space %d on %s, schema version %llu (%s), resolved %lld s ago",
+                    resolved->space_id, share.endpoint.c_str(),
+                    (unsigned long long) version,
+                    version == cache.version(share.endpoint) ? "current" : "stale",
+                    (long long) (now - resolved->resolved_at));
+    }
+    uint64_t hits= share.row_cache->hitCount(), misses= share.row_cache->missCount();
+    append_format(out, "\n  row cache %llu/%llu (%.1f%%), %zu bytes",
+                  (unsigned long long) hits, (unsigned long long) (hits + misses),
+                  hit_rate(hits, misses), share.row_cache->bytes());
+    if (share.latency)
+    {
+      out+= "; requests";
+      for (int op= 0; op < tnt::LATENCY_OPS; op++)
+        append_format(out, " %s %llu",
+                      tnt::latencyOpName(static_cast<tnt::latency_op_t>(op)),
+                      (unsigned long long) share.latency->ops[op].count());
+    }
+    out+= '\n';
+  });
+  return out;
+}
+
+/*
+  SHOW ENGINE TARANTOOL STATUS. Every section is read while the engine
+  keeps running: counters are loaded without locks and registries are
+  locked one at a time just long enough to copy them.
+*/
+static bool tarantool_show_status(handlerton *hton, THD *thd,
+                                  stat_print_fn *stat_print,
+                                  enum ha_stat_type stat_type)
+{
+  if (stat_type != HA_ENGINE_STATUS)
+    return false;
+  const std::pair<const char*, std::string> sections[]= {
+    { "endpoints", endpoints_status() },
+    { "io_threads", io_threads_status() },
+    { "schema_cache", schema_cache_status() },
+    { "caches", caches_status() },
+    { "tables", tables_status() },
+    { "trace", tnt::Trace::dump(256) },
+  };
+  for (const auto &section : sections)
+  {
+    if (stat_print(thd, "TARANTOOL", 9, section.first, strlen(section.first),
+                   section.second.data(), section.second.size()))
+      return true;
+  }
+  return false;
+}
+
+std::mutex Mysqloluene_share::all_mutex;
+std::set<Mysqloluene_share*> Mysqloluene_share::all;
+
+Mysqloluene_share::Mysqloluene_share(const std::string &name,
+                                     const std::string &endpoint,
+                                     std::shared_ptr<tnt::LatencySet> latency)
+  : name(name),
+    endpoint(endpoint),
+    row_cache(std::make_shared<tnt::RowCache>()),
+    latency(std::move(latency))
 {
   thr_lock_init(&lock);
+  std::lock_guard<std::mutex> guard(all_mutex);
+  all.insert(this);
+}
+
+Mysqloluene_share::~Mysqloluene_share()
+{
+  {
+    std::lock_guard<std::mutex> guard(all_mutex);
+    all.erase(this);
+  }
+  thr_lock_delete(&lock);
+}
+
+
+#ifdef HAVE_PSI_INTERFACE
+/* performance_schema instruments, fed through tnt::Probes */
+static PSI_stage_info stage_encoding= { 0, "Tarantool: encoding request", 0};
+static PSI_stage_info stage_waiting= { 0, "Tarantool: waiting for reply", 0};
+static PSI_stage_info stage_decoding= { 0, "Tarantool: decoding reply", 0};
+static PSI_stage_info stage_converting= { 0, "Tarantool: converting rows", 0};
+
+/* indexed by tnt::Probes::stage_t */
+static PSI_stage_info *all_tarantool_stages[]=
+{
+  &stage_encoding,
+  &stage_waiting,
+  &stage_decoding,
+  &stage_converting
+};
+static_assert(array_elements(all_tarantool_stages) == tnt::Probes::STAGES_NUMBER,
+              "a PSI stage for every tnt::Probes stage");
+
+static PSI_socket_key key_socket_tarantool;
+
+static PSI_socket_info all_tarantool_sockets[]=
+{
+  { &key_socket_tarantool, "client_connection", 0}
+};
+
+static void psi_stage(tnt::Probes::stage_t stage)
+{
+  mysql_set_stage(all_tarantool_stages[stage]->m_key);
+}
+
+static void *psi_socket_open(int fd)
+{
+  my_socket socket= fd;
+  return PSI_SOCKET_CALL(init_socket)(key_socket_tarantool,
+                                      fd < 0 ? NULL : &socket, NULL, 0);
+}
+
+static void psi_socket_close(void *socket)
+{
+  PSI_SOCKET_CALL(destroy_socket)(static_cast<PSI_socket*>(socket));
+}
+
+static void *psi_io_start(void *socket, tnt::Probes::io_t io, void *state)
+{
+  static_assert(sizeof(PSI_socket_locker_state) <= tnt::Probes::state_size,
+                "tnt::Probes::Io must hold a socket locker state");
+  return PSI_SOCKET_CALL(start_socket_wait)(
+    static_cast<PSI_socket_locker_state*>(state), static_cast<PSI_socket*>(socket),
+    io == tnt::Probes::IO_SEND ? PSI_SOCKET_SEND : PSI_SOCKET_RECV,
+    0, __FILE__, __LINE__);
 }
 
+static void psi_io_end(void *locker, size_t bytes)
+{
+  PSI_SOCKET_CALL(end_socket_wait)(static_cast<PSI_socket_locker*>(locker), bytes);
+}
+
+static const tnt::Probes::hooks_t psi_hooks=
+{
+  psi_stage,
+  psi_socket_open,
+  psi_socket_close,
+  psi_io_start,
+  psi_io_end
+};
+
+static void init_tarantool_psi_keys()
+{
+  const char *category= "tarantool";
+  mysql_stage_register(category, all_tarantool_stages,
+                       array_elements(all_tarantool_stages));
+  mysql_socket_register(category, all_tarantool_sockets,
+                        array_elements(all_tarantool_sockets));
+}
+#endif /* HAVE_PSI_INTERFACE */
 
 static int example_init_func(void *p)
 {
   DBUG_ENTER("example_init_func");
 
+  tnt::BufferPool::install();
+#ifdef HAVE_PSI_INTERFACE
+  init_tarantool_psi_keys();
+  tnt::Probes::install(&psi_hooks);
+#endif
+  if (srv_io_threads > 0 && !tnt::IoLoop::start(srv_io_threads, srv_io_request_timeout)) {
+    sql_print_error("Tarantool: can't start %lu I/O threads", srv_io_threads);
+    DBUG_RETURN(1);
+  }
+  tnt::Trace::setLevel(static_cast<tnt::trace_level_t>(srv_trace_level));
+  tnt::PagedScan::setMaxPrefetchers(srv_scan_prefetch_threads);
+  tnt::SlowLog::setThresholdUs(srv_slow_request_threshold * 1000ULL);
+  if (srv_slow_request_log && *srv_slow_request_log &&
+      !tnt::SlowLog::start(srv_slow_request_log, 4096))
+    sql_print_warning("Tarantool: can't open the slow request log %s",
+                      srv_slow_request_log);
+
   example_hton= (handlerton *)p;
   example_hton->state=                     SHOW_OPTION_YES;
   example_hton->create=                    create_handler;
   example_hton->flags=                     HTON_CAN_RECREATE;
+  example_hton->partition_flags=           tarantool_partition_flags;
+  example_hton->commit=                    tarantool_commit;
+  example_hton->rollback=                  tarantool_rollback;
+  example_hton->close_connection=          tarantool_close_connection;
+  example_hton->show_status=               tarantool_show_status;
   example_hton->system_database=   example_system_database;
   example_hton->is_supported_system_table= example_is_supported_system_table;
 
   DBUG_RETURN(0);
 }
 
+static int example_deinit_func(void *p)
+{
+  DBUG_ENTER("example_deinit_func");
+
+  tnt::Mirror::stopAll();
+  tnt::IoLoop::stop();
+  tnt::Probes::install(NULL);
+  tnt::SlowLog::stop();
+
+  DBUG_RETURN(0);
+}
+
 
 /**
   @brief
@@ -59,7 +559,18 @@ Mysqloluene_share *ha_mysqloluene::get_share()
   lock_shared_ha_data();
   if (!(tmp_share= static_cast<Mysqloluene_share*>(get_ha_share_ptr())))
   {
-    tmp_share= new Mysqloluene_share;
+    std::string table_name=
+      std::string(table_share->db.str, table_share->db.length) + "." +
+      std::string(table_share->table_name.str, table_share->table_name.length);
+    /*
+      The share is visible to SHOW ENGINE TARANTOOL STATUS as soon as it is
+      constructed, so everything it reports is passed in. Partitions of a
+      table add up to the table's histograms.
+    */
+    tmp_share= new Mysqloluene_share(partition_name.empty() ? table_name
+                                       : table_name + "#P#" + partition_name,
+                                     connection_info.host_port_uri,
+                                     tnt::Latency::forTable(table_name));
     if (!tmp_share)
       goto err;
 
@@ -82,13 +593,72 @@ ha_mysqloluene::ha_mysqloluene(handlerton *hton, TABLE_SHARE *table_arg)
   :handler(hton, table_arg),
    share(0)
 {
-	if (table_arg) { // on create table is NULL
-		const st_mysql_lex_string &connection = table_arg->connect_string;
-		if (!parseConnectionString(std::string(connection.str, connection.length))) {
-		 sql_print_warning("Wrong schema'");
+	configure(std::string());
+}
+
+/*
+  Builds the cluster from the table's connection string. A partition
+  substitutes its name for "{partition}" (and "{subpartition}") in the
+  string, so every partition can map to its own space, and is sent to the
+  instances of a "partition.<name>=host:port" option when there is one.
+  A partition that gets neither would read and drop the data of the others,
+  so config_error refuses it, as it refuses range bounds that don't parse.
+*/
+void ha_mysqloluene::configure(const std::string &partition)
+{
+	partition_name = partition;
+	connection_info = connection_info_t();
+	config_error.clear();
+	if (table_share) { // on create table is NULL
+		const st_mysql_lex_string &connection = table_share->connect_string;
+		std::string connection_string(connection.str, connection.length);
+		if (!partition.empty()) {
+			size_t sub = partition.find("#SP#");
+			connection_string = expandPlaceholder(connection_string, "partition",
+			                                      partition.substr(0, sub));
+			if (sub != std::string::npos) {
+				connection_string = expandPlaceholder(connection_string, "subpartition",
+				                                      partition.substr(sub + 4));
+			}
+		}
+		if (!parseConnectionString(connection_string)) {
+		 sql_print_warning("Tarantool: wrong connection string '%s'", connection_string.c_str());
+		}
+		auto instances = connection_info.options.find("partition." + partition.substr(0, partition.find("#SP#")));
+		bool own_instances = false;
+		if (!partition.empty() && instances != connection_info.options.end()) {
+			std::vector<std::vector<std::string>> shared_shards;
+			shared_shards.swap(connection_info.shards);
+			if (!parseShards(instances->second)) {
+				sql_print_warning("Tarantool: wrong instances for partition %s", partition.c_str());
+			}
+			own_instances = connection_info.shards != shared_shards;
+			for (auto &option: connection_info.options) {
+				if (option.first != instances->first && option.first.compare(0, 10, "partition.") == 0 &&
+				    option.second == instances->second)
+					own_instances = false;
+			}
+		}
+		const std::string template_string(connection.str, connection.length);
+		if (partition.empty()) {
+			// not partitioned
+		} else if (template_string.find("{partition}") == std::string::npos && !own_instances) {
+			config_error = "partition " + partition + " would share its space with the other "
+			               "partitions: use {partition} in the connection string or give it "
+			               "instances of its own with partition." + partition.substr(0, partition.find("#SP#"));
+		} else if (partition.find("#SP#") != std::string::npos &&
+		           template_string.find("{subpartition}") == std::string::npos) {
+			config_error = "subpartition " + partition + " would share its space with the other "
+			               "subpartitions: use {subpartition} in the connection string";
 		}
 	}
-
+	cluster.reset(new tnt::Cluster(connection_info.shards));
+	/* hash sharding instead would put rows where the ranges don't */
+	if (connection_info.options["sharding"] == "range" &&
+	    !cluster->setRanges(splitList(connection_info.options["bounds"], ',')) &&
+	    config_error.empty()) {
+		config_error = cluster->lastError();
+	}
 }
 
 
@@ -199,10 +769,27 @@ int ha_mysqloluene::open(const char *name, int mode, uint test_if_locked)
 {
   DBUG_ENTER("ha_mysqloluene::open");
 
+  /* under PARTITION BY every partition gets a handler of its own */
+  std::string partition= partitionOf(name);
+  if (partition != partition_name)
+    configure(partition);
+  if (!config_error.empty()) {
+    my_printf_error(ER_UNKNOWN_ERROR, "Tarantool: %s", MYF(0), config_error.c_str());
+    DBUG_RETURN(HA_WRONG_CREATE_OPTION);
+  }
+
   if (!(share = get_share()))
     DBUG_RETURN(1);
   thr_lock_data_init(&share->lock,&lock,NULL);
 
+  /*
+    Resolve the space once per TABLE_SHARE. Failing here is not fatal:
+    the table must stay openable while Tarantool is down, statements will
+    retry the lookup.
+  */
+  if (!std::atomic_load(&share->resolved))
+    resolveSpace();
+
   DBUG_RETURN(0);
 }
 
@@ -225,6 +812,7 @@ int ha_mysqloluene::open(const char *name, int mode, uint test_if_locked)
 int ha_mysqloluene::close(void)
 {
   DBUG_ENTER("ha_mysqloluene::close");
+  cluster->bind(NULL); // the session's connections outlive the handler
   DBUG_RETURN(0);
 }
 
@@ -262,14 +850,8 @@ int ha_mysqloluene::close(void)
 int ha_mysqloluene::write_row(uchar *buf)
 {
   DBUG_ENTER("ha_mysqloluene::write_row");
-
-  if (!c.connected()) {
-	  c.connect(connection_info.host_port_uri);
-	  if (!c.connected()) {
-		  DBUG_PRINT("ha_mysqloluene::write_row", ("Not connected, no tarantool connection"));
-		  DBUG_RETURN(HA_ERR_NO_CONNECTION);
-	  }
-  }
+  MYSQL_INSERT_ROW_START(table_share->db.str, table_share->table_name.str);
+  tnt::Probes::stage(tnt::Probes::STAGE_ENCODING);
 
   my_bitmap_map *org_bitmap = dbug_tmp_use_all_columns(table, table->read_set);
 
@@ -282,7 +864,7 @@ int ha_mysqloluene::write_row(uchar *buf)
 		  switch ((*field)->type()) {
 			  case MYSQL_TYPE_LONG:
 				  builder.push((*field)->val_int());
-				  sql_print_warning("write_row: value int( %lld )", (*field)->val_int());
+				  TNT_TRACE(tnt::TRACE_DEBUG, "write_row: value int( %lld )", (*field)->val_int());
 				  break;
 			  case MYSQL_TYPE_STRING:
 			  case MYSQL_TYPE_VAR_STRING:
@@ -312,9 +894,102 @@ int ha_mysqloluene::write_row(uchar *buf)
 
   dbug_tmp_restore_column_map(table->read_set, org_bitmap);
 
-  if (!c.insert(connection_info.space_name, builder)) {
+  int rc= sendWrite(tnt::WRITE_INSERT, builder);
+  MYSQL_INSERT_ROW_DONE(rc);
+  DBUG_RETURN(rc);
+}
+
+
+/**
+  @brief
+  Sends a row write to the master of the shard owning the primary key,
+  through the group commit queue when tarantool_group_commit is on.
+*/
+int ha_mysqloluene::sendWrite(tnt::write_op_t op, const tnt::TupleBuilder &builder)
+{
+  DBUG_ENTER("ha_mysqloluene::sendWrite");
+  tnt::Latency::Scope latency_scope(share->latency.get());
+
+  tnt::ReplicaSet &shard= cluster->shardFor(builder);
+  tnt::Connection *c = shard.master();
+  if (!c) {
+	  DBUG_PRINT("ha_mysqloluene::sendWrite", ("Not connected: %s", shard.lastError().c_str()));
+	  DBUG_RETURN(HA_ERR_NO_CONNECTION);
+  }
+  int space_id= resolveSpace();
+  if (space_id == -1) {
+	  DBUG_RETURN(HA_ERR_NO_SUCH_TABLE);
+  }
+
+  std::string cache_key= tnt::RowCache::keyOf(space_id, builder.ptr());
+  std::string flight_key= tnt::SingleFlight::keyOf(shard.masterEndpoint(), space_id,
+                                                  builder.ptr());
+  THD *thd= ha_thd();
+  if (in_transaction(thd)) {
+	  /* applied by tarantool_commit() together with the rest of the transaction */
+	  tnt::Transaction &transaction= get_thd_data(thd)->transaction;
+	  std::string written;
+	  tnt::Transaction::lookup_t own_write=
+	    transaction.find(c->endpoint(), space_id, builder, written);
+	  /*
+	    Tarantool would only refuse a duplicate at COMMIT, too late for
+	    ON DUPLICATE KEY UPDATE and REPLACE to turn it into an update
+	  */
+	  if (op == tnt::WRITE_INSERT && own_write == tnt::Transaction::WRITTEN) {
+		  DBUG_RETURN(HA_ERR_FOUND_DUPP_KEY);
+	  }
+	  if (op == tnt::WRITE_INSERT && own_write == tnt::Transaction::NOT_WRITTEN &&
+	      builder.firstField()) {
+		  tnt::TupleBuilder key(1);
+		  key.pushEncoded(builder.firstField());
+		  std::shared_ptr<tnt::Iterator> existing= c->select(space_id, key);
+		  if (!existing) {
+			  DBUG_PRINT("ha_mysqloluene::sendWrite", ("Lookup failed: %s", c->lastError().c_str()));
+			  DBUG_RETURN(HA_ERR_NO_CONNECTION);
+		  }
+		  if (*existing) {
+			  DBUG_RETURN(HA_ERR_FOUND_DUPP_KEY);
+		  }
+	  }
+	  transaction.add(c->endpoint(), op, space_id, builder);
+	  std::shared_ptr<tnt::RowCache> row_cache= share->row_cache;
+	  transaction.onCommit([row_cache, cache_key, flight_key]() {
+		  row_cache->invalidate(cache_key);
+		  tnt::SingleFlight::instance().forget(flight_key);
+	  });
+	  tnt::Stats::add(tnt::Stats::ROWS_WRITTEN);
+	  DBUG_RETURN(0);
+  }
+
+  bool ok;
+  if (srv_group_commit) {
+	  tnt::GroupCommit::options_t options;
+	  options.window_us= srv_group_commit_window;
+	  options.max_batch= srv_group_commit_max_batch;
+	  std::string error;
+	  ok= tnt::GroupCommit::instance().write(*c, op, space_id, builder, options, error);
+	  if (!ok) {
+		  DBUG_PRINT("ha_mysqloluene::sendWrite", ("Batched write failed: %s", error.c_str()));
+	  }
+  } else {
+	  switch (op) {
+	  case tnt::WRITE_INSERT:
+		  ok= c->insert(space_id, builder);
+		  break;
+	  case tnt::WRITE_REPLACE:
+		  ok= c->replace(space_id, builder);
+		  break;
+	  default:
+		  ok= c->del(space_id, builder);
+	  }
+  }
+  // even a failed write may have been applied before the connection broke
+  share->row_cache->invalidate(cache_key);
+  tnt::SingleFlight::instance().forget(flight_key);
+  if (!ok) {
 	  DBUG_RETURN(HA_ERR_NO_PARTITION_FOUND);
   }
+  tnt::Stats::add(tnt::Stats::ROWS_WRITTEN);
 
   DBUG_RETURN(0);
 }
@@ -347,14 +1022,8 @@ int ha_mysqloluene::update_row(const uchar *old_data, uchar *new_data)
 {
 
   DBUG_ENTER("ha_mysqloluene::update_row");
-
-  if (!c.connected()) {
-	  c.connect(connection_info.host_port_uri);
-	  if (!c.connected()) {
-		  DBUG_PRINT("ha_mysqloluene::write_row", ("Not connected, no tarantool connection"));
-		  DBUG_RETURN(HA_ERR_NO_CONNECTION);
-	  }
-  }
+  MYSQL_UPDATE_ROW_START(table_share->db.str, table_share->table_name.str);
+  tnt::Probes::stage(tnt::Probes::STAGE_ENCODING);
 
   my_bitmap_map *org_bitmap = dbug_tmp_use_all_columns(table, table->read_set);
 
@@ -367,7 +1036,7 @@ int ha_mysqloluene::update_row(const uchar *old_data, uchar *new_data)
 		  switch ((*field)->type()) {
 			  case MYSQL_TYPE_LONG:
 				  builder.push((*field)->val_int());
-				  sql_print_warning("write_row: value int( %lld )", (*field)->val_int());
+				  TNT_TRACE(tnt::TRACE_DEBUG, "update_row: value int( %lld )", (*field)->val_int());
 				  break;
 			  case MYSQL_TYPE_STRING:
 			  case MYSQL_TYPE_VAR_STRING:
@@ -396,11 +1065,9 @@ int ha_mysqloluene::update_row(const uchar *old_data, uchar *new_data)
 
   dbug_tmp_restore_column_map(table->read_set, org_bitmap);
 
-  if (!c.replace(connection_info.space_name, builder)) {
-	  DBUG_RETURN(HA_ERR_NO_PARTITION_FOUND);
-  }
-
-  DBUG_RETURN(0);
+  int rc= sendWrite(tnt::WRITE_REPLACE, builder);
+  MYSQL_UPDATE_ROW_DONE(rc);
+  DBUG_RETURN(rc);
 }
 
 
@@ -427,14 +1094,8 @@ int ha_mysqloluene::update_row(const uchar *old_data, uchar *new_data)
 int ha_mysqloluene::delete_row(const uchar *buf)
 {
   DBUG_ENTER("ha_mysqloluene::delete_row");
-
-  if (!c.connected()) {
-	  c.connect(connection_info.host_port_uri);
-	  if (!c.connected()) {
-		  DBUG_PRINT("ha_mysqloluene::delete_row", ("Not connected, no tarantool connection"));
-		  DBUG_RETURN(HA_ERR_NO_CONNECTION);
-	  }
-  }
+  MYSQL_DELETE_ROW_START(table_share->db.str, table_share->table_name.str);
+  tnt::Probes::stage(tnt::Probes::STAGE_ENCODING);
 
   my_bitmap_map *org_bitmap = dbug_tmp_use_all_columns(table, table->read_set);
 
@@ -477,11 +1138,9 @@ built:
 
   dbug_tmp_restore_column_map(table->read_set, org_bitmap);
 
-  if (!c.del(connection_info.space_name, builder)) {
-	  DBUG_RETURN(HA_ERR_NO_PARTITION_FOUND);
-  }
-
-  DBUG_RETURN(0);
+  int rc= sendWrite(tnt::WRITE_DELETE, builder);
+  MYSQL_DELETE_ROW_DONE(rc);
+  DBUG_RETURN(rc);
 }
 
 
@@ -497,11 +1156,30 @@ int ha_mysqloluene::index_read_map(uchar *buf, const uchar *key,
 {
   int rc = 0;
   DBUG_ENTER("ha_mysqloluene::index_read");
+  tnt::Latency::Scope latency_scope(share->latency.get());
   // MYSQL_INDEX_READ_ROW_START(table_share->db.str, table_share->table_name.str);
 
-  if (find_flag == HA_READ_KEY_EXACT && keypart_map == 1) { // where id = <value>
+  int iterator_type;
+  switch (find_flag) {
+  case HA_READ_KEY_EXACT:   // where id = <value>
+	  iterator_type = tnt::ITER_EQ;
+	  break;
+  case HA_READ_KEY_OR_NEXT: // where id >= <value>
+	  iterator_type = tnt::ITER_GE;
+	  break;
+  case HA_READ_AFTER_KEY:   // where id > <value>
+	  iterator_type = tnt::ITER_GT;
+	  break;
+  default:
+	  DBUG_RETURN(HA_ERR_WRONG_COMMAND);
+  }
+
+  if (keypart_map == 1) {
 	  // TODO: check for key type
-	  c.connect(connection_info.host_port_uri);
+	  int space_id= resolveSpace();
+	  if (space_id == -1) {
+		  DBUG_RETURN(HA_ERR_NO_SUCH_TABLE);
+	  }
 	  tnt::TupleBuilder builder(1);
 
 	  	  switch (table->key_info[active_index].key_part[0].field->type()) {
@@ -527,8 +1205,73 @@ int ha_mysqloluene::index_read_map(uchar *buf, const uchar *key,
 			  default:
 				  DBUG_RETURN(HA_ERR_WRONG_COMMAND);
 	  	  }
-	  iterator = c.select(connection_info.space_name, builder);
+	  std::shared_ptr<tnt::Mirror> mirror= localMirror(space_id);
+	  THD *thd= ha_thd();
+	  tnt::Transaction::lookup_t own_write= tnt::Transaction::NOT_WRITTEN;
+	  std::string own_tuple;
+	  if (iterator_type == tnt::ITER_EQ && in_transaction(thd)) {
+		  /* the transaction's own writes are still in its write set */
+		  tnt::ReplicaSet &shard= cluster->shardFor(builder);
+		  own_write= get_thd_data(thd)->transaction.find(shard.masterEndpoint(), space_id,
+		                                                  builder, own_tuple);
+	  }
+	  if (own_write != tnt::Transaction::NOT_WRITTEN) {
+		  /* a reply of one tuple, or of none when it was deleted */
+		  std::string tuples(own_write == tnt::Transaction::WRITTEN ? "\x91" : "\x90");
+		  tuples+= own_tuple;
+		  iterator = tnt::Iterator::makeFromData(tuples);
+	  } else if (mirror) {
+		  iterator = mirror->select(builder, iterator_type);
+	  } else if (iterator_type == tnt::ITER_EQ) {
+		  // a point lookup only concerns the shard owning the key
+		  tnt::ReplicaSet &shard= cluster->shardFor(builder);
+		  tnt::SingleFlight::fetch_t fetch= [&]() {
+			  if (srv_hedged_reads && shard.size() > 1) {
+				  return shard.hedgedSelect(space_id, 0, builder, iterator_type,
+				                            readOptions(), tnt::HedgePolicy::instance(),
+				                            srv_hedge_percentile, srv_hedge_min_delay);
+			  }
+			  return shard.select(space_id, 0, builder, iterator_type, readOptions());
+		  };
+		  iterator.reset();
+		  bool shared_read= !in_transaction(thd);
+		  bool cached= shared_read && srv_row_cache_size > 0;
+		  bool cache_hit= false;
+		  std::string cache_key;
+		  uint64_t cache_generation= 0;
+		  if (cached) {
+			  cache_key= tnt::RowCache::keyOf(space_id, builder.ptr());
+			  std::string tuples;
+			  if (share->row_cache->find(cache_key, srv_row_cache_ttl * 1000ULL, tuples)) {
+				  iterator = tnt::Iterator::makeFromData(tuples);
+				  cache_hit= iterator != nullptr;
+			  } else {
+				  cache_generation= share->row_cache->generation(cache_key);
+			  }
+		  }
+		  if (cache_hit) {
+			  // served without a round trip
+		  } else if (srv_coalesce_reads && shared_read) {
+			  std::string flight_key= tnt::SingleFlight::keyOf(shard.masterEndpoint(), space_id,
+			                                                  builder.ptr());
+			  iterator = tnt::SingleFlight::instance().run(flight_key, fetch);
+		  } else {
+			  iterator = fetch();
+		  }
+		  if (cached && !cache_hit && iterator) {
+			  share->row_cache->store(cache_key, iterator->encodedTuples(),
+			                          cache_generation, srv_row_cache_size);
+		  }
+	  } else {
+		  iterator = cluster->select(space_id, 0, builder, iterator_type,
+		                             true, readOptions());
+	  }
+	  if (!iterator) {
+		  DBUG_RETURN(HA_ERR_NO_PARTITION_FOUND);
+	  }
 	  table->status = 0;
+	  /* the rows are decoded as they are converted, so that is one stage */
+	  tnt::Probes::stage(tnt::Probes::STAGE_CONVERTING);
 
 	  rc = index_next(buf);
   } else {
@@ -540,6 +1283,20 @@ int ha_mysqloluene::index_read_map(uchar *buf, const uchar *key,
 }
 
 
+/**
+  @brief
+  Ends an index scan. The reply buffers go back to the buffer pool here
+  rather than when the handler is closed.
+*/
+int ha_mysqloluene::index_end()
+{
+  DBUG_ENTER("ha_mysqloluene::index_end");
+  iterator.reset();
+  active_index= MAX_KEY;
+  DBUG_RETURN(0);
+}
+
+
 /**
   @brief
   Used to read forward through the index.
@@ -549,14 +1306,24 @@ int ha_mysqloluene::index_next(uchar *buf)
 {
   int rc = 0;
   DBUG_ENTER("ha_mysqloluene::index_next");
+  tnt::Latency::Scope latency_scope(share->latency.get());
   MYSQL_INDEX_READ_ROW_START(table_share->db.str, table_share->table_name.str);
   // rc= HA_ERR_WRONG_COMMAND;
   memset((void*)buf, 0, (unsigned long int)table->s->null_bytes);
 
   auto r = iterator->nextRow();
   if (!r) {
-	  rc = HA_ERR_END_OF_FILE;
+	  const std::string &error= iterator->lastError();
+	  if (error.empty()) {
+		  rc = HA_ERR_END_OF_FILE;
+	  } else {
+		  /* a cut short scan must not pass for the whole table */
+		  sql_print_warning("Tarantool: reading %s.%s failed: %s", table_share->db.str,
+		                    table_share->table_name.str, error.c_str());
+		  rc = HA_ERR_NO_CONNECTION;
+	  }
   } else {
+	  tnt::Stats::add(tnt::Stats::ROWS_READ);
 	  my_bitmap_map *org_bitmap = dbug_tmp_use_all_columns(table, table->write_set);
 
 	  int i = 0;
@@ -625,9 +1392,24 @@ int ha_mysqloluene::index_first(uchar *buf)
 {
   int rc;
   DBUG_ENTER("ha_mysqloluene::index_first");
-  MYSQL_INDEX_READ_ROW_START(table_share->db.str, table_share->table_name.str);
-  rc = HA_ERR_WRONG_COMMAND;
-  MYSQL_INDEX_READ_ROW_DONE(rc);
+  tnt::Latency::Scope latency_scope(share->latency.get());
+  int space_id= resolveSpace();
+  if (space_id == -1) {
+	  DBUG_RETURN(HA_ERR_NO_SUCH_TABLE);
+  }
+  std::shared_ptr<tnt::Mirror> mirror= localMirror(space_id);
+  if (mirror) {
+	  iterator = mirror->select(tnt::TupleBuilder(0), tnt::ITER_ALL);
+  } else {
+	  /* primary key order across all shards */
+	  iterator = cluster->select(space_id, 0, tnt::TupleBuilder(0), tnt::ITER_ALL,
+	                             true, readOptions());
+  }
+  iterator = withOwnWrites(space_id, iterator);
+  if (!iterator) {
+	  DBUG_RETURN(HA_ERR_NO_PARTITION_FOUND);
+  }
+  rc = index_next(buf);
   DBUG_RETURN(rc);
 }
 
@@ -669,22 +1451,50 @@ int ha_mysqloluene::index_last(uchar *buf)
 int ha_mysqloluene::rnd_init(bool scan)
 {
   DBUG_ENTER("ha_mysqloluene::rnd_init");
-  if (!c.connected()) {
-	  c.connect(connection_info.host_port_uri);
+  tnt::Latency::Scope latency_scope(share->latency.get());
+  int space_id= resolveSpace();
+  if (space_id == -1) {
+	  DBUG_RETURN(HA_ERR_NO_SUCH_TABLE);
   }
-  if (!c.connected()) {
-	  DBUG_PRINT("ha_mysqloluene::rnd_init", ("Not connected, no tarantool connection"));
-	  DBUG_RETURN(HA_ERR_NO_CONNECTION);
-  } else {
-	  DBUG_PRINT("ha_mysqloluene::rnd_init", ("Successfully created tarantool connection"));
-	  iterator = c.select(connection_info.space_name, tnt::TupleBuilder(0));
+  std::shared_ptr<tnt::Mirror> mirror= localMirror(space_id);
+  const std::string &snapshot_dir= connection_info.options["snapshot_dir"];
+  if (!snapshot_dir.empty()) {
+	  /* analytics scans read the instance's files instead of the instance */
+	  std::string error;
+	  iterator = tnt::OfflineScan::open(snapshot_dir, space_id,
+	                                    connection_info.options["xlogs"] != "0", error);
 	  if (!iterator) {
-		  // TODO: set warning
-		  DBUG_RETURN(HA_ERR_NO_PARTITION_FOUND);
+		  sql_print_warning("Tarantool: offline scan of %s failed: %s",
+		                    snapshot_dir.c_str(), error.c_str());
 	  }
-	  current_row = 0;
-	  DBUG_RETURN(0);
+  } else if (mirror) {
+	  iterator = mirror->select(tnt::TupleBuilder(0), tnt::ITER_ALL);
+  } else if (srv_scan_page_size > 0 || !partition_name.empty()) {
+	  /*
+	    Read ahead for sequential scans and when the server asked for caching.
+	    Partitions are fetched in the background while scan_prefetch_threads
+	    allows: the server inits every partition of a scan before reading
+	    the first one, so their requests overlap.
+	  */
+	  tnt::PagedScan::options_t scan_options;
+	  scan_options.page_size = srv_scan_page_size > 0 ? srv_scan_page_size : UINT32_MAX;
+	  scan_options.prefetch_depth = (scan || read_ahead) ? srv_scan_prefetch_depth : 0;
+	  if (!partition_name.empty() && scan_options.prefetch_depth == 0)
+		  scan_options.prefetch_depth = 1;
+	  iterator = cluster->scan(space_id, scan_options, readOptions());
+  } else {
+	  /* a scan doesn't need any order, shards are returned one after another */
+	  iterator = cluster->select(space_id, 0, tnt::TupleBuilder(0), tnt::ITER_ALL,
+	                             false, readOptions());
+  }
+  iterator = withOwnWrites(space_id, iterator);
+  if (!iterator) {
+	  // TODO: set warning
+	  DBUG_RETURN(HA_ERR_NO_PARTITION_FOUND);
   }
+  tnt::Probes::stage(tnt::Probes::STAGE_CONVERTING);
+  current_row = 0;
+  DBUG_RETURN(0);
 }
 
 int ha_mysqloluene::rnd_end()
@@ -714,6 +1524,7 @@ int ha_mysqloluene::rnd_next(uchar *buf)
 {
   int rc = 0;
   DBUG_ENTER("ha_mysqloluene::rnd_next");
+  tnt::Latency::Scope latency_scope(share->latency.get());
 
   // statistic_increment(table->in_use->status_var.ha_read_rnd_next_count, &LOCK_status);
 
@@ -729,8 +1540,17 @@ int ha_mysqloluene::rnd_next(uchar *buf)
 
   auto r = iterator->nextRow();
   if (!r) {
-	  rc = HA_ERR_END_OF_FILE;
+	  const std::string &error= iterator->lastError();
+	  if (error.empty()) {
+		  rc = HA_ERR_END_OF_FILE;
+	  } else {
+		  /* a cut short scan must not pass for the whole table */
+		  sql_print_warning("Tarantool: reading %s.%s failed: %s", table_share->db.str,
+		                    table_share->table_name.str, error.c_str());
+		  rc = HA_ERR_NO_CONNECTION;
+	  }
   } else {
+	  tnt::Stats::add(tnt::Stats::ROWS_READ);
 	  int i = 0;
 	  for (Field **field=table->field ; *field ; field++) {
 
@@ -893,6 +1713,17 @@ int ha_mysqloluene::extra(enum ha_extra_function operation)
   DBUG_ENTER("ha_mysqloluene::extra");
   DBUG_PRINT("enter ha_mysqloluene::extra",("function: %d",(int) operation));
 
+  switch (operation) {
+  case HA_EXTRA_CACHE:
+	  read_ahead= true;
+	  break;
+  case HA_EXTRA_NO_CACHE:
+  case HA_EXTRA_RESET_STATE:
+	  read_ahead= false;
+	  break;
+  default:
+	  break;
+  }
   DBUG_RETURN(0);
 }
 
@@ -966,6 +1797,35 @@ int ha_mysqloluene::truncate()
 int ha_mysqloluene::external_lock(THD *thd, int lock_type)
 {
   DBUG_ENTER("ha_mysqloluene::external_lock");
+  if (lock_type == F_UNLCK) {
+    cluster->bind(NULL);
+  } else {
+    tarantool_thd_t *data= get_thd_data(thd);
+    cluster->bind(&data->session);
+    data->transaction.startStatement(thd->query_id);
+    trans_register_ha(thd, FALSE, ht, NULL);
+    if (in_transaction(thd)) {
+      trans_register_ha(thd, TRUE, ht, NULL);
+    }
+    tnt::SlowLog::setQueryId(thd->query_id);
+  }
+  DBUG_RETURN(0);
+}
+
+
+/**
+  @brief
+  Called instead of external_lock() for every statement under LOCK TABLES.
+*/
+int ha_mysqloluene::start_stmt(THD *thd, thr_lock_type lock_type)
+{
+  DBUG_ENTER("ha_mysqloluene::start_stmt");
+  get_thd_data(thd)->transaction.startStatement(thd->query_id);
+  trans_register_ha(thd, FALSE, ht, NULL);
+  if (in_transaction(thd)) {
+    trans_register_ha(thd, TRUE, ht, NULL);
+  }
+  tnt::SlowLog::setQueryId(thd->query_id);
   DBUG_RETURN(0);
 }
 
@@ -1012,7 +1872,39 @@ THR_LOCK_DATA **ha_mysqloluene::store_lock(THD *thd,
                                        enum thr_lock_type lock_type)
 {
   if (lock_type != TL_IGNORE && lock.type == TL_UNLOCK)
+  {
+    int sql_command= thd_sql_command(thd);
+    /*
+      Tarantool applies every row write atomically, so inserts don't have
+      to be serialised here: let them and the readers in together, as
+      InnoDB does. UPDATE, DELETE and INSERT ... ON DUPLICATE KEY UPDATE
+      keep their lock: update_row() replaces the whole tuple with one built
+      from the row read before, so two of them on one row would lose an
+      update without it. LOCK TABLES, tablespace operations and the
+      statements that work on the table as a whole keep it too.
+    */
+    bool plain_insert= (sql_command == SQLCOM_INSERT ||
+                        sql_command == SQLCOM_INSERT_SELECT ||
+                        sql_command == SQLCOM_REPLACE ||
+                        sql_command == SQLCOM_REPLACE_SELECT ||
+                        sql_command == SQLCOM_LOAD) &&
+                       thd->lex->duplicates != DUP_UPDATE;
+    if (lock_type >= TL_WRITE_CONCURRENT_INSERT && lock_type <= TL_WRITE &&
+        plain_insert && !thd_in_lock_tables(thd) && !thd_tablespace_op(thd))
+      lock_type= TL_WRITE_ALLOW_WRITE;
+
+    /*
+      INSERT ... SELECT and CREATE ... SELECT ask for TL_READ_NO_INSERT on
+      their source so that statement-based binlogging replays them the same
+      way; keep it unless rows are logged or nothing is.
+    */
+    int binlog_format= thd_binlog_format(thd);
+    if (lock_type == TL_READ_NO_INSERT && !thd_in_lock_tables(thd) &&
+        (binlog_format == BINLOG_FORMAT_ROW || binlog_format == BINLOG_FORMAT_UNSPEC))
+      lock_type= TL_READ;
+
     lock.type=lock_type;
+  }
   *to++= &lock;
   return to;
 }
@@ -1040,11 +1932,54 @@ THR_LOCK_DATA **ha_mysqloluene::store_lock(THD *thd,
 int ha_mysqloluene::delete_table(const char *name)
 {
   DBUG_ENTER("ha_mysqloluene::delete_table");
-  /* This is not implemented but we want someone to be able that it works. */
-  DBUG_RETURN(0);
+  /*
+    Spaces belong to Tarantool and outlive the tables mapping them, except
+    on ALTER TABLE ... DROP PARTITION of a table with drop_partitions=1:
+    then the dropped partition's space is dropped too, to expire old data.
+  */
+  std::string partition= partitionOf(name);
+  THD *thd= ha_thd();
+  if (partition.empty() || !thd || thd_sql_command(thd) != SQLCOM_ALTER_TABLE ||
+      !(thd->lex->alter_info.flags & Alter_info::ALTER_DROP_PARTITION))
+    DBUG_RETURN(0);
+  if (partition != partition_name)
+    configure(partition);
+  if (connection_info.options["drop_partitions"] != "1")
+    DBUG_RETURN(0);
+  if (!config_error.empty()) {
+    /* the space isn't the partition's alone */
+    sql_print_warning("Tarantool: not dropping the space: %s", config_error.c_str());
+    DBUG_RETURN(0);
+  }
+  DBUG_RETURN(dropSpace());
 }
 
-
+int ha_mysqloluene::dropSpace()
+{
+  static const std::string expression=
+    "local space = box.space[...] "
+    "if space ~= nil then space:drop() end";
+  tnt::TupleBuilder arguments(1);
+  if (connection_info.space_id >= 0)
+    arguments.push(static_cast<int64_t>(connection_info.space_id));
+  else
+    arguments.push(connection_info.space_name);
+
+  for (size_t n= 0; n < cluster->size(); ++n)
+  {
+    tnt::ReplicaSet &shard= cluster->shard(n);
+    tnt::Connection *c= shard.master();
+    if (!c || !c->eval(expression, arguments.ptr(), arguments.size()))
+    {
+      sql_print_warning("Tarantool: can't drop the space of partition %s on %s",
+                        partition_name.c_str(), shard.masterEndpoint().c_str());
+      return HA_ERR_NO_CONNECTION;
+    }
+  }
+  return 0;
+}
+
+
 /**
   @brief
   Renames a table from one name to another via an alter table call.
@@ -1111,62 +2046,209 @@ int ha_mysqloluene::create(const char *name, TABLE *table_arg,
 {
   DBUG_ENTER("ha_mysqloluene::create");
   /*
-    This is not implemented but we want someone to be able to see that it
-    works.
+    The space belongs to Tarantool, only check that the connection string
+    can serve the table.
   */
+  std::string partition= partitionOf(name);
+  if (partition != partition_name)
+    configure(partition);
+  if (!config_error.empty()) {
+    my_printf_error(ER_UNKNOWN_ERROR, "Tarantool: %s", MYF(0), config_error.c_str());
+    DBUG_RETURN(HA_WRONG_CREATE_OPTION);
+  }
   DBUG_RETURN(0);
 }
 
+// "master:3301,replica:3301;shard2:3301", one replica set per ';'
+bool ha_mysqloluene::parseShards(const std::string &shards)
+{
+ for (const std::string &shard: splitList(shards, ';')) {
+	 std::vector<std::string> endpoints;
+	 for (const std::string &host_port: splitList(shard, ',')) {
+		 if (host_port.find(':') == std::string::npos) {
+			 TNT_TRACE_TEXT(tnt::TRACE_ERROR, "Can't find colon_point in '%s'", host_port);
+			 return false;
+		 }
+		 endpoints.push_back(host_port);
+	 }
+	 connection_info.shards.push_back(endpoints);
+ }
+
+ const std::string &master = connection_info.shards.front().front();
+ size_t colon_point = master.find(':');
+ connection_info.hostname = master.substr(0, colon_point);
+ connection_info.port = atoi(master.c_str() + colon_point + 1);
+ connection_info.host_port_uri = master;
+ TNT_TRACE_TEXT(tnt::TRACE_INFO, "host:port: '%s', %lld shard(s)", master,
+                (int64_t) connection_info.shards.size());
+ return true;
+}
+
 // TODO: rewrite using Boost.Spirit
 bool ha_mysqloluene::parseConnectionString(const std::string &connection_string)
 {
  // tnt://localhost:3301/isp
  // tnt://localhost:3301/:513
  if (strncmp(connection_string.data(), "tnt://", 6) != 0) {
-	 sql_print_warning("Wrong schema'");
+	 TNT_TRACE_TEXT(tnt::TRACE_ERROR, "Wrong schema in '%s'", connection_string);
 	 return false;
  }
 
- size_t colon_point = connection_string.find(':', 6);
- if (colon_point == std::string::npos) {
-	 sql_print_warning("Can't find colon_point'");
+ // tnt://master:3301,replica1:3301,replica2:3301/isp
+ // tnt://shard1:3301,shard1_replica:3301;shard2:3301/isp?sharding=range&bounds=1000
+ size_t slash_point = connection_string.find('/', 6);
+ if (slash_point == std::string::npos) {
+	 TNT_TRACE_TEXT(tnt::TRACE_ERROR, "Can't find slash_point in '%s'", connection_string);
 	 return false;
  }
-
- const std::string &hostname = connection_string.substr(6, colon_point - 6);
- connection_info.hostname = hostname;
- sql_print_warning("hostname: %s", hostname.c_str());
-
- colon_point++;
- size_t slash_point = connection_string.find('/', colon_point);
- if (slash_point == std::string::npos) {
-	 sql_print_warning("Can't find slash_point'");
+ // tnt://{partition}.metrics:3301/events_{partition}?partition.p2020=archive:3301
+ if (!parseShards(connection_string.substr(6, slash_point - 6))) {
 	 return false;
  }
- const std::string &port_string = connection_string.substr(colon_point, slash_point - colon_point);
- connection_info.port = atoi(port_string.c_str());
- sql_print_warning("port: %d (%s)", connection_info.port, port_string.c_str());
-
- connection_info.host_port_uri = connection_string.substr(6, slash_point - 6);
- sql_print_warning("host:port: '%s'", connection_info.host_port_uri.c_str());
 
- const std::string &space = connection_string.substr(slash_point + 1);
+ std::string space = connection_string.substr(slash_point + 1);
+ size_t question_point = space.find('?');
+ if (question_point != std::string::npos) {
+	 for (const std::string &option: splitList(space.substr(question_point + 1), '&')) {
+		 size_t equals_point = option.find('=');
+		 if (equals_point == std::string::npos) {
+			 connection_info.options[option] = "1";
+		 } else {
+			 connection_info.options[option.substr(0, equals_point)] = option.substr(equals_point + 1);
+		 }
+	 }
+	 space.erase(question_point);
+ }
  if (space.empty()) {
-	 sql_print_warning("Space is empty'");
+	 TNT_TRACE_TEXT(tnt::TRACE_ERROR, "Space is empty in '%s'", connection_string);
 	 return false;
  }
- sql_print_warning("space: %s", space.c_str());
+ TNT_TRACE_TEXT(tnt::TRACE_INFO, "space: %s", space);
 
  if (space[0] == ':') {
-	 connection_info.space_id = atoi(space.c_str());
-	 sql_print_warning("space id: %d", connection_info.space_id);
+	 connection_info.space_id = atoi(space.c_str() + 1);
+	 TNT_TRACE(tnt::TRACE_INFO, "space id: %lld", connection_info.space_id);
  } else {
 	 connection_info.space_name = space;
-	 sql_print_warning("space name: %s", connection_info.space_name.c_str());
+	 TNT_TRACE_TEXT(tnt::TRACE_INFO, "space name: %s", connection_info.space_name);
  }
  return true;
 }
 
+tnt::ReplicaSet::read_options_t ha_mysqloluene::readOptions() const
+{
+  tnt::ReplicaSet::read_options_t options;
+  options.use_replicas= srv_read_from_replicas;
+  options.max_lag= srv_replica_max_lag;
+  options.retry_interval_ms= srv_replica_retry_interval;
+  options.hedge_timeout_ms= srv_hedge_timeout;
+  return options;
+}
+
+/**
+  @brief
+  Returns the Tarantool space id of the table.
+
+  @details
+  The id is cached in the share together with the schema version it was
+  resolved under, so a statement costs one snapshot load unless the
+  server's schema has changed since. Numeric spaces (tnt://host:port/:513)
+  are never resolved.
+*/
+int ha_mysqloluene::resolveSpace()
+{
+  if (connection_info.space_id >= 0)
+    return connection_info.space_id;
+
+  tnt::Latency::Scope latency_scope(share->latency.get());
+  tnt::SchemaCache &cache= tnt::SchemaCache::instance();
+  const std::string &endpoint= connection_info.host_port_uri;
+  /*
+    Read the version before resolving: if the schema changes meanwhile,
+    the id is stored under the older version and re-resolved next time,
+    rather than a stale id being taken for current.
+  */
+  uint64_t version= cache.version(endpoint);
+  std::shared_ptr<const Mysqloluene_share::resolved_space_t> resolved=
+    std::atomic_load(&share->resolved);
+  if (resolved && resolved->schema_version == version)
+    return resolved->space_id;
+  int space_id= -1;
+
+  /*
+    The master knows the schema first; a replica will do while it's down.
+    Every shard must have the space under the same id, since the share
+    keeps a single one.
+  */
+  for (size_t n= 0; n < cluster->size(); ++n)
+  {
+    tnt::ReplicaSet &shard= cluster->shard(n);
+    tnt::Connection *c= shard.master();
+    if (!c)
+      c= shard.reader(readOptions());
+    if (!c)
+      return -1;
+    int shard_space_id= c->resolveSpace(connection_info.space_name);
+    if (n == 0)
+      space_id= shard_space_id;
+    else if (shard_space_id != space_id)
+    {
+      sql_print_warning("Tarantool: space '%s' has id %d on shard 0 but %d on shard %u",
+                        connection_info.space_name.c_str(), space_id,
+                        shard_space_id, (uint) n);
+      return -1;
+    }
+  }
+  if (space_id >= 0)
+  {
+    std::shared_ptr<const Mysqloluene_share::resolved_space_t> fresh(
+      new Mysqloluene_share::resolved_space_t{ space_id, version, time(NULL) });
+    std::atomic_store(&share->resolved, fresh);
+  }
+  return space_id;
+}
+
+/**
+  @brief
+  The table's replication mirror when the connection string asks for one
+  (?mirror=1) and it is loaded and fresh enough to answer reads.
+
+  @details
+  Only unsharded tables are mirrored. The first call starts the mirror, so
+  reads go to Tarantool until its snapshot has been fetched.
+*/
+std::shared_ptr<tnt::Mirror> ha_mysqloluene::localMirror(int space_id)
+{
+  if (connection_info.options["mirror"] != "1" || cluster->size() != 1) {
+	  return std::shared_ptr<tnt::Mirror>();
+  }
+  std::shared_ptr<tnt::Mirror> mirror=
+    tnt::Mirror::get(cluster->shard(0).masterEndpoint(), space_id);
+  if (!mirror->ready() ||
+      mirror->stalenessUs() > srv_mirror_max_staleness * 1000ULL) {
+	  return std::shared_ptr<tnt::Mirror>();
+  }
+  return mirror;
+}
+
+/**
+  @brief
+  A full scan as the session's transaction sees it: the rows it has
+  written but not committed yet replace those read from Tarantool, and
+  come after them, out of primary key order.
+*/
+std::shared_ptr<tnt::Iterator> ha_mysqloluene::withOwnWrites(int space_id,
+                                                            std::shared_ptr<tnt::Iterator> scan)
+{
+  THD *thd= ha_thd();
+  if (!scan || !in_transaction(thd))
+    return scan;
+  std::vector<std::string> endpoints;
+  for (size_t n= 0; n < cluster->size(); ++n)
+    endpoints.push_back(cluster->shard(n).masterEndpoint());
+  return get_thd_data(thd)->transaction.overlay(endpoints, space_id, scan);
+}
+
 struct st_mysql_storage_engine mysqloulene_storage_engine=
 { MYSQL_HANDLERTON_INTERFACE_VERSION };
 
@@ -1230,63 +2312,625 @@ static MYSQL_THDVAR_DOUBLE(
   1000.5,
   0);
 
+static MYSQL_SYSVAR_BOOL(
+  read_from_replicas,
+  srv_read_from_replicas,
+  PLUGIN_VAR_OPCMDARG,
+  "Route table scans and index reads to the replicas listed after the "
+  "master in the connection string",
+  NULL,
+  NULL,
+  TRUE);
+
+static MYSQL_SYSVAR_DOUBLE(
+  replica_max_lag,
+  srv_replica_max_lag,
+  PLUGIN_VAR_RQCMDARG,
+  "Replicas lagging behind the master by more seconds than this are not read from",
+  NULL,
+  NULL,
+  1.0,
+  0,
+  86400,
+  0);
+
+static MYSQL_SYSVAR_ULONG(
+  replica_retry_interval,
+  srv_replica_retry_interval,
+  PLUGIN_VAR_RQCMDARG,
+  "Milliseconds an unreachable instance is skipped for before a retry",
+  NULL,
+  NULL,
+  1000,
+  0,
+  3600 * 1000,
+  0);
+
+static MYSQL_SYSVAR_BOOL(
+  hedged_reads,
+  srv_hedged_reads,
+  PLUGIN_VAR_OPCMDARG,
+  "Repeat a primary key lookup on a second instance of the replica set "
+  "when the first one is slower than tarantool_hedge_percentile; not done "
+  "when tarantool_io_threads is set",
+  NULL,
+  NULL,
+  FALSE);
+
+static MYSQL_SYSVAR_DOUBLE(
+  hedge_percentile,
+  srv_hedge_percentile,
+  PLUGIN_VAR_RQCMDARG,
+  "Percentile of recent lookup latencies after which a read is hedged",
+  NULL,
+  NULL,
+  95.0,
+  50.0,
+  100.0,
+  0);
+
+static MYSQL_SYSVAR_ULONG(
+  hedge_min_delay,
+  srv_hedge_min_delay,
+  PLUGIN_VAR_RQCMDARG,
+  "Microseconds a lookup is given at least before it is hedged",
+  NULL,
+  NULL,
+  1000,
+  0,
+  10 * 1000 * 1000,
+  0);
+
+static MYSQL_SYSVAR_ULONG(
+  hedge_timeout,
+  srv_hedge_timeout,
+  PLUGIN_VAR_RQCMDARG,
+  "Milliseconds a hedged lookup waits for either instance before it fails",
+  NULL,
+  NULL,
+  30000,
+  1,
+  3600 * 1000,
+  0);
+
+static MYSQL_SYSVAR_ULONG(
+  io_threads,
+  srv_io_threads,
+  PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+  "Threads that own the Tarantool sockets and multiplex all sessions "
+  "over them; 0 gives every handler its own socket",
+  NULL,
+  NULL,
+  0,
+  0,
+  64,
+  0);
+
+static MYSQL_SYSVAR_ULONG(
+  io_request_timeout,
+  srv_io_request_timeout,
+  PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+  "Milliseconds a request sent through the I/O threads waits for its "
+  "reply before it fails; 0 waits forever",
+  NULL,
+  NULL,
+  30000,
+  0,
+  3600 * 1000,
+  0);
+
+static MYSQL_SYSVAR_BOOL(
+  group_commit,
+  srv_group_commit,
+  PLUGIN_VAR_OPCMDARG,
+  "Batch autocommit writes of concurrent sessions into one Tarantool "
+  "transaction",
+  NULL,
+  NULL,
+  FALSE);
+
+static MYSQL_SYSVAR_ULONG(
+  group_commit_window,
+  srv_group_commit_window,
+  PLUGIN_VAR_RQCMDARG,
+  "Microseconds a batch waits for more writes before it is committed",
+  NULL,
+  NULL,
+  200,
+  0,
+  1000 * 1000,
+  0);
+
+static MYSQL_SYSVAR_ULONG(
+  group_commit_max_batch,
+  srv_group_commit_max_batch,
+  PLUGIN_VAR_RQCMDARG,
+  "Writes that make a batch full, so it is committed without waiting",
+  NULL,
+  NULL,
+  64,
+  1,
+  10000,
+  0);
+
+static MYSQL_SYSVAR_BOOL(
+  coalesce_reads,
+  srv_coalesce_reads,
+  PLUGIN_VAR_OPCMDARG,
+  "Let concurrent identical primary key lookups outside explicit "
+  "transactions share one request to Tarantool",
+  NULL,
+  NULL,
+  FALSE);
+
+static MYSQL_SYSVAR_ULONGLONG(
+  row_cache_size,
+  srv_row_cache_size,
+  PLUGIN_VAR_RQCMDARG,
+  "Bytes of primary key lookup results cached per table; 0 disables the cache",
+  NULL,
+  NULL,
+  0,
+  0,
+  ULLONG_MAX,
+  0);
+
+static MYSQL_SYSVAR_ULONG(
+  row_cache_ttl,
+  srv_row_cache_ttl,
+  PLUGIN_VAR_RQCMDARG,
+  "Milliseconds a cached row is served for; bounds staleness against "
+  "writes made outside this server",
+  NULL,
+  NULL,
+  1000,
+  0,
+  24 * 3600 * 1000,
+  0);
+
+static MYSQL_SYSVAR_ULONG(
+  mirror_max_staleness,
+  srv_mirror_max_staleness,
+  PLUGIN_VAR_RQCMDARG,
+  "Milliseconds without news from Tarantool after which a mirrored table "
+  "is read from Tarantool again",
+  NULL,
+  NULL,
+  1000,
+  0,
+  3600 * 1000,
+  0);
+
+static MYSQL_SYSVAR_ULONG(
+  scan_page_size,
+  srv_scan_page_size,
+  PLUGIN_VAR_RQCMDARG,
+  "Tuples per request of a table scan, paged by the primary key which must "
+  "then be a TREE index; 0 reads the whole space in one request",
+  NULL,
+  NULL,
+  0,
+  0,
+  1000 * 1000,
+  0);
+
+static MYSQL_SYSVAR_ULONG(
+  scan_prefetch_depth,
+  srv_scan_prefetch_depth,
+  PLUGIN_VAR_RQCMDARG,
+  "Pages of a paged table scan fetched ahead in the background while the "
+  "current one is read; 0 fetches each page when it is needed",
+  NULL,
+  NULL,
+  2,
+  0,
+  64,
+  0);
+
+static void scan_prefetch_threads_update(MYSQL_THD thd, struct st_mysql_sys_var *var,
+                                         void *var_ptr, const void *save)
+{
+  ulong threads= *static_cast<const ulong*>(save);
+  *static_cast<ulong*>(var_ptr)= threads;
+  tnt::PagedScan::setMaxPrefetchers(threads);
+}
+
+static MYSQL_SYSVAR_ULONG(
+  scan_prefetch_threads,
+  srv_scan_prefetch_threads,
+  PLUGIN_VAR_RQCMDARG,
+  "Paged scans, partitions included, that may fetch ahead at once, each "
+  "with its own thread and connection; the others fetch on demand",
+  NULL,
+  scan_prefetch_threads_update,
+  16,
+  0,
+  1024,
+  0);
+
+static void slow_request_threshold_update(MYSQL_THD thd, struct st_mysql_sys_var *var,
+                                          void *var_ptr, const void *save)
+{
+  ulong threshold_ms= *static_cast<const ulong*>(save);
+  *static_cast<ulong*>(var_ptr)= threshold_ms;
+  tnt::SlowLog::setThresholdUs(threshold_ms * 1000ULL);
+}
+
+static MYSQL_SYSVAR_ULONG(
+  slow_request_threshold,
+  srv_slow_request_threshold,
+  PLUGIN_VAR_RQCMDARG,
+  "Milliseconds after which a Tarantool request is written to the slow "
+  "request log; 0 disables the log",
+  NULL,
+  slow_request_threshold_update,
+  0,
+  0,
+  3600 * 1000,
+  0);
+
+static MYSQL_SYSVAR_STR(
+  slow_request_log,
+  srv_slow_request_log,
+  PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+  "File the slow Tarantool requests are appended to, relative to the data "
+  "directory; empty disables the log",
+  NULL,
+  NULL,
+  "tarantool-slow.log");
+
+static const char *trace_level_names[]=
+{
+  "off", "error", "warning", "info", "debug", NullS
+};
+
+static TYPELIB trace_level_typelib=
+{
+  array_elements(trace_level_names) - 1, "trace_level_typelib",
+  trace_level_names, NULL
+};
+
+static void trace_level_update(MYSQL_THD thd, struct st_mysql_sys_var *var,
+                               void *var_ptr, const void *save)
+{
+  ulong level= *static_cast<const ulong*>(save);
+  *static_cast<ulong*>(var_ptr)= level;
+  tnt::Trace::setLevel(static_cast<tnt::trace_level_t>(level));
+}
+
+static MYSQL_SYSVAR_ENUM(
+  trace_level,
+  srv_trace_level,
+  PLUGIN_VAR_RQCMDARG,
+  "Events recorded in the per-thread trace shown by SHOW ENGINE TARANTOOL "
+  "STATUS: off, error, warning, info or debug",
+  NULL,
+  trace_level_update,
+  tnt::TRACE_OFF,
+  &trace_level_typelib);
+
+static void latency_reset_update(MYSQL_THD thd, struct st_mysql_sys_var *var,
+                                 void *var_ptr, const void *save)
+{
+  if (*static_cast<const my_bool*>(save))
+    tnt::Latency::resetAll();
+  *static_cast<my_bool*>(var_ptr)= FALSE; // a trigger, not a setting
+}
+
+static MYSQL_SYSVAR_BOOL(
+  latency_reset,
+  srv_latency_reset,
+  PLUGIN_VAR_OPCMDARG | PLUGIN_VAR_NOCMDARG,
+  "Set to ON to clear the latency histograms",
+  NULL,
+  latency_reset_update,
+  FALSE);
+
 static struct st_mysql_sys_var* example_system_variables[]= {
   MYSQL_SYSVAR(enum_var),
   MYSQL_SYSVAR(ulong_var),
   MYSQL_SYSVAR(double_var),
   MYSQL_SYSVAR(double_thdvar),
+  MYSQL_SYSVAR(read_from_replicas),
+  MYSQL_SYSVAR(replica_max_lag),
+  MYSQL_SYSVAR(replica_retry_interval),
+  MYSQL_SYSVAR(hedged_reads),
+  MYSQL_SYSVAR(hedge_percentile),
+  MYSQL_SYSVAR(hedge_min_delay),
+  MYSQL_SYSVAR(hedge_timeout),
+  MYSQL_SYSVAR(io_threads),
+  MYSQL_SYSVAR(io_request_timeout),
+  MYSQL_SYSVAR(group_commit),
+  MYSQL_SYSVAR(group_commit_window),
+  MYSQL_SYSVAR(group_commit_max_batch),
+  MYSQL_SYSVAR(coalesce_reads),
+  MYSQL_SYSVAR(row_cache_size),
+  MYSQL_SYSVAR(row_cache_ttl),
+  MYSQL_SYSVAR(mirror_max_staleness),
+  MYSQL_SYSVAR(scan_page_size),
+  MYSQL_SYSVAR(scan_prefetch_depth),
+  MYSQL_SYSVAR(scan_prefetch_threads),
+  MYSQL_SYSVAR(latency_reset),
+  MYSQL_SYSVAR(slow_request_threshold),
+  MYSQL_SYSVAR(slow_request_log),
+  MYSQL_SYSVAR(trace_level),
   NULL
 };
 
-// this is an example of SHOW_FUNC and of my_snprintf() service
-static int show_func_example(MYSQL_THD thd, struct st_mysql_show_var *var,
+/* Sums of the sharded tnt::Stats counters */
+template<tnt::Stats::counter_t counter>
+static int show_counter(MYSQL_THD thd, struct st_mysql_show_var *var,
+                        char *buf)
+{
+  var->type= SHOW_LONGLONG;
+  var->value= buf;
+  *reinterpret_cast<longlong*>(buf)=
+    static_cast<longlong>(tnt::Stats::get(counter));
+  return 0;
+}
+
+static int show_buffer_pool_bytes(MYSQL_THD thd, struct st_mysql_show_var *var,
+                                  char *buf)
+{
+  var->type= SHOW_LONGLONG;
+  var->value= buf;
+  *reinterpret_cast<longlong*>(buf)=
+    static_cast<longlong>(tnt::BufferPool::bytesAllocated());
+  return 0;
+}
+
+static int show_buffer_pool_peak_bytes(MYSQL_THD thd,
+                                       struct st_mysql_show_var *var,
+                                       char *buf)
+{
+  var->type= SHOW_LONGLONG;
+  var->value= buf;
+  *reinterpret_cast<longlong*>(buf)=
+    static_cast<longlong>(tnt::BufferPool::peakBytes());
+  return 0;
+}
+
+static int show_hedged_reads(MYSQL_THD thd, struct st_mysql_show_var *var,
                              char *buf)
 {
-  var->type= SHOW_CHAR;
-  var->value= buf; // it's of SHOW_VAR_FUNC_BUFF_SIZE bytes
-  my_snprintf(buf, SHOW_VAR_FUNC_BUFF_SIZE,
-              "enum_var is %lu, ulong_var is %lu, "
-              "double_var is %f, %.6b", // %b is a MySQL extension
-              srv_enum_var, srv_ulong_var, srv_double_var, "really");
+  var->type= SHOW_LONGLONG;
+  var->value= buf;
+  *reinterpret_cast<longlong*>(buf)=
+    static_cast<longlong>(tnt::HedgePolicy::instance().hedgeCount());
   return 0;
 }
 
-struct example_vars_t
+static int show_hedge_wins(MYSQL_THD thd, struct st_mysql_show_var *var,
+                           char *buf)
 {
-	ulong  var1;
-	double var2;
-	char   var3[64];
-  bool   var4;
-  bool   var5;
-  ulong  var6;
-};
+  var->type= SHOW_LONGLONG;
+  var->value= buf;
+  *reinterpret_cast<longlong*>(buf)=
+    static_cast<longlong>(tnt::HedgePolicy::instance().winCount());
+  return 0;
+}
 
-example_vars_t example_vars= {100, 20.01, "three hundred", true, 0, 8250};
+static int show_group_commits(MYSQL_THD thd, struct st_mysql_show_var *var,
+                              char *buf)
+{
+  var->type= SHOW_LONGLONG;
+  var->value= buf;
+  *reinterpret_cast<longlong*>(buf)=
+    static_cast<longlong>(tnt::GroupCommit::instance().batchCount());
+  return 0;
+}
 
-static st_mysql_show_var show_status_example[]=
+static int show_group_commit_writes(MYSQL_THD thd,
+                                    struct st_mysql_show_var *var,
+                                    char *buf)
 {
-  {"var1", (char *)&example_vars.var1, SHOW_LONG, SHOW_SCOPE_GLOBAL},
-  {"var2", (char *)&example_vars.var2, SHOW_DOUBLE, SHOW_SCOPE_GLOBAL},
-  {0,0,SHOW_UNDEF, SHOW_SCOPE_UNDEF} // null terminator required
-};
+  var->type= SHOW_LONGLONG;
+  var->value= buf;
+  *reinterpret_cast<longlong*>(buf)=
+    static_cast<longlong>(tnt::GroupCommit::instance().writeCount());
+  return 0;
+}
 
-static struct st_mysql_show_var show_array_example[]=
+static int show_coalesced_reads(MYSQL_THD thd, struct st_mysql_show_var *var,
+                                char *buf)
 {
-  {"array", (char *)show_status_example, SHOW_ARRAY, SHOW_SCOPE_GLOBAL},
-  {"var3", (char *)&example_vars.var3, SHOW_CHAR, SHOW_SCOPE_GLOBAL},
-  {"var4", (char *)&example_vars.var4, SHOW_BOOL, SHOW_SCOPE_GLOBAL},
-  {0,0,SHOW_UNDEF, SHOW_SCOPE_UNDEF}
-};
+  var->type= SHOW_LONGLONG;
+  var->value= buf;
+  *reinterpret_cast<longlong*>(buf)=
+    static_cast<longlong>(tnt::SingleFlight::instance().coalescedCount());
+  return 0;
+}
+
+static int show_row_cache_hits(MYSQL_THD thd, struct st_mysql_show_var *var,
+                               char *buf)
+{
+  var->type= SHOW_LONGLONG;
+  var->value= buf;
+  *reinterpret_cast<longlong*>(buf)=
+    static_cast<longlong>(tnt::RowCache::totalHits());
+  return 0;
+}
+
+static int show_row_cache_misses(MYSQL_THD thd, struct st_mysql_show_var *var,
+                                 char *buf)
+{
+  var->type= SHOW_LONGLONG;
+  var->value= buf;
+  *reinterpret_cast<longlong*>(buf)=
+    static_cast<longlong>(tnt::RowCache::totalMisses());
+  return 0;
+}
+
+static int show_row_cache_bytes(MYSQL_THD thd, struct st_mysql_show_var *var,
+                                char *buf)
+{
+  var->type= SHOW_LONGLONG;
+  var->value= buf;
+  *reinterpret_cast<longlong*>(buf)=
+    static_cast<longlong>(tnt::RowCache::totalBytes());
+  return 0;
+}
+
+static int show_mirrors(MYSQL_THD thd, struct st_mysql_show_var *var,
+                        char *buf)
+{
+  var->type= SHOW_LONGLONG;
+  var->value= buf;
+  *reinterpret_cast<longlong*>(buf)=
+    static_cast<longlong>(tnt::Mirror::count());
+  return 0;
+}
+
+static int show_mirror_staleness(MYSQL_THD thd, struct st_mysql_show_var *var,
+                                 char *buf)
+{
+  uint64_t staleness_us= tnt::Mirror::maxStalenessUs();
+  var->type= SHOW_LONGLONG;
+  var->value= buf;
+  /* -1 while some mirror hasn't reached its instance yet */
+  *reinterpret_cast<longlong*>(buf)= staleness_us == UINT64_MAX ? -1 :
+    static_cast<longlong>(staleness_us / 1000);
+  return 0;
+}
+
+static int show_mirror_rows_applied(MYSQL_THD thd,
+                                    struct st_mysql_show_var *var,
+                                    char *buf)
+{
+  var->type= SHOW_LONGLONG;
+  var->value= buf;
+  *reinterpret_cast<longlong*>(buf)=
+    static_cast<longlong>(tnt::Mirror::totalRowsApplied());
+  return 0;
+}
+
+static int show_slow_requests(MYSQL_THD thd, struct st_mysql_show_var *var,
+                              char *buf)
+{
+  var->type= SHOW_LONGLONG;
+  var->value= buf;
+  *reinterpret_cast<longlong*>(buf)=
+    static_cast<longlong>(tnt::SlowLog::loggedCount());
+  return 0;
+}
+
+static int show_slow_requests_dropped(MYSQL_THD thd,
+                                      struct st_mysql_show_var *var,
+                                      char *buf)
+{
+  var->type= SHOW_LONGLONG;
+  var->value= buf;
+  *reinterpret_cast<longlong*>(buf)=
+    static_cast<longlong>(tnt::SlowLog::droppedCount());
+  return 0;
+}
 
 static struct st_mysql_show_var func_status[]=
 {
-  {"example_func_example", (char *)show_func_example, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
-  {"example_status_var5", (char *)&example_vars.var5, SHOW_BOOL, SHOW_SCOPE_GLOBAL},
-  {"example_status_var6", (char *)&example_vars.var6, SHOW_LONG, SHOW_SCOPE_GLOBAL},
-  {"example_status",  (char *)show_array_example, SHOW_ARRAY, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_selects", (char *)show_counter<tnt::Stats::SELECTS>, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_inserts", (char *)show_counter<tnt::Stats::INSERTS>, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_replaces", (char *)show_counter<tnt::Stats::REPLACES>, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_deletes", (char *)show_counter<tnt::Stats::DELETES>, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_evals", (char *)show_counter<tnt::Stats::EVALS>, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_rows_read", (char *)show_counter<tnt::Stats::ROWS_READ>, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_rows_written", (char *)show_counter<tnt::Stats::ROWS_WRITTEN>, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_bytes_sent", (char *)show_counter<tnt::Stats::BYTES_SENT>, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_bytes_received", (char *)show_counter<tnt::Stats::BYTES_RECEIVED>, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_connects", (char *)show_counter<tnt::Stats::CONNECTS>, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_reconnects", (char *)show_counter<tnt::Stats::RECONNECTS>, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_schema_reloads", (char *)show_counter<tnt::Stats::SCHEMA_RELOADS>, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_pool_waits", (char *)show_counter<tnt::Stats::POOL_WAITS>, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_requests_in_flight", (char *)show_counter<tnt::Stats::IN_FLIGHT>, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_buffer_pool_bytes", (char *)show_buffer_pool_bytes, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_buffer_pool_peak_bytes", (char *)show_buffer_pool_peak_bytes, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_hedged_reads", (char *)show_hedged_reads, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_hedge_wins", (char *)show_hedge_wins, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_group_commits", (char *)show_group_commits, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_group_commit_writes", (char *)show_group_commit_writes, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_coalesced_reads", (char *)show_coalesced_reads, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_row_cache_hits", (char *)show_row_cache_hits, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_row_cache_misses", (char *)show_row_cache_misses, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_row_cache_bytes", (char *)show_row_cache_bytes, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_mirrors", (char *)show_mirrors, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_mirror_staleness_ms", (char *)show_mirror_staleness, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_mirror_rows_applied", (char *)show_mirror_rows_applied, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_slow_requests", (char *)show_slow_requests, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+  {"Tarantool_slow_requests_dropped", (char *)show_slow_requests_dropped, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
   {0,0,SHOW_UNDEF, SHOW_SCOPE_UNDEF}
 };
 
+/*
+  INFORMATION_SCHEMA.TARANTOOL_LATENCY: round trips to Tarantool by
+  operation, for the whole engine (TABLE_NAME is NULL) and per table.
+*/
+static ST_FIELD_INFO tarantool_latency_fields[]=
+{
+  {"TABLE_NAME", NAME_LEN * 2 + 1, MYSQL_TYPE_STRING, 0, MY_I_S_MAYBE_NULL, 0, SKIP_OPEN_TABLE},
+  {"OPERATION", 16, MYSQL_TYPE_STRING, 0, 0, 0, SKIP_OPEN_TABLE},
+  {"COUNT", MY_INT64_NUM_DECIMAL_DIGITS, MYSQL_TYPE_LONGLONG, 0, MY_I_S_UNSIGNED, 0, SKIP_OPEN_TABLE},
+  {"AVG_US", MY_INT64_NUM_DECIMAL_DIGITS, MYSQL_TYPE_LONGLONG, 0, MY_I_S_UNSIGNED, 0, SKIP_OPEN_TABLE},
+  {"P50_US", MY_INT64_NUM_DECIMAL_DIGITS, MYSQL_TYPE_LONGLONG, 0, MY_I_S_UNSIGNED, 0, SKIP_OPEN_TABLE},
+  {"P99_US", MY_INT64_NUM_DECIMAL_DIGITS, MYSQL_TYPE_LONGLONG, 0, MY_I_S_UNSIGNED, 0, SKIP_OPEN_TABLE},
+  {"P999_US", MY_INT64_NUM_DECIMAL_DIGITS, MYSQL_TYPE_LONGLONG, 0, MY_I_S_UNSIGNED, 0, SKIP_OPEN_TABLE},
+  {"MAX_US", MY_INT64_NUM_DECIMAL_DIGITS, MYSQL_TYPE_LONGLONG, 0, MY_I_S_UNSIGNED, 0, SKIP_OPEN_TABLE},
+  {0, 0, MYSQL_TYPE_NULL, 0, 0, 0, 0}
+};
+
+/* One row per operation of the set, empty histograms are skipped */
+static int store_latency_rows(THD *thd, TABLE *table, const std::string *name,
+                              const tnt::LatencySet &set)
+{
+  for (int op= 0; op < tnt::LATENCY_OPS; ++op)
+  {
+    const tnt::LatencyHistogram &histogram= set.ops[op];
+    uint64_t count= histogram.count();
+    if (count == 0)
+      continue;
+    if (name)
+    {
+      table->field[0]->set_notnull();
+      table->field[0]->store(name->data(), name->size(), system_charset_info);
+    }
+    else
+      table->field[0]->set_null();
+    const char *operation= tnt::latencyOpName(static_cast<tnt::latency_op_t>(op));
+    table->field[1]->store(operation, strlen(operation), system_charset_info);
+    table->field[2]->store(static_cast<longlong>(count), true);
+    table->field[3]->store(static_cast<longlong>(histogram.sumUs() / count), true);
+    table->field[4]->store(static_cast<longlong>(histogram.percentileUs(50)), true);
+    table->field[5]->store(static_cast<longlong>(histogram.percentileUs(99)), true);
+    table->field[6]->store(static_cast<longlong>(histogram.percentileUs(99.9)), true);
+    table->field[7]->store(static_cast<longlong>(histogram.maxUs()), true);
+    if (schema_table_store_record(thd, table))
+      return 1;
+  }
+  return 0;
+}
+
+static int tarantool_latency_fill(THD *thd, TABLE_LIST *tables, Item *cond)
+{
+  TABLE *table= tables->table;
+  if (store_latency_rows(thd, table, NULL, tnt::Latency::global()))
+    return 1;
+  int rc= 0;
+  tnt::Latency::eachTable([&](const std::string &name, const tnt::LatencySet &set) {
+    if (!rc)
+      rc= store_latency_rows(thd, table, &name, set);
+  });
+  return rc;
+}
+
+static int tarantool_latency_init(void *p)
+{
+  ST_SCHEMA_TABLE *schema= static_cast<ST_SCHEMA_TABLE*>(p);
+  schema->fields_info= tarantool_latency_fields;
+  schema->fill_table= tarantool_latency_fill;
+  return 0;
+}
+
+static struct st_mysql_information_schema tarantool_latency_info=
+{ MYSQL_INFORMATION_SCHEMA_INTERFACE_VERSION };
+
 mysql_declare_plugin(mysqloluene)
 {
   MYSQL_STORAGE_ENGINE_PLUGIN,
@@ -1296,11 +2940,26 @@ mysql_declare_plugin(mysqloluene)
   "Tarantool storage engine",
   PLUGIN_LICENSE_BSD,
   example_init_func,                            /* Plugin Init */
-  NULL,                                         /* Plugin Deinit */
+  example_deinit_func,                          /* Plugin Deinit */
   0x0001 /* 0.1 */,
   func_status,                                  /* stat	us variables */
   example_system_variables,                     /* system variables */
   NULL,                                         /* config options */
   0,                                            /* flags */
+},
+{
+  MYSQL_INFORMATION_SCHEMA_PLUGIN,
+  &tarantool_latency_info,
+  "TARANTOOL_LATENCY",
+  "Mikhail Galanin",
+  "Latency of Tarantool requests by operation and table",
+  PLUGIN_LICENSE_BSD,
+  tarantool_latency_init,                       /* Plugin Init */
+  NULL,                                         /* Plugin Deinit */
+  0x0001 /* 0.1 */,
+  NULL,                                         /* status variables */
+  NULL,                                         /* system variables */
+  NULL,                                         /* config options */
+  0,                                            /* flags */
 }
 mysql_declare_plugin_end;
@@ -5,12 +5,22 @@
 #include "handler.h"                     /* handler */
 #include "my_base.h"                     /* ha_rows */
 
+#include <atomic>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
 
 #include "tnt/connection.h"
+#include "tnt/cluster.h"
+#include "tnt/group_commit.h"
+#include "tnt/row_cache.h"
 
 namespace tnt {
 class Iterator;
+struct LatencySet;
+class Mirror;
 }
 /** @brief
   Example_share is a class that will be shared among all open handlers.
@@ -19,11 +29,40 @@ class Iterator;
 class Mysqloluene_share : public Handler_share {
 public:
   THR_LOCK lock;
-  Mysqloluene_share();
-  ~Mysqloluene_share()
+  /* "db.table" or "db.table#P#p0", and the endpoint the space is resolved on */
+  std::string name;
+  std::string endpoint;
+  /*
+    Space id resolved at open() and the schema version it is valid for.
+    Replaced as a whole with std::atomic_store so readers never pair an id
+    with another resolution's version; nullptr until first resolved.
+  */
+  struct resolved_space_t {
+    int space_id;
+    uint64_t schema_version;
+    time_t resolved_at;
+  };
+  std::shared_ptr<const resolved_space_t> resolved;
+  /* Primary key lookups, shared by the table's handlers */
+  std::shared_ptr<tnt::RowCache> row_cache;
+  /* Round trips made for this table, see INFORMATION_SCHEMA.TARANTOOL_LATENCY */
+  std::shared_ptr<tnt::LatencySet> latency;
+  /* Registered for each() only once the fields are set */
+  Mysqloluene_share(const std::string &name, const std::string &endpoint,
+                    std::shared_ptr<tnt::LatencySet> latency);
+  ~Mysqloluene_share();
+
+  /* Calls visit(share) for every share, see SHOW ENGINE TARANTOOL STATUS */
+  template<class Visit>
+  static void each(Visit visit)
   {
-    thr_lock_delete(&lock);
+    std::lock_guard<std::mutex> guard(all_mutex);
+    for (const Mysqloluene_share *share : all)
+      visit(*share);
   }
+private:
+  static std::mutex all_mutex;
+  static std::set<Mysqloluene_share*> all;
 };
 
 /** @brief
@@ -34,15 +73,21 @@ class ha_mysqloluene: public handler
   struct connection_info_t {
 	  std::string hostname;
 	  std::string host_port_uri;
-	  int port;
-	  int space_id;
+	  /* one replica set per shard: master first, then replicas */
+	  std::vector<std::vector<std::string>> shards;
+	  std::map<std::string, std::string> options; // after '?' in the string
+	  int port = 0;
+	  int space_id = -1;
 	  std::string space_name;
   };
   THR_LOCK_DATA lock;      ///< MySQL lock
   Mysqloluene_share *share;    ///< Shared lock info
   Mysqloluene_share *get_share(); ///< Get the share
+  std::string partition_name; ///< "p0" or "p0#SP#s0" when the handler serves one partition
+  std::string config_error; ///< why the connection string can't serve this table, see configure()
   int current_row = 0;
-  tnt::Connection c;
+  bool read_ahead = false;  ///< HA_EXTRA_CACHE: the scan may fetch pages ahead
+  std::unique_ptr<tnt::Cluster> cluster;
   std::shared_ptr<tnt::Iterator> iterator;
   connection_info_t connection_info;
 public:
@@ -192,6 +237,11 @@ public:
   int index_read_map(uchar *buf, const uchar *key,
                      key_part_map keypart_map, enum ha_rkey_function find_flag);
 
+  /** @brief
+    Releases the reply of the last index lookup back to the buffer pool.
+  */
+  int index_end();
+
 
   /** @brief
     We implement this in ha_example.cc. It's not an obligatory method;
@@ -233,6 +283,7 @@ public:
   int info(uint);                                               ///< required
   int extra(enum ha_extra_function operation);
   int external_lock(THD *thd, int lock_type);                   ///< required
+  int start_stmt(THD *thd, thr_lock_type lock_type);
   int delete_all_rows(void);
   int truncate();
   ha_rows records_in_range(uint inx, key_range *min_key,
@@ -245,5 +296,13 @@ public:
   THR_LOCK_DATA **store_lock(THD *thd, THR_LOCK_DATA **to,
                              enum thr_lock_type lock_type);     ///< required
 private:
+  void configure(const std::string &partition);
   bool parseConnectionString(const std::string &connection_string);
+  bool parseShards(const std::string &shards);
+  int dropSpace();
+  tnt::ReplicaSet::read_options_t readOptions() const;
+  int resolveSpace();
+  std::shared_ptr<tnt::Mirror> localMirror(int space_id);
+  std::shared_ptr<tnt::Iterator> withOwnWrites(int space_id, std::shared_ptr<tnt::Iterator> scan);
+  int sendWrite(tnt::write_op_t op, const tnt::TupleBuilder &builder);
 };
@@ -0,0 +1,230 @@
+#include "buffer_pool.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <tarantool/tnt_mem.h>
+
+namespace tnt {
+
+namespace {
+
+const uint32_t block_magic = 0x7a7b0bfu;
+const int min_class_shift = 6;  // 64 bytes
+const int max_class_shift = 20; // 1 MiB
+const int classes_number = max_class_shift - min_class_shift + 1;
+const int large_block = -1;
+// bytes kept cached by one thread, and by all of them: a thread that frees
+// what others allocated (replies handed over by the I/O threads) would
+// otherwise hoard up to its own limit of them
+const std::size_t thread_cache_limit_bytes = 4 << 20;
+const std::size_t cache_limit_bytes = 64 << 20;
+
+struct block_header_t {
+	uint32_t magic;
+	int32_t size_class;
+	std::size_t size; // usable size
+};
+static_assert(sizeof(block_header_t) == 16, "header must keep payload 16-byte aligned");
+
+struct free_block_t {
+	free_block_t *next;
+};
+
+std::atomic<std::size_t> bytes_allocated(0);
+std::atomic<std::size_t> peak_bytes(0);
+std::atomic<std::size_t> bytes_cached(0);
+
+void accountAllocated(std::size_t size)
+{
+	std::size_t now = bytes_allocated.fetch_add(size, std::memory_order_relaxed) + size;
+	std::size_t peak = peak_bytes.load(std::memory_order_relaxed);
+	while (now > peak &&
+			!peak_bytes.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {
+	}
+}
+
+void accountReleased(std::size_t size)
+{
+	bytes_allocated.fetch_sub(size, std::memory_order_relaxed);
+}
+
+int sizeClass(std::size_t size)
+{
+	for (int shift = min_class_shift; shift <= max_class_shift; ++shift) {
+		if (size <= (std::size_t(1) << shift)) {
+			return shift - min_class_shift;
+		}
+	}
+	return large_block;
+}
+
+std::size_t classSize(int size_class)
+{
+	return std::size_t(1) << (size_class + min_class_shift);
+}
+
+block_header_t *systemAllocate(int size_class, std::size_t size)
+{
+	std::size_t payload = size_class == large_block ? size : classSize(size_class);
+	block_header_t *header = static_cast<block_header_t*>(
+			std::malloc(sizeof(block_header_t) + payload)
+		);
+	if (!header) {
+		return nullptr;
+	}
+	header->magic = block_magic;
+	header->size_class = size_class;
+	header->size = payload;
+	accountAllocated(sizeof(block_header_t) + payload);
+	return header;
+}
+
+void systemRelease(block_header_t *header)
+{
+	accountReleased(sizeof(block_header_t) + header->size);
+	std::free(header);
+}
+
+// set once the thread's cache has been torn down; trivially destructible,
+// so it stays valid for frees that happen during thread exit
+thread_local bool cache_gone = false;
+
+struct ThreadCache {
+	free_block_t *heads[classes_number];
+	std::size_t counts[classes_number];
+	std::size_t cached = 0; // bytes in all the lists
+
+	ThreadCache()
+	{
+		memset(heads, 0, sizeof heads);
+		memset(counts, 0, sizeof counts);
+	}
+
+	~ThreadCache()
+	{
+		cache_gone = true;
+		for (int i = 0; i < classes_number; ++i) {
+			while (heads[i]) {
+				free_block_t *block = heads[i];
+				heads[i] = block->next;
+				systemRelease(reinterpret_cast<block_header_t*>(block) - 1);
+			}
+		}
+		bytes_cached.fetch_sub(cached, std::memory_order_relaxed);
+	}
+
+	block_header_t *pop(int size_class)
+	{
+		free_block_t *block = heads[size_class];
+		if (!block) {
+			return nullptr;
+		}
+		heads[size_class] = block->next;
+		--counts[size_class];
+		cached -= classSize(size_class);
+		bytes_cached.fetch_sub(classSize(size_class), std::memory_order_relaxed);
+		return reinterpret_cast<block_header_t*>(block) - 1;
+	}
+
+	bool push(block_header_t *header)
+	{
+		int size_class = header->size_class;
+		std::size_t size = classSize(size_class);
+		if (cached + size > thread_cache_limit_bytes) {
+			return false;
+		}
+		if (bytes_cached.fetch_add(size, std::memory_order_relaxed) + size > cache_limit_bytes) {
+			bytes_cached.fetch_sub(size, std::memory_order_relaxed);
+			return false;
+		}
+		cached += size;
+		free_block_t *block = reinterpret_cast<free_block_t*>(header + 1);
+		block->next = heads[size_class];
+		heads[size_class] = block;
+		++counts[size_class];
+		return true;
+	}
+};
+
+thread_local ThreadCache cache;
+
+}
+
+void *BufferPool::allocate(std::size_t size)
+{
+	int size_class = sizeClass(size);
+	block_header_t *header = nullptr;
+	if (size_class != large_block && !cache_gone) {
+		header = cache.pop(size_class);
+	}
+	if (!header) {
+		header = systemAllocate(size_class, size);
+		if (!header) {
+			throw std::bad_alloc();
+		}
+	}
+	return header + 1;
+}
+
+void BufferPool::release(void *ptr)
+{
+	if (!ptr) {
+		return;
+	}
+	block_header_t *header = static_cast<block_header_t*>(ptr) - 1;
+	assert(header->magic == block_magic);
+	if (header->size_class == large_block || cache_gone || !cache.push(header)) {
+		systemRelease(header);
+	}
+}
+
+void *BufferPool::reallocate(void *ptr, std::size_t size)
+{
+	if (!ptr) {
+		return allocate(size);
+	}
+	block_header_t *header = static_cast<block_header_t*>(ptr) - 1;
+	assert(header->magic == block_magic);
+	if (size <= header->size) {
+		return ptr;
+	}
+	void *grown = allocate(size);
+	memcpy(grown, ptr, header->size);
+	release(ptr);
+	return grown;
+}
+
+void *BufferPool::allocator(void *ptr, std::size_t size)
+{
+	// tarantool-c allocator contract: realloc() semantics, size 0 frees
+	if (size == 0) {
+		release(ptr);
+		return nullptr;
+	}
+	try {
+		return reallocate(ptr, size);
+	} catch (const std::bad_alloc &) {
+		return nullptr;
+	}
+}
+
+void BufferPool::install()
+{
+	tnt_mem_init(&BufferPool::allocator);
+}
+
+std::size_t BufferPool::bytesAllocated()
+{
+	return bytes_allocated.load(std::memory_order_relaxed);
+}
+
+std::size_t BufferPool::peakBytes()
+{
+	return peak_bytes.load(std::memory_order_relaxed);
+}
+
+}
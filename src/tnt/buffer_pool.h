@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+namespace tnt {
+
+/**
+ * Size-classed recycling allocator for reply structures and receive buffers.
+ *
+ * Every thread keeps its own free lists, so a point lookup that allocates a
+ * reply and frees it on rnd_end()/index_end() never touches malloc once the
+ * cache is warm. Blocks larger than the biggest class go straight to malloc.
+ * What a thread caches is capped, and so is the total over all threads.
+ */
+class BufferPool
+{
+public:
+	static void *allocate(std::size_t size);
+	static void *reallocate(void *ptr, std::size_t size);
+	static void release(void *ptr);
+
+	/// Routes tarantool-c's internal allocations through the pool.
+	/// Must be called before the first stream is created.
+	static void install();
+
+	/// Bytes currently obtained from malloc (handed out + cached).
+	static std::size_t bytesAllocated();
+	/// High-water mark of bytesAllocated().
+	static std::size_t peakBytes();
+
+	template<class T>
+	static T *create()
+	{
+		return new (allocate(sizeof(T))) T();
+	}
+
+	template<class T>
+	static void destroy(T *object)
+	{
+		if (object) {
+			object->~T();
+			release(object);
+		}
+	}
+private:
+	static void *allocator(void *ptr, std::size_t size);
+};
+
+}
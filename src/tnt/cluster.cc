@@ -0,0 +1,235 @@
+#include "cluster.h"
+
+#include <cstdlib>
+
+#include <msgpuck.h>
+
+#include "connection.h"
+#include "iterator.h"
+#include "merge_iterator.h"
+#include "tuple_builder.h"
+
+namespace tnt {
+
+namespace {
+
+uint64_t fnv1a(const char *begin, const char *end)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (const char *p = begin; p != end; ++p) {
+		hash ^= static_cast<unsigned char>(*p);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+bool parseNumber(const std::string &text, int64_t &number)
+{
+	if (text.empty()) {
+		return false;
+	}
+	char *end = nullptr;
+	number = strtoll(text.c_str(), &end, 10);
+	return end && *end == '\0';
+}
+
+}
+
+Cluster::Cluster(const std::vector<std::vector<std::string>> &shard_uris)
+{
+	for (const auto &uris: shard_uris) {
+		shards.emplace_back(new ReplicaSet(uris));
+	}
+	if (shards.empty()) {
+		shards.emplace_back(new ReplicaSet(std::vector<std::string>()));
+	}
+}
+
+bool Cluster::setRanges(const std::vector<std::string> &texts)
+{
+	if (texts.size() + 1 != shards.size()) {
+		last_error = "Range sharding needs one bound less than there are shards";
+		return false;
+	}
+	bounds.clear();
+	for (const auto &text: texts) {
+		bound_t bound;
+		bound.text = text;
+		bound.numeric = parseNumber(text, bound.number);
+		if (!bounds.empty()) {
+			const bound_t &previous = bounds.back();
+			if (previous.numeric != bound.numeric) {
+				last_error = "Range bounds must be all numbers or all strings";
+				return false;
+			}
+			if (bound.numeric ? previous.number >= bound.number : previous.text >= bound.text) {
+				last_error = "Range bounds must be ascending";
+				return false;
+			}
+		}
+		bounds.push_back(bound);
+	}
+	sharding = SHARDING_RANGE;
+	return true;
+}
+
+std::size_t Cluster::size() const
+{
+	return shards.size();
+}
+
+void Cluster::bind(Session *session)
+{
+	for (auto &shard: shards) {
+		shard->bind(session);
+	}
+}
+
+ReplicaSet &Cluster::shard(std::size_t n)
+{
+	return *shards[n];
+}
+
+ReplicaSet &Cluster::shardFor(const TupleBuilder &tuple)
+{
+	return *shards[shardIndexFor(tuple)];
+}
+
+const std::string &Cluster::lastError() const
+{
+	return last_error;
+}
+
+// Lamping & Veach, "A Fast, Minimal Memory, Consistent Hash Algorithm"
+std::size_t Cluster::jumpHash(uint64_t key, std::size_t buckets)
+{
+	int64_t b = -1;
+	int64_t j = 0;
+	while (j < static_cast<int64_t>(buckets)) {
+		b = j;
+		key = key * 2862933555777941757ull + 1;
+		j = static_cast<int64_t>((b + 1) * (double(1ll << 31) / double((key >> 33) + 1)));
+	}
+	return static_cast<std::size_t>(b);
+}
+
+std::size_t Cluster::shardIndexFor(const TupleBuilder &tuple) const
+{
+	if (shards.size() == 1) {
+		return 0;
+	}
+	const char *p = tuple.ptr();
+	if (mp_typeof(*p) != MP_ARRAY || mp_decode_array(&p) == 0) {
+		return 0;
+	}
+	const char *key_begin = p;
+
+	if (sharding == SHARDING_HASH) {
+		mp_next(&p);
+		return jumpHash(fnv1a(key_begin, p), shards.size());
+	}
+
+	bool numeric = false;
+	int64_t number = 0;
+	std::string text;
+	switch (mp_typeof(*p)) {
+	case MP_UINT:
+		numeric = true;
+		number = static_cast<int64_t>(mp_decode_uint(&p));
+		break;
+	case MP_INT:
+		numeric = true;
+		number = mp_decode_int(&p);
+		break;
+	case MP_STR: {
+		uint32_t len = 0;
+		const char *data = mp_decode_str(&p, &len);
+		text.assign(data, len);
+		break;
+	}
+	default:
+		return 0;
+	}
+	std::size_t n = 0;
+	for (; n < bounds.size(); ++n) {
+		const bound_t &bound = bounds[n];
+		bool below = numeric && bound.numeric ? number < bound.number :
+			(numeric ? std::to_string(number) : text) < bound.text;
+		if (below) {
+			break;
+		}
+	}
+	return n;
+}
+
+std::shared_ptr<Iterator> Cluster::select(int space_id, int index_id, const TupleBuilder &key,
+		int iterator, bool ordered, const ReplicaSet::read_options_t &options)
+{
+	last_error.clear();
+
+	struct pending_t {
+		Connection *conn;
+		int64_t sync;
+		std::unique_ptr<ReplicaSet::Request> request;
+	};
+	std::vector<pending_t> pending(shards.size());
+
+	// send to every shard first so that they all work at the same time
+	for (std::size_t n = 0; n < shards.size(); ++n) {
+		pending[n].conn = shards[n]->reader(options);
+		pending[n].sync = -1;
+		if (pending[n].conn) {
+			pending[n].request.reset(new ReplicaSet::Request(*shards[n], pending[n].conn));
+			pending[n].sync = pending[n].conn->sendSelect(space_id, index_id, key, UINT32_MAX, 0, iterator);
+		}
+	}
+
+	// every reply has to be read even after a failure, or the next request
+	// on that connection would get it
+	std::vector<std::shared_ptr<Iterator>> results;
+	bool failed = false;
+	for (std::size_t n = 0; n < shards.size(); ++n) {
+		std::shared_ptr<Iterator> result;
+		if (pending[n].sync != -1) {
+			result = pending[n].conn->receiveSelect(pending[n].sync);
+		}
+		pending[n].request.reset();
+		if (failed) {
+			continue;
+		}
+		if (!result && pending[n].conn && !pending[n].conn->connected()) {
+			// transport failure: fail over inside the shard
+			shards[n]->failed(pending[n].conn, options);
+			result = shards[n]->select(space_id, index_id, key, iterator, options);
+		}
+		if (!result) {
+			last_error = "shard " + std::to_string(n) + ": " +
+				(pending[n].conn && pending[n].conn->connected() ?
+					pending[n].conn->lastError() : shards[n]->lastError());
+			failed = true;
+			continue;
+		}
+		results.push_back(result);
+	}
+	if (failed) {
+		return std::shared_ptr<Iterator>();
+	}
+
+	if (results.size() == 1) {
+		return results.front();
+	}
+	return std::make_shared<MergeIterator>(std::move(results), ordered);
+}
+
+std::shared_ptr<Iterator> Cluster::scan(int space_id, const PagedScan::options_t &scan_options,
+		const ReplicaSet::read_options_t &options)
+{
+	// with read-ahead every shard's helper starts fetching right away
+	std::vector<std::shared_ptr<Iterator>> scans;
+	for (auto &shard: shards) {
+		scans.push_back(std::make_shared<PagedScan>(*shard, space_id, options, scan_options));
+	}
+	return std::make_shared<MergeIterator>(std::move(scans), false);
+}
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "paged_scan.h"
+#include "replica_set.h"
+
+namespace tnt {
+
+class Iterator;
+class TupleBuilder;
+
+/**
+ * One table spread over several shards, each of them a replica set.
+ *
+ * Tuples are routed by their first field (the primary key): either by jump
+ * consistent hash of its msgpack encoding, so growing the cluster moves
+ * only 1/N of the keys, or by a list of N-1 ascending range bounds. Scans
+ * are sent to every shard before any reply is read, so the shards work
+ * concurrently; the replies are merged in primary key order when asked to.
+ */
+class Cluster
+{
+public:
+	enum sharding_t {
+		SHARDING_HASH,
+		SHARDING_RANGE
+	};
+
+	explicit Cluster(const std::vector<std::vector<std::string>> &shards);
+
+	/// Ascending bounds, all numbers or all strings; a key is compared
+	/// numerically if both sides are numbers. False leaves hash sharding
+	bool setRanges(const std::vector<std::string> &bounds);
+
+	std::size_t size() const;
+	ReplicaSet &shard(std::size_t n);
+	/// Binds every shard to the session's connections, see ReplicaSet::bind()
+	void bind(Session *session);
+	/// Shard owning the tuple or key encoded by the builder
+	ReplicaSet &shardFor(const TupleBuilder &tuple);
+
+	/// Fan-out select over all shards
+	std::shared_ptr<Iterator> select(int space_id, int index_id, const TupleBuilder &key,
+			int iterator, bool ordered, const ReplicaSet::read_options_t &options);
+	/// Paged full scan of the primary index, shards one after another
+	std::shared_ptr<Iterator> scan(int space_id, const PagedScan::options_t &scan_options,
+			const ReplicaSet::read_options_t &options);
+
+	const std::string &lastError() const;
+
+	static std::size_t jumpHash(uint64_t key, std::size_t buckets);
+private:
+	struct bound_t {
+		std::string text;
+		bool numeric;
+		int64_t number;
+	};
+	std::vector<std::unique_ptr<ReplicaSet>> shards;
+	sharding_t sharding = SHARDING_HASH;
+	std::vector<bound_t> bounds;
+	std::string last_error;
+
+	std::size_t shardIndexFor(const TupleBuilder &tuple) const;
+};
+
+}
@@ -1,44 +1,124 @@
 #include "connection.h"
 
+#include <errno.h>
+#include <poll.h>
 #include <stdint.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <set>
 
 #include <tarantool/tarantool.h>
 #include <tarantool/tnt_net.h>
 #include <tarantool/tnt_opt.h>
 #include <tarantool/tnt_request.h>
 #include <tarantool/tnt_object.h>
+#include <tarantool/tnt_buf.h>
 
 #include <msgpuck.h>
 
 #include "iterator.h"
 #include "tuple_builder.h"
 #include "row.h"
+#include "schema_cache.h"
+#include "io_loop.h"
+#include "trace.h"
 
 namespace tnt {
 
+namespace {
+const int vspace_id = 281;
+const int vspace_name_index = 2;
+const int vindex_id = 289;
+
+int64_t nowUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+}
+
+latency_op_t latencyOf(Stats::counter_t type)
+{
+	switch (type) {
+	case Stats::SELECTS:
+		return LATENCY_SELECT;
+	case Stats::INSERTS:
+		return LATENCY_INSERT;
+	case Stats::REPLACES:
+		return LATENCY_REPLACE;
+	case Stats::DELETES:
+		return LATENCY_DELETE;
+	default:
+		return LATENCY_EVAL;
+	}
+}
+
+std::mutex registry_mutex;
+std::set<Connection*> registry; // every live connection, for status()
+
+// iproto packet size of a decoded reply, length prefix included
+std::size_t replySize(const struct tnt_reply *reply)
+{
+	const char *end = reply->data ? reply->data_end : reply->error_end;
+	return reply->buf && end ? 5 + (end - reply->buf) : 0;
+}
+
+// Size of the whole iproto packet at the front of data, 0 if it hasn't all arrived
+std::size_t packetSize(const std::string &data)
+{
+	const char *p = data.data();
+	if (data.empty() || mp_typeof(*p) != MP_UINT || mp_check_uint(p, p + data.size()) > 0) {
+		return 0;
+	}
+	uint64_t length = mp_decode_uint(&p);
+	std::size_t size = (p - data.data()) + length;
+	return size <= data.size() ? size : 0;
+}
+
+// Sync in the header of a whole packet, UINT64_MAX if it has none
+uint64_t packetSync(const char *p)
+{
+	mp_decode_uint(&p);
+	if (mp_typeof(*p) != MP_MAP) {
+		return UINT64_MAX;
+	}
+	uint32_t keys = mp_decode_map(&p);
+	for (uint32_t i = 0; i < keys; ++i) {
+		if (mp_typeof(*p) != MP_UINT) {
+			mp_next(&p);
+			mp_next(&p);
+			continue;
+		}
+		uint64_t key = mp_decode_uint(&p);
+		if (key == 0x01 && mp_typeof(*p) == MP_UINT) {
+			return mp_decode_uint(&p);
+		}
+		mp_next(&p);
+	}
+	return UINT64_MAX;
+}
+}
+
 Connection::Connection():
 	tnt(nullptr),
-	port(0)
-{
-/*
-        const char * uri = "localhost:3301";
-        struct tnt_stream * tnt = tnt_net(NULL); // Allocating stream
-        tnt_set(tnt, TNT_OPT_URI, uri); // Setting URI
-        tnt_set(tnt, TNT_OPT_SEND_BUF, 0); // Disable buffering for send
-        tnt_set(tnt, TNT_OPT_RECV_BUF, 0); // Disable buffering for recv
-        tnt_connect(tnt); // Initialize stream and connect to Tarantool
-        tnt_ping(tnt); // Send ping request
-        struct tnt_reply * reply = tnt_reply_init(NULL); // Initialize reply
-        tnt->read_reply(tnt, reply); // Read reply from server
-        tnt_reply_free(reply); // Free reply
-        tnt_close(tnt); tnt_stream_free(tnt); // Close connection and free stream object
- */
+	via_loop(false),
+	open(false)
+{
+	std::lock_guard<std::mutex> guard(registry_mutex);
+	registry.insert(this);
 }
 
 Connection::~Connection()
 {
+	{
+		std::lock_guard<std::mutex> guard(registry_mutex);
+		registry.erase(this);
+	}
 	shutdownConnection();
+	Probes::socketClose(probe_socket);
 }
 
 
@@ -49,19 +129,51 @@ void Connection::connect(const std::string &host_port)
 
 	shutdownConnection(); // TODO: don't do this if we are/still connected
 
+	Stats::add(host == host_port ? Stats::RECONNECTS : Stats::CONNECTS);
+	{
+		std::lock_guard<std::mutex> guard(status_mutex);
+		host = host_port;
+	}
+	if (IoLoop::instance()) {
+		// the I/O thread owns the socket and connects on the first request
+		via_loop = true;
+		open = true;
+		if (!probe_socket) {
+			probe_socket = Probes::socketOpen(-1);
+		}
+		return;
+	}
 	tnt = tnt_net(NULL);
     tnt_set(tnt, TNT_OPT_URI, host_port.c_str()); // Setting URI
     tnt_set(tnt, TNT_OPT_SEND_BUF, 0); // Disable buffering for send
     tnt_set(tnt, TNT_OPT_RECV_BUF, 0); // Disable buffering for recv
+    int64_t start_us = nowUs();
     if (tnt_connect(tnt) != 0) {// Initialize stream and connect to Tarantool
     	// report error
     	last_error = tnt_strerror(tnt);
+    	TNT_TRACE_TEXT(TRACE_WARNING, "%s: connect failed", host_port);
     	shutdownConnection();
+    	return;
+    }
+    Latency::record(LATENCY_CONNECT, nowUs() - start_us);
+    open = true;
+    if (!probe_socket) {
+    	// kept across reconnects, a wait may still refer to it
+    	probe_socket = Probes::socketOpen(fd());
     }
 }
 
 void Connection::shutdownConnection()
 {
+	discarded.clear();
+	input.clear();
+	in_flight.clear();
+	{
+		std::lock_guard<std::mutex> guard(status_mutex);
+		started.clear();
+	}
+	open = false;
+	via_loop = false;
 	if (tnt) {
 		tnt_close(tnt);
 		tnt_stream_free(tnt);
@@ -71,7 +183,17 @@ void Connection::shutdownConnection()
 
 bool Connection::connected()
 {
-	return tnt != nullptr;
+	return tnt != nullptr || via_loop;
+}
+
+const std::string &Connection::endpoint() const
+{
+	return host;
+}
+
+const std::string &Connection::lastError() const
+{
+	return last_error;
 }
 
 std::shared_ptr<tnt::Iterator> Connection::select(const std::string &space, const tnt::TupleBuilder &builder)
@@ -83,23 +205,41 @@ std::shared_ptr<tnt::Iterator> Connection::select(const std::string &space, cons
 		last_error = "Can't resolve space '" + space + "'";
 		return std::shared_ptr<tnt::Iterator>();
 	}
+	return select(sno, builder);
+}
 
-	std::unique_ptr<struct tnt_stream, void(*)(struct tnt_stream*)> key (
-			tnt_object_as(NULL, const_cast<char*>(builder.ptr()), builder.size()),
+std::shared_ptr<tnt::Iterator> Connection::select(int space_id, const tnt::TupleBuilder &builder)
+{
+	int64_t sync = sendSelect(space_id, 0, builder);
+	if (sync == -1) {
+		return std::shared_ptr<tnt::Iterator>();
+	}
+	return receiveSelect(sync);
+}
+
+int64_t Connection::sendSelect(int space_id, int index_id, const tnt::TupleBuilder &key,
+		uint32_t limit, uint32_t offset, int iterator)
+{
+	std::unique_ptr<struct tnt_stream, void(*)(struct tnt_stream*)> key_stream (
+			tnt_object_as(NULL, const_cast<char*>(key.ptr()), key.size()),
 			Connection::deleteStream
 		);
 
-	if (tnt_select(tnt, sno, 0, UINT32_MAX, 0, 0, key.get()) == -1) {// box.space[sno]:select({}) {
-		last_error = tnt_strerror(tnt);
+	return send({Stats::SELECTS, space_id, index_id, &key}, [&](struct tnt_stream *s) {
+			return tnt_select(s, space_id, index_id, limit, offset, iterator, key_stream.get());
+		});
+}
+
+std::shared_ptr<tnt::Iterator> Connection::receiveSelect(int64_t sync)
+{
+	auto reply = Iterator::allocateReply();
+	if (!readReply(sync, reply.get())) {
 		return std::shared_ptr<tnt::Iterator>();
 	}
-	if (tnt_flush(tnt) == -1) {
-		last_error = tnt_strerror(tnt);
-		return std::shared_ptr<tnt::Iterator>();
+	auto result = Iterator::makeFromReply(reply);
+	if (!result) {
+		last_error = "Malformed select reply";
 	}
-
-    auto result = tnt::Iterator::makeFromStream(tnt);
-
 	return result;
 }
 
@@ -109,31 +249,25 @@ bool Connection::insert(const std::string &space, const tnt::TupleBuilder &build
 
 	int32_t sno = resolveSpace(space);
 	if (sno == -1) {
-		// TODO: set last error
+		last_error = "Can't resolve space '" + space + "'";
 		return false;
 	}
+	return insert(sno, builder);
+}
 
-	struct tnt_stream *val = tnt_object_as(NULL, const_cast<char*>(builder.ptr()), builder.size());
-	auto result = tnt_insert(tnt, sno, val);
-	if (result == -1) {
-		tnt_stream_free(val);
-		last_error = tnt_strerror(tnt);
-		return false;
-	}
-	tnt_stream_free(val);
-	if (tnt_flush(tnt) == -1) {
-		last_error = tnt_strerror(tnt);
+bool Connection::insert(int space_id, const tnt::TupleBuilder &builder)
+{
+	std::unique_ptr<struct tnt_stream, void(*)(struct tnt_stream*)> val(
+			tnt_object_as(NULL, const_cast<char*>(builder.ptr()), builder.size()),
+			Connection::deleteStream
+		);
+	int64_t sync = send({Stats::INSERTS, space_id, 0, &builder}, [&](struct tnt_stream *s) {
+			return tnt_insert(s, space_id, val.get());
+		});
+	if (sync == -1) {
 		return false;
 	}
-
-	struct tnt_reply reply;
-	tnt_reply_init(&reply);
-	if (tnt->read_reply(tnt, &reply) == -1) {
-		throw new std::runtime_error("Failed to read reply"); // TODO: add moar info into error message
-	}
-	tnt_reply_free(&reply);
-
-	return true;
+	return receiveOk(sync);
 }
 
 bool Connection::del(const std::string &space, const tnt::TupleBuilder &builder)
@@ -145,34 +279,22 @@ bool Connection::del(const std::string &space, const tnt::TupleBuilder &builder)
 		last_error = "Can't resolve space '" + space + "'";
 		return false;
 	}
+	return del(sno, builder);
+}
 
+bool Connection::del(int space_id, const tnt::TupleBuilder &builder)
+{
 	std::unique_ptr<struct tnt_stream, void(*)(struct tnt_stream*)> key (
 			tnt_object_as(NULL, const_cast<char*>(builder.ptr()), builder.size()),
 			Connection::deleteStream
 		);
-	if (tnt_delete(tnt, sno, 0, key.get()) == -1) {
-		last_error = tnt_strerror(tnt);
-		return false;
-	}
-	if (tnt_flush(tnt) == -1) {
-		last_error = tnt_strerror(tnt);
+	int64_t sync = send({Stats::DELETES, space_id, 0, &builder}, [&](struct tnt_stream *s) {
+			return tnt_delete(s, space_id, 0, key.get());
+		});
+	if (sync == -1) {
 		return false;
 	}
-
-	struct tnt_reply reply;
-	tnt_reply_init(&reply);
-	if (tnt->read_reply(tnt, &reply) == -1) {
-		tnt_reply_free(&reply);
-		if (reply.error) {
-			last_error.assign(reply.error, reply.error_end);
-		} else {
-			last_error = "Unknown reply error"; // TODO: add error code
-		}
-		return false;
-	}
-	tnt_reply_free(&reply);
-
-	return true;
+	return receiveOk(sync);
 }
 
 bool Connection::replace(const std::string &space, const tnt::TupleBuilder &builder)
@@ -181,61 +303,488 @@ bool Connection::replace(const std::string &space, const tnt::TupleBuilder &buil
 
 	int32_t sno = resolveSpace(space);
 	if (sno == -1) {
-		// TODO: set last error
-		last_error = "Space not found. ";
-		last_error.append(tnt_strerror(tnt));
+		last_error = "Can't resolve space '" + space + "'";
 		return false;
 	}
+	return replace(sno, builder);
+}
 
+bool Connection::replace(int space_id, const tnt::TupleBuilder &builder)
+{
 	std::unique_ptr<struct tnt_stream, void(*)(struct tnt_stream*)> val(
 			tnt_object_as(NULL, const_cast<char*>(builder.ptr()), builder.size()),
 			Connection::deleteStream
 		);
-	auto result = tnt_replace(tnt, sno, val.get());
-	int64_t reqid = tnt->reqid;
-	if (tnt_flush(tnt) == -1) {
-		last_error = tnt_strerror(tnt);
+	int64_t sync = send({Stats::REPLACES, space_id, 0, &builder}, [&](struct tnt_stream *s) {
+			return tnt_replace(s, space_id, val.get());
+		});
+	if (sync == -1) {
 		return false;
 	}
+	return receiveOk(sync);
+}
 
+bool Connection::receiveOk(int64_t sync)
+{
 	struct tnt_reply reply;
 	tnt_reply_init(&reply);
-	if (tnt->read_reply(tnt, &reply) == -1) {
+	bool ok = readReply(sync, &reply);
+	tnt_reply_free(&reply);
+	return ok;
+}
+
+int Connection::fd() const
+{
+	return tnt ? TNT_SNET_CAST(tnt)->fd : -1;
+}
+
+void Connection::discardReply(int64_t sync)
+{
+	Stats::add(Stats::IN_FLIGHT, -1);
+	{
+		std::lock_guard<std::mutex> guard(status_mutex);
+		started.erase(sync);
+	}
+	if (via_loop) {
+		in_flight.erase(sync); // the I/O thread drops replies nobody waits for
+		return;
+	}
+	discarded.push_back(sync);
+}
+
+bool Connection::waitReply(int64_t sync, int timeout_ms)
+{
+	if (via_loop || !tnt) {
+		return true; // receiveSelect() has the answer
+	}
+	int64_t deadline_us = nowUs() + timeout_ms * 1000LL;
+	for (;;) {
+		std::size_t size;
+		while ((size = packetSize(input)) > 0) {
+			auto abandoned = std::find(discarded.begin(), discarded.end(),
+					static_cast<int64_t>(packetSync(input.data())));
+			if (abandoned == discarded.end()) {
+				return true; // ours, or a mismatch readReply() reports
+			}
+			discarded.erase(abandoned);
+			input.erase(0, size);
+		}
+		if (!input.empty() && mp_typeof(input[0]) != MP_UINT) {
+			return true;
+		}
+		int64_t remaining_us = std::max<int64_t>(deadline_us - nowUs(), 0);
+		struct pollfd pfd = { fd(), POLLIN, 0 };
+		int ready = poll(&pfd, 1, static_cast<int>((remaining_us + 999) / 1000));
+		if (ready < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ready == 0) {
+			return false;
+		}
+		char chunk[16 * 1024];
+		ssize_t n = ready < 0 ? -1 : recv(pfd.fd, chunk, sizeof chunk, MSG_DONTWAIT);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+			continue;
+		}
+		if (n <= 0) {
+			return true; // readReply() fails on it
+		}
+		input.append(chunk, n);
+	}
+}
+
+bool Connection::readBufferedReply(struct tnt_reply *reply)
+{
+	std::size_t size;
+	while ((size = packetSize(input)) == 0) {
+		if (!input.empty() && mp_typeof(input[0]) != MP_UINT) {
+			last_error = "Malformed reply";
+			return false;
+		}
+		struct pollfd pfd = { fd(), POLLIN, 0 };
+		char chunk[16 * 1024];
+		ssize_t n = poll(&pfd, 1, -1) < 0 ? -1 : recv(pfd.fd, chunk, sizeof chunk, MSG_DONTWAIT);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+			continue;
+		}
+		if (n <= 0) {
+			last_error = n == 0 ? "Connection closed" : strerror(errno);
+			return false;
+		}
+		input.append(chunk, n);
+	}
+	// the reply owns its buffer, so tnt_reply_free() returns it to the pool
+	char *buffer = static_cast<char*>(tnt_mem_alloc(size));
+	if (!buffer) {
+		last_error = "Out of memory";
+		return false;
+	}
+	memcpy(buffer, input.data(), size);
+	input.erase(0, size);
+	size_t offset = 0;
+	if (tnt_reply(reply, buffer, size, &offset) != 0) {
+		tnt_mem_free(buffer);
+		last_error = "Malformed reply";
+		return false;
+	}
+	reply->buf = buffer;
+	return true;
+}
+
+template<class Encode>
+int64_t Connection::send(const request_t &info, Encode encode)
+{
+	last_error.clear();
+	int64_t start_us = nowUs();
+	Probes::stage(Probes::STAGE_ENCODING);
+
+	if (!connected()) {
+		last_error = "Not connected";
+		return -1;
+	}
+
+	if (via_loop) {
+		IoLoop *loop = IoLoop::instance();
+		if (!loop) {
+			last_error = "I/O thread is not running";
+			shutdownConnection();
+			return -1;
+		}
+		std::unique_ptr<struct tnt_stream, void(*)(struct tnt_stream*)> request(
+				tnt_buf(NULL),
+				Connection::deleteStream
+			);
+		int64_t sync = static_cast<int64_t>(loop->nextSync());
+		request->reqid = sync;
+		if (encode(request.get()) == -1) {
+			last_error = "Can't encode request";
+			return -1;
+		}
+		in_flight[sync] = loop->submit(host, TNT_SBUF_DATA(request.get()),
+				TNT_SBUF_SIZE(request.get()), static_cast<uint64_t>(sync));
+		sent(info, sync, start_us, TNT_SBUF_SIZE(request.get()));
+		return sync;
+	}
+
+	// without a send buffer encoding writes to the socket already
+	Probes::Io io(probe_socket, Probes::IO_SEND);
+	int64_t sync = tnt->reqid;
+	ssize_t size = encode(tnt);
+	if (size == -1) {
 		last_error = tnt_strerror(tnt);
-		tnt_reply_free(&reply);
-		return false; // TODO: add moar info into error message
+		return -1;
+	}
+	if (tnt_flush(tnt) == -1) {
+		last_error = tnt_strerror(tnt);
+		shutdownConnection();
+		return -1;
+	}
+	io.done(size);
+	sent(info, sync, start_us, size);
+	return sync;
+}
+
+void Connection::sent(const request_t &request, int64_t sync, int64_t start_us, std::size_t size)
+{
+	Stats::add(request.type);
+	Stats::add(Stats::BYTES_SENT, size);
+	Stats::add(Stats::IN_FLIGHT);
+
+	std::lock_guard<std::mutex> guard(status_mutex);
+	pending_t &pending = started[sync];
+	pending.op = latencyOf(request.type);
+	pending.start_us = start_us;
+	pending.space_id = request.space_id;
+	pending.index_id = request.index_id;
+	pending.bytes_sent = size;
+	pending.key_size = 0;
+	if (request.key && SlowLog::thresholdUs() > 0) {
+		pending.key_size = static_cast<uint8_t>(std::min(request.key->size(), sizeof pending.key));
+		memcpy(pending.key, request.key->ptr(), pending.key_size);
+	}
+}
+
+void Connection::replied(int64_t sync, const struct tnt_reply *reply)
+{
+	std::lock_guard<std::mutex> guard(status_mutex);
+	auto found = started.find(sync);
+	if (found == started.end()) {
+		return;
+	}
+	const pending_t &pending = found->second;
+	uint64_t rtt_us = static_cast<uint64_t>(nowUs() - pending.start_us);
+	Latency::record(pending.op, rtt_us);
+
+	uint64_t threshold_us = SlowLog::thresholdUs();
+	if (threshold_us > 0 && rtt_us >= threshold_us) {
+		SlowLog::entry_t entry;
+		entry.time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count();
+		entry.query_id = SlowLog::queryId();
+		entry.space_id = pending.space_id;
+		entry.index_id = pending.index_id;
+		entry.op = pending.op;
+		entry.rows = 0;
+		const char *data = reply->data;
+		if (data && mp_typeof(*data) == MP_ARRAY) {
+			entry.rows = mp_decode_array(&data);
+		}
+		entry.bytes = pending.bytes_sent + replySize(reply);
+		entry.rtt_us = rtt_us;
+		snprintf(entry.endpoint, sizeof entry.endpoint, "%s", host.c_str());
+		entry.key_size = pending.key_size;
+		memcpy(entry.key, pending.key, pending.key_size);
+		SlowLog::record(entry);
+	}
+	started.erase(found);
+}
+
+std::vector<Connection::status_t> Connection::status()
+{
+	std::vector<status_t> all;
+	int64_t now_us = nowUs();
+	std::lock_guard<std::mutex> registry_guard(registry_mutex);
+	all.reserve(registry.size());
+	for (Connection *conn: registry) {
+		std::lock_guard<std::mutex> guard(conn->status_mutex);
+		status_t status;
+		status.endpoint = conn->host;
+		status.connected = conn->open;
+		for (const auto &pending: conn->started) {
+			status.pending.emplace_back(pending.second.op, now_us - pending.second.start_us);
+		}
+		all.push_back(std::move(status));
+	}
+	return all;
+}
+
+bool Connection::readLoopReply(int64_t sync, struct tnt_reply *reply)
+{
+	auto found = in_flight.find(sync);
+	if (found == in_flight.end()) {
+		last_error = "sync mismatch";
+		return false;
+	}
+	auto request = found->second;
+	in_flight.erase(found);
+
+	std::string error;
+	if (!request->wait(error)) {
+		last_error = error;
+		shutdownConnection();
+		return false;
 	}
-	if (reqid != reply.sync) {
-		tnt_reply_free(&reply);
+	// the reply owns its buffer, so tnt_reply_free() returns it to the pool
+	char *buffer = static_cast<char*>(tnt_mem_alloc(request->reply.size()));
+	if (!buffer) {
+		last_error = "Out of memory";
+		return false;
+	}
+	memcpy(buffer, request->reply.data(), request->reply.size());
+	size_t offset = 0;
+	if (tnt_reply(reply, buffer, request->reply.size(), &offset) != 0) {
+		tnt_mem_free(buffer);
+		last_error = "Malformed reply";
+		shutdownConnection();
+		return false;
+	}
+	reply->buf = buffer;
+	return true;
+}
+
+bool Connection::readReply(int64_t sync, struct tnt_reply *reply)
+{
+	Stats::add(Stats::IN_FLIGHT, -1);
+	Probes::stage(Probes::STAGE_WAITING);
+	Probes::Io io(probe_socket, Probes::IO_RECEIVE);
+	if (via_loop && !readLoopReply(sync, reply)) {
+		return false;
+	}
+	while (!via_loop) {
+		// bytes waitReply() read ahead come first
+		if (!input.empty()) {
+			if (!readBufferedReply(reply)) {
+				shutdownConnection();
+				return false;
+			}
+		} else if (tnt->read_reply(tnt, reply) == -1) {
+			last_error = tnt_strerror(tnt);
+			shutdownConnection();
+			return false;
+		}
+		auto abandoned = std::find(discarded.begin(), discarded.end(),
+				static_cast<int64_t>(reply->sync));
+		if (abandoned == discarded.end()) {
+			break;
+		}
+		// a reply nobody waits for anymore (e.g. the slower half of a hedged read)
+		discarded.erase(abandoned);
+		tnt_reply_free(reply);
+		tnt_reply_init(reply);
+	}
+	if (static_cast<uint64_t>(sync) != reply->sync) {
 		last_error = "sync mismatch";
 		shutdownConnection();
 		return false;
 	}
-	if (reply.code != 0) {
-		tnt_reply_free(&reply);
-		if (reply.error) {
-			last_error.assign(reply.error, reply.error_end);
+	Stats::add(Stats::BYTES_RECEIVED, replySize(reply));
+	io.done(replySize(reply));
+	Probes::stage(Probes::STAGE_DECODING);
+	replied(sync, reply);
+	SchemaCache::instance().observe(host, reply->schema_id);
+	if (reply->code != 0) {
+		if (reply->error) {
+			last_error.assign(reply->error, reply->error_end);
 		} else {
-			last_error = "Unknown reply error"; // TODO: add error code
+			last_error = "Unknown reply error, code " + std::to_string(reply->code);
 		}
 		return false;
 	}
-	tnt_reply_free(&reply);
-
 	return true;
 }
 
+std::shared_ptr<tnt::Iterator> Connection::eval(const std::string &expression,
+		const char *arguments, std::size_t size)
+{
+	std::unique_ptr<struct tnt_stream, void(*)(struct tnt_stream*)> args(
+			tnt_object_as(NULL, const_cast<char*>(arguments), size),
+			Connection::deleteStream
+		);
+	int64_t sync = send({Stats::EVALS, -1, -1, nullptr}, [&](struct tnt_stream *s) {
+			return tnt_eval(s, expression.data(), expression.size(), args.get());
+		});
+	if (sync == -1) {
+		return std::shared_ptr<tnt::Iterator>();
+	}
+	auto reply = Iterator::allocateReply();
+	if (!readReply(sync, reply.get())) {
+		return std::shared_ptr<tnt::Iterator>();
+	}
+	auto result = Iterator::makeFromReply(reply);
+	if (!result) {
+		last_error = "Malformed eval reply";
+	}
+	return result;
+}
+
+bool Connection::replicationLag(double &lag)
+{
+	// the worst upstream lag; a replica that isn't following is infinitely behind
+	static const std::string expression =
+		"local lag = 0 "
+		"for _, r in pairs(box.info.replication) do "
+			"if r.upstream ~= nil then "
+				"if r.upstream.status ~= 'follow' then return 1e9 end "
+				"lag = math.max(lag, r.upstream.lag or 0) "
+			"end "
+		"end "
+		"return lag";
+	static const char no_arguments[] = { '\x90' }; // empty msgpack array
+
+	std::unique_ptr<struct tnt_stream, void(*)(struct tnt_stream*)> args(
+			tnt_object_as(NULL, const_cast<char*>(no_arguments), sizeof no_arguments),
+			Connection::deleteStream
+		);
+	int64_t sync = send({Stats::EVALS, -1, -1, nullptr}, [&](struct tnt_stream *s) {
+			return tnt_eval(s, expression.data(), expression.size(), args.get());
+		});
+	if (sync == -1) {
+		return false;
+	}
+
+	struct tnt_reply reply;
+	tnt_reply_init(&reply);
+	bool ok = readReply(sync, &reply);
+	const char *p = reply.data;
+	if (ok && p && mp_typeof(*p) == MP_ARRAY && mp_decode_array(&p) > 0) {
+		switch (mp_typeof(*p)) {
+		case MP_DOUBLE:
+			lag = mp_decode_double(&p);
+			break;
+		case MP_FLOAT:
+			lag = mp_decode_float(&p);
+			break;
+		case MP_UINT:
+			lag = mp_decode_uint(&p);
+			break;
+		default:
+			ok = false;
+			last_error = "Unexpected replication lag type";
+		}
+	} else if (ok) {
+		ok = false;
+		last_error = "Empty replication lag reply";
+	}
+	tnt_reply_free(&reply);
+	return ok;
+}
+
 int Connection::resolveSpace(const std::string &space)
 {
-	if (spaces.find(space) == spaces.end()) {
-		tnt_reload_schema(tnt); // TODO: error check if connected, if not loaded yet
-		int32_t sno = tnt_get_spaceno(tnt, space.c_str(), space.size());
-		if (sno == -1) {
-			return -1;
+	auto info = spaceInfo(space);
+	return info ? info->id : -1;
+}
+
+std::shared_ptr<const SpaceInfo> Connection::spaceInfo(const std::string &space)
+{
+	auto info = SchemaCache::instance().find(host, space);
+	if (!info) {
+		info = fetchSpace(space);
+	}
+	return info;
+}
+
+// Fetches a single space and its indexes instead of the whole catalogue
+std::shared_ptr<const SpaceInfo> Connection::fetchSpace(const std::string &space)
+{
+	TupleBuilder name_key(1);
+	name_key.push(space);
+	int64_t sync = sendSelect(vspace_id, vspace_name_index, name_key, 1);
+	if (sync == -1) {
+		return std::shared_ptr<const SpaceInfo>();
+	}
+	auto reply = Iterator::allocateReply();
+	if (!readReply(sync, reply.get())) {
+		return std::shared_ptr<const SpaceInfo>();
+	}
+	uint64_t schema_version = reply->schema_id;
+
+	const char *p = reply->data;
+	if (!p || mp_typeof(*p) != MP_ARRAY || mp_decode_array(&p) == 0) {
+		last_error = "Space '" + space + "' not found";
+		return std::shared_ptr<const SpaceInfo>();
+	}
+	auto info = std::make_shared<SpaceInfo>();
+	if (!decodeSpaceTuple(p, *info)) {
+		last_error = "Malformed _vspace tuple for '" + space + "'";
+		return std::shared_ptr<const SpaceInfo>();
+	}
+
+	TupleBuilder id_key(1);
+	id_key.push(static_cast<int64_t>(info->id));
+	sync = sendSelect(vindex_id, 0, id_key);
+	if (sync == -1) {
+		return std::shared_ptr<const SpaceInfo>();
+	}
+	reply = Iterator::allocateReply();
+	if (!readReply(sync, reply.get())) {
+		return std::shared_ptr<const SpaceInfo>();
+	}
+	p = reply->data;
+	if (p && mp_typeof(*p) == MP_ARRAY) {
+		uint32_t indexes_number = mp_decode_array(&p);
+		for (uint32_t i = 0; i < indexes_number; ++i) {
+			IndexInfo index;
+			if (decodeIndexTuple(p, index)) {
+				info->indexes.push_back(index);
+			}
+			mp_next(&p);
 		}
-		spaces[space] = sno;
 	}
-	return spaces[space];
+
+	SchemaCache::instance().store(host, schema_version, info);
+	Stats::add(Stats::SCHEMA_RELOADS);
+	return info;
 }
 
 void Connection::deleteStream(struct tnt_stream *stream)
@@ -1,14 +1,37 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
 #include <string>
 #include <memory>
-#include <map>
+#include <vector>
+
+#include "io_loop.h"
+#include "latency.h"
+#include "probes.h"
+#include "slow_log.h"
+#include "stats.h"
 
 struct tnt_stream;
-class Row;
+struct tnt_reply;
 namespace tnt {
 	class Iterator;
+
+/// Tarantool index iterator types, as in tnt_iterator_t
+enum iterator_type_t {
+	ITER_EQ = 0,
+	ITER_REQ,
+	ITER_ALL,
+	ITER_LT,
+	ITER_LE,
+	ITER_GE,
+	ITER_GT
+};
+
 	class TupleBuilder;
+	struct SpaceInfo;
 
 class Connection {
 public:
@@ -17,6 +40,7 @@ public:
 
 	void connect(const std::string &host_port);
 	bool connected();
+	const std::string &endpoint() const;
 
 	std::shared_ptr<tnt::Iterator> select(const std::string &space, const tnt::TupleBuilder &builder);
 	std::shared_ptr<tnt::Iterator> select(int space_id, const tnt::TupleBuilder &builder);
@@ -30,17 +54,79 @@ public:
 	bool replace(const std::string &space, const tnt::TupleBuilder &builder);
 	bool replace(int space_id, const tnt::TupleBuilder &builder);
 
+	/// Encodes and flushes a select; returns the request's sync or -1
+	int64_t sendSelect(int space_id, int index_id, const tnt::TupleBuilder &key,
+			uint32_t limit = UINT32_MAX, uint32_t offset = 0, int iterator = 0);
+	std::shared_ptr<tnt::Iterator> receiveSelect(int64_t sync);
+
+	/// Socket of the connection, -1 if not connected
+	int fd() const;
+	/// The reply to this request will be read and thrown away
+	void discardReply(int64_t sync);
+	/// Reads ahead until the reply to sync (or a failure) is whole; false on timeout
+	bool waitReply(int64_t sync, int timeout_ms);
+
+	/// Runs Lua with the msgpack array of arguments; rows are the returned values
+	std::shared_ptr<tnt::Iterator> eval(const std::string &expression,
+			const char *arguments, std::size_t size);
+
+	/// Worst upstream lag of the instance in seconds (0 on a master)
+	bool replicationLag(double &lag);
+
+	/// Space id via the shared schema cache, -1 if there is no such space
 	int resolveSpace(const std::string &space);
+	std::shared_ptr<const SpaceInfo> spaceInfo(const std::string &space);
 
 	const std::string &lastError() const;
+
+	/// One connection of the process and its requests waiting for a reply
+	struct status_t {
+		std::string endpoint;
+		bool connected;
+		std::vector<std::pair<latency_op_t, int64_t>> pending; // operation, age in us
+	};
+	/// Taken while the connections work: each one is locked only to copy its own state
+	static std::vector<status_t> status();
 private:
 	struct tnt_stream * tnt;
 	std::string last_error;
 	std::string host;
-	std::map<std::string, int> spaces;
-	int port;
+	std::vector<int64_t> discarded; // syncs of abandoned requests
+	std::string input; // reply bytes read ahead by waitReply()
+	bool via_loop; // requests go through the shared I/O thread
+	std::map<int64_t, std::shared_ptr<IoLoop::Request>> in_flight;
+	/// What a request is about, for statistics and the slow log
+	struct request_t {
+		Stats::counter_t type;
+		int space_id;
+		int index_id;
+		const TupleBuilder *key; // the tuple for inserts and replaces, may be nullptr
+	};
+	struct pending_t {
+		latency_op_t op;
+		int64_t start_us;
+		int space_id;
+		int index_id;
+		std::size_t bytes_sent;
+		uint8_t key_size;
+		char key[SlowLog::key_prefix_size];
+	};
+	std::map<int64_t, pending_t> started; // by sync
+	std::atomic<bool> open;
+	mutable std::mutex status_mutex; // host and started, for status() readers
+	void *probe_socket = nullptr; // see Probes::socketOpen(), lives as long as the connection
 
 	void shutdownConnection();
+	/// Encodes a request with encode(stream) and sends it; returns its sync or -1
+	template<class Encode>
+	int64_t send(const request_t &request, Encode encode);
+	void sent(const request_t &request, int64_t sync, int64_t start_us, std::size_t size);
+	void replied(int64_t sync, const struct tnt_reply *reply);
+	bool readLoopReply(int64_t sync, struct tnt_reply *reply);
+	bool receiveOk(int64_t sync);
+	bool readReply(int64_t sync, struct tnt_reply *reply);
+	bool readBufferedReply(struct tnt_reply *reply);
+	std::shared_ptr<const SpaceInfo> fetchSpace(const std::string &space);
 	static void deleteStream(struct tnt_stream *stream);
 };
 
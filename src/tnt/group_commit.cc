@@ -0,0 +1,162 @@
+#include "group_commit.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include <msgpuck.h>
+
+#include "connection.h"
+#include "iterator.h"
+#include "row.h"
+#include "tuple_builder.h"
+
+namespace tnt {
+
+namespace {
+
+// Each statement runs under pcall so one failure doesn't abort the others
+const std::string batch_expression =
+	"local errors = {} "
+	"box.begin() "
+	"for i, op in ipairs({...}) do "
+		"local space = box.space[op[2]] "
+		"if space == nil then "
+			"errors[i] = 'Space ' .. op[2] .. ' does not exist' "
+		"else "
+			"local ok, err = pcall(space[op[1]], space, op[3]) "
+			"errors[i] = ok and '' or tostring(err) "
+		"end "
+	"end "
+	"box.commit() "
+	"return errors";
+
+const char *opName(write_op_t op)
+{
+	switch (op) {
+	case WRITE_INSERT:
+		return "insert";
+	case WRITE_REPLACE:
+		return "replace";
+	case WRITE_DELETE:
+		return "delete";
+	}
+	return "";
+}
+
+}
+
+void encodeWrite(std::string &arguments, write_op_t op, int space_id, const std::string &tuple)
+{
+	char header[16];
+	const char *name = opName(op);
+	arguments.append(header, mp_encode_array(header, 3) - header);
+	arguments.append(header, mp_encode_str(header, name, strlen(name)) - header);
+	arguments.append(header, mp_encode_uint(header, space_id) - header);
+	arguments.append(tuple);
+}
+
+GroupCommit::GroupCommit():
+	batches(0),
+	writes(0)
+{
+}
+
+GroupCommit &GroupCommit::instance()
+{
+	static GroupCommit group_commit;
+	return group_commit;
+}
+
+uint64_t GroupCommit::batchCount() const
+{
+	return batches.load(std::memory_order_relaxed);
+}
+
+uint64_t GroupCommit::writeCount() const
+{
+	return writes.load(std::memory_order_relaxed);
+}
+
+GroupCommit::queue_t &GroupCommit::queue(const std::string &endpoint)
+{
+	std::lock_guard<std::mutex> guard(mutex);
+	auto &q = queues[endpoint];
+	if (!q) {
+		q.reset(new queue_t);
+	}
+	return *q;
+}
+
+bool GroupCommit::write(Connection &connection, write_op_t op, int space_id,
+		const TupleBuilder &tuple, const options_t &options, std::string &error)
+{
+	pending_t self;
+	self.op = op;
+	self.space_id = space_id;
+	self.tuple.assign(tuple.ptr(), tuple.size());
+
+	const std::size_t max_batch = std::max<std::size_t>(options.max_batch, 1);
+	queue_t &q = queue(connection.endpoint());
+	std::unique_lock<std::mutex> lock(q.mutex);
+	q.waiting.push_back(&self);
+	if (q.waiting.size() >= max_batch) {
+		q.condition.notify_all(); // the leader doesn't need to wait any longer
+	}
+
+	while (!self.done) {
+		if (q.leader_active) {
+			q.condition.wait(lock);
+			continue;
+		}
+		q.leader_active = true;
+		auto deadline = std::chrono::steady_clock::now() +
+			std::chrono::microseconds(options.window_us);
+		q.condition.wait_until(lock, deadline, [&] {
+				return q.waiting.size() >= max_batch;
+			});
+
+		std::size_t taken = std::min(q.waiting.size(), max_batch);
+		std::vector<pending_t*> batch(q.waiting.begin(), q.waiting.begin() + taken);
+		q.waiting.erase(q.waiting.begin(), q.waiting.begin() + taken);
+		lock.unlock();
+
+		commit(connection, batch);
+
+		lock.lock();
+		for (auto pending: batch) {
+			pending->done = true;
+		}
+		q.leader_active = false;
+		q.condition.notify_all();
+	}
+
+	error = self.error;
+	return error.empty();
+}
+
+void GroupCommit::commit(Connection &connection, const std::vector<pending_t*> &batch)
+{
+	std::string arguments;
+	char header[16];
+	arguments.append(header, mp_encode_array(header, batch.size()) - header);
+	for (auto pending: batch) {
+		encodeWrite(arguments, pending->op, pending->space_id, pending->tuple);
+	}
+
+	batches.fetch_add(1, std::memory_order_relaxed);
+	writes.fetch_add(batch.size(), std::memory_order_relaxed);
+
+	auto result = connection.eval(batch_expression, arguments.data(), arguments.size());
+	std::shared_ptr<Row> errors = result ? result->nextRow() : std::shared_ptr<Row>();
+	for (std::size_t i = 0; i < batch.size(); ++i) {
+		if (!errors) {
+			batch[i]->error = connection.lastError().empty() ?
+				"Malformed batch reply" : connection.lastError();
+		} else if (static_cast<int>(i) < errors->getFieldNum() && errors->isString(i)) {
+			batch[i]->error = errors->getString(i);
+		}
+	}
+}
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tnt {
+
+class Connection;
+class TupleBuilder;
+
+/// Kinds of row writes the engine sends to Tarantool
+enum write_op_t {
+	WRITE_INSERT,
+	WRITE_REPLACE,
+	WRITE_DELETE
+};
+
+/// Appends {"insert"|"replace"|"delete", space_id, tuple} to eval arguments
+void encodeWrite(std::string &arguments, write_op_t op, int space_id, const std::string &tuple);
+
+/**
+ * Batches autocommit writes of concurrent sessions into one transaction.
+ *
+ * Writes to an endpoint queue up; the first waiting session becomes the
+ * leader, lets the queue fill for a short window (or until it holds a full
+ * batch) and runs the whole batch as one box.begin()..box.commit() eval on
+ * its own connection. Every write gets its own result back, so a duplicate
+ * key fails only the statement that caused it, while the batch costs
+ * Tarantool a single WAL write.
+ */
+class GroupCommit
+{
+public:
+	struct options_t {
+		uint64_t window_us = 200;
+		std::size_t max_batch = 64;
+	};
+
+	static GroupCommit &instance();
+
+	/// Blocks until the batch holding the write is committed
+	bool write(Connection &connection, write_op_t op, int space_id,
+			const TupleBuilder &tuple, const options_t &options, std::string &error);
+
+	uint64_t batchCount() const;
+	uint64_t writeCount() const;
+private:
+	struct pending_t {
+		write_op_t op;
+		int space_id;
+		std::string tuple;
+		bool done = false;
+		std::string error;
+	};
+	struct queue_t {
+		std::mutex mutex;
+		std::condition_variable condition;
+		std::vector<pending_t*> waiting;
+		bool leader_active = false;
+	};
+
+	std::mutex mutex;
+	std::map<std::string, std::unique_ptr<queue_t>> queues;
+	std::atomic<uint64_t> batches;
+	std::atomic<uint64_t> writes;
+
+	GroupCommit();
+	queue_t &queue(const std::string &endpoint);
+	void commit(Connection &connection, const std::vector<pending_t*> &batch);
+};
+
+}
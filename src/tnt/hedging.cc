@@ -0,0 +1,89 @@
+#include "hedging.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+namespace tnt {
+
+namespace {
+
+const int64_t refresh_interval_us = 100 * 1000;
+
+int64_t nowUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+}
+
+}
+
+HedgePolicy::HedgePolicy():
+	next_sample(0),
+	cached_delay_us(0),
+	computed_at_us(0),
+	hedges(0),
+	wins(0)
+{
+	for (auto &sample: samples) {
+		sample.store(0, std::memory_order_relaxed);
+	}
+}
+
+HedgePolicy &HedgePolicy::instance()
+{
+	static HedgePolicy policy;
+	return policy;
+}
+
+void HedgePolicy::record(uint64_t latency_us)
+{
+	uint64_t n = next_sample.fetch_add(1, std::memory_order_relaxed);
+	uint32_t clamped = static_cast<uint32_t>(std::min<uint64_t>(latency_us, UINT32_MAX));
+	samples[n % samples_number].store(clamped, std::memory_order_relaxed);
+}
+
+uint64_t HedgePolicy::delayUs(double percentile, uint64_t min_delay_us)
+{
+	int64_t now = nowUs();
+	int64_t computed_at = computed_at_us.load(std::memory_order_relaxed);
+	if (now - computed_at >= refresh_interval_us &&
+			computed_at_us.compare_exchange_strong(computed_at, now)) {
+		std::size_t filled = static_cast<std::size_t>(
+				std::min<uint64_t>(next_sample.load(std::memory_order_relaxed), samples_number)
+			);
+		if (filled > 0) {
+			std::vector<uint32_t> sorted(filled);
+			for (std::size_t i = 0; i < filled; ++i) {
+				sorted[i] = samples[i].load(std::memory_order_relaxed);
+			}
+			std::size_t rank = static_cast<std::size_t>(percentile / 100.0 * (filled - 1));
+			std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+			cached_delay_us.store(sorted[rank], std::memory_order_relaxed);
+		}
+	}
+	return std::max(cached_delay_us.load(std::memory_order_relaxed), min_delay_us);
+}
+
+void HedgePolicy::hedged()
+{
+	hedges.fetch_add(1, std::memory_order_relaxed);
+}
+
+void HedgePolicy::won()
+{
+	wins.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t HedgePolicy::hedgeCount() const
+{
+	return hedges.load(std::memory_order_relaxed);
+}
+
+uint64_t HedgePolicy::winCount() const
+{
+	return wins.load(std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace tnt {
+
+/**
+ * Decides when a point read is slow enough to be sent to a second replica.
+ *
+ * The delay is a percentile of recent read latencies, recomputed from a
+ * fixed ring of samples at most every refresh interval, so a stalled
+ * instance (snapshotting, GC) is hedged after "longer than usual" rather
+ * than after a fixed timeout.
+ */
+class HedgePolicy
+{
+public:
+	HedgePolicy();
+
+	void record(uint64_t latency_us);
+	/// Percentile (0..100) of recent latencies, at least min_delay_us
+	uint64_t delayUs(double percentile, uint64_t min_delay_us);
+
+	void hedged();
+	void won();
+	uint64_t hedgeCount() const;
+	uint64_t winCount() const;
+
+	static HedgePolicy &instance();
+private:
+	static const int samples_number = 1024;
+	std::atomic<uint32_t> samples[samples_number];
+	std::atomic<uint64_t> next_sample;
+	std::atomic<uint64_t> cached_delay_us;
+	std::atomic<int64_t> computed_at_us;
+	std::atomic<uint64_t> hedges;
+	std::atomic<uint64_t> wins;
+};
+
+}
@@ -0,0 +1,541 @@
+#include "io_loop.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <functional>
+
+#include <tarantool/tarantool.h>
+#include <tarantool/tnt_net.h>
+#include <tarantool/tnt_opt.h>
+
+#include <msgpuck.h>
+
+#include "stats.h"
+
+namespace tnt {
+
+namespace {
+
+const uint64_t iproto_sync = 0x01;
+const std::size_t read_chunk = 64 * 1024;
+
+const long connect_timeout_s = 3;          // bounds how long stop() waits for a connect
+const int64_t min_backoff_ms = 100;
+const int64_t max_backoff_ms = 10000;
+const int expire_interval_ms = 100;        // how late a timed out request may fail
+
+int64_t nowMs()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+}
+
+// bytes taken by the msgpack uint prefix starting with this byte, 0 if invalid
+std::size_t lengthPrefixSize(unsigned char first)
+{
+	if (first <= 0x7f) {
+		return 1;
+	}
+	switch (first) {
+	case 0xcc: return 2;
+	case 0xcd: return 3;
+	case 0xce: return 5;
+	case 0xcf: return 9;
+	default: return 0;
+	}
+}
+
+}
+
+std::atomic<IoLoop*> IoLoop::running(nullptr);
+
+bool IoLoop::Request::wait(std::string &failure)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	if (!done) {
+		Stats::add(Stats::POOL_WAITS);
+		if (deadline == std::chrono::steady_clock::time_point::max()) {
+			condition.wait(lock, [this] { return done; });
+		} else if (!condition.wait_until(lock, deadline, [this] { return done; })) {
+			// the I/O thread drops it too, a late reply finds nobody waiting
+			error = "Request timed out";
+			done = true;
+		}
+	}
+	failure = error;
+	return error.empty();
+}
+
+void IoLoop::Request::complete(const std::string &failure)
+{
+	{
+		std::lock_guard<std::mutex> guard(mutex);
+		if (done) {
+			return; // timed out already
+		}
+		error = failure;
+		done = true;
+	}
+	condition.notify_one();
+}
+
+IoLoop::IoLoop():
+	sync_counter(1)
+{
+}
+
+bool IoLoop::start(unsigned threads_number, uint64_t request_timeout_ms)
+{
+	if (running.load() || threads_number == 0) {
+		return false;
+	}
+	IoLoop *loop = new IoLoop;
+	loop->request_timeout_ms = request_timeout_ms;
+	for (unsigned i = 0; i < threads_number; ++i) {
+		std::unique_ptr<Worker> worker(new Worker);
+		if (!worker->start()) {
+			delete loop;
+			return false;
+		}
+		loop->workers.push_back(std::move(worker));
+	}
+	running = loop;
+	return true;
+}
+
+void IoLoop::stop()
+{
+	IoLoop *loop = running.exchange(nullptr);
+	delete loop; // workers fail whatever is still queued
+}
+
+IoLoop *IoLoop::instance()
+{
+	return running.load(std::memory_order_acquire);
+}
+
+uint64_t IoLoop::nextSync()
+{
+	return sync_counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::shared_ptr<IoLoop::Request> IoLoop::submit(const std::string &endpoint, const char *data,
+		std::size_t size, uint64_t sync)
+{
+	auto request = std::make_shared<Request>();
+	request->endpoint = endpoint;
+	request->data.assign(data, size);
+	request->sync = sync;
+	request->deadline = request_timeout_ms == 0 ? std::chrono::steady_clock::time_point::max() :
+		std::chrono::steady_clock::now() + std::chrono::milliseconds(request_timeout_ms);
+
+	node_t *node = new node_t;
+	node->request = request;
+	// all requests for an endpoint go through one worker and one socket
+	std::size_t n = std::hash<std::string>()(endpoint) % workers.size();
+	workers[n]->push(node);
+	return request;
+}
+
+std::vector<IoLoop::worker_status_t> IoLoop::status() const
+{
+	std::vector<worker_status_t> all;
+	for (const auto &worker: workers) {
+		all.push_back(worker->status());
+	}
+	return all;
+}
+
+IoLoop::Worker::Worker():
+	head(nullptr),
+	queued(0),
+	stopping(false)
+{
+	wakeup_pipe[0] = wakeup_pipe[1] = -1;
+}
+
+IoLoop::Worker::~Worker()
+{
+	stop();
+}
+
+bool IoLoop::Worker::start()
+{
+	if (pipe(wakeup_pipe) != 0) {
+		return false;
+	}
+	fcntl(wakeup_pipe[0], F_SETFL, fcntl(wakeup_pipe[0], F_GETFL) | O_NONBLOCK);
+	fcntl(wakeup_pipe[1], F_SETFL, fcntl(wakeup_pipe[1], F_GETFL) | O_NONBLOCK);
+	thread = std::thread(&Worker::run, this);
+	return true;
+}
+
+void IoLoop::Worker::stop()
+{
+	if (thread.joinable()) {
+		stopping = true;
+		char byte = 0;
+		(void) !write(wakeup_pipe[1], &byte, 1);
+		thread.join();
+	}
+	for (int &fd: wakeup_pipe) {
+		if (fd != -1) {
+			close(fd);
+			fd = -1;
+		}
+	}
+}
+
+// Treiber stack push; the worker takes the whole stack at once, so there is
+// no ABA problem and producers never wait for each other
+void IoLoop::Worker::push(node_t *node)
+{
+	queued.fetch_add(1, std::memory_order_relaxed);
+	node_t *old_head = head.load(std::memory_order_relaxed);
+	do {
+		node->next = old_head;
+	} while (!head.compare_exchange_weak(old_head, node,
+			std::memory_order_release, std::memory_order_relaxed));
+	if (!old_head) {
+		// the stack was empty: the worker may be asleep in poll()
+		char byte = 0;
+		(void) !write(wakeup_pipe[1], &byte, 1);
+	}
+}
+
+void IoLoop::Worker::drainQueue()
+{
+	node_t *node = head.exchange(nullptr, std::memory_order_acquire);
+	// the stack is LIFO, restore submission order
+	node_t *ordered = nullptr;
+	while (node) {
+		node_t *next = node->next;
+		node->next = ordered;
+		ordered = node;
+		node = next;
+	}
+	while (ordered) {
+		node_t *next = ordered->next;
+		std::shared_ptr<Request> request = ordered->request;
+		delete ordered;
+		ordered = next;
+		queued.fetch_sub(1, std::memory_order_relaxed);
+
+		if (stopping) {
+			request->complete("I/O thread stopped");
+			continue;
+		}
+		auto up = upstreams.find(request->endpoint);
+		if (up != upstreams.end()) {
+			send(up->second, request);
+			continue;
+		}
+		auto attempt = connecting.find(request->endpoint);
+		if (attempt != connecting.end()) {
+			attempt->second->queued.push_back(request);
+			continue;
+		}
+		auto backoff = backoffs.find(request->endpoint);
+		if (backoff != backoffs.end() && nowMs() < backoff->second.until_ms) {
+			request->complete(backoff->second.error);
+			continue;
+		}
+		startConnect(request->endpoint, request);
+	}
+}
+
+void IoLoop::Worker::send(upstream_t &up, const std::shared_ptr<Request> &request)
+{
+	up.output.append(request->data);
+	request->data.clear();
+	up.waiting[request->sync] = request;
+}
+
+void IoLoop::Worker::startConnect(const std::string &endpoint, const std::shared_ptr<Request> &request)
+{
+	std::unique_ptr<connect_t> attempt(new connect_t);
+	attempt->queued.push_back(request);
+	attempt->thread = std::thread(&Worker::connectUpstream, this, attempt.get(), endpoint);
+	connecting[endpoint] = std::move(attempt);
+}
+
+// runs on its own thread: tarantool-c does the greeting and authentication,
+// the socket is the loop's after that
+void IoLoop::Worker::connectUpstream(connect_t *attempt, std::string endpoint)
+{
+	struct tnt_stream *stream = tnt_net(NULL);
+	tnt_set(stream, TNT_OPT_URI, endpoint.c_str());
+	tnt_set(stream, TNT_OPT_SEND_BUF, 0);
+	tnt_set(stream, TNT_OPT_RECV_BUF, 0);
+	struct timeval timeout = { connect_timeout_s, 0 };
+	tnt_set(stream, TNT_OPT_TMOUT_CONNECT, &timeout);
+	if (tnt_connect(stream) != 0) {
+		attempt->error = endpoint + ": " + tnt_strerror(stream);
+		tnt_stream_free(stream);
+	} else {
+		attempt->stream = stream;
+	}
+	attempt->finished.store(true, std::memory_order_release);
+	char byte = 0;
+	(void) !write(wakeup_pipe[1], &byte, 1);
+}
+
+void IoLoop::Worker::finishConnects(bool wait)
+{
+	for (auto it = connecting.begin(); it != connecting.end(); ) {
+		connect_t &attempt = *it->second;
+		if (!wait && !attempt.finished.load(std::memory_order_acquire)) {
+			++it;
+			continue;
+		}
+		attempt.thread.join();
+		if (attempt.stream && !stopping) {
+			std::unique_lock<std::mutex> guard(upstreams_mutex);
+			upstream_t &up = upstreams[it->first];
+			guard.unlock();
+			up.stream = attempt.stream;
+			up.fd = TNT_SNET_CAST(attempt.stream)->fd;
+			fcntl(up.fd, F_SETFL, fcntl(up.fd, F_GETFL) | O_NONBLOCK);
+			backoffs.erase(it->first);
+			for (auto &request: attempt.queued) {
+				send(up, request);
+			}
+		} else {
+			std::string error = "I/O thread stopped";
+			if (attempt.stream) {
+				tnt_close(attempt.stream);
+				tnt_stream_free(attempt.stream);
+			} else if (!stopping) {
+				backoff_t &backoff = backoffs[it->first];
+				backoff.delay_ms = std::min(std::max(backoff.delay_ms * 2, min_backoff_ms), max_backoff_ms);
+				backoff.until_ms = nowMs() + backoff.delay_ms;
+				backoff.error = attempt.error;
+				error = attempt.error;
+			}
+			for (auto &request: attempt.queued) {
+				request->complete(error);
+			}
+		}
+		it = connecting.erase(it);
+	}
+}
+
+void IoLoop::Worker::expireRequests()
+{
+	auto now = std::chrono::steady_clock::now();
+	auto expired = [&now](const std::shared_ptr<Request> &request) {
+		if (request->deadline > now) {
+			return false;
+		}
+		request->complete("Request timed out");
+		return true;
+	};
+	for (auto &up: upstreams) {
+		std::map<uint64_t, std::shared_ptr<Request>> &waiting = up.second.waiting;
+		for (auto it = waiting.begin(); it != waiting.end(); ) {
+			it = expired(it->second) ? waiting.erase(it) : std::next(it);
+		}
+	}
+	for (auto &attempt: connecting) {
+		std::vector<std::shared_ptr<Request>> &queued = attempt.second->queued;
+		queued.erase(std::remove_if(queued.begin(), queued.end(), expired), queued.end());
+	}
+}
+
+void IoLoop::Worker::closeUpstream(const std::string &endpoint, const std::string &error)
+{
+	auto it = upstreams.find(endpoint);
+	if (it == upstreams.end()) {
+		return;
+	}
+	for (auto &waiting: it->second.waiting) {
+		waiting.second->complete(endpoint + ": " + error);
+	}
+	tnt_close(it->second.stream);
+	tnt_stream_free(it->second.stream);
+	std::lock_guard<std::mutex> guard(upstreams_mutex);
+	upstreams.erase(it);
+}
+
+// one write() carries everything queued for the socket since the last one
+bool IoLoop::Worker::flush(upstream_t &up)
+{
+	while (!up.output.empty()) {
+		ssize_t written = write(up.fd, up.output.data(), up.output.size());
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		up.output.erase(0, static_cast<std::size_t>(written));
+	}
+	return true;
+}
+
+bool IoLoop::Worker::receive(upstream_t &up)
+{
+	char chunk[read_chunk];
+	for (;;) {
+		ssize_t got = read(up.fd, chunk, sizeof chunk);
+		if (got == 0) {
+			return false;
+		} else if (got < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				return false;
+			}
+			break;
+		}
+		up.input.append(chunk, static_cast<std::size_t>(got));
+		if (static_cast<std::size_t>(got) < sizeof chunk) {
+			break;
+		}
+	}
+
+	std::size_t offset = 0;
+	while (offset < up.input.size()) {
+		const char *begin = up.input.data() + offset;
+		const char *end = up.input.data() + up.input.size();
+		std::size_t prefix = lengthPrefixSize(static_cast<unsigned char>(*begin));
+		if (prefix == 0) {
+			return false;
+		}
+		if (static_cast<std::size_t>(end - begin) < prefix) {
+			break;
+		}
+		const char *p = begin;
+		uint64_t length = mp_decode_uint(&p);
+		if (static_cast<uint64_t>(end - p) < length) {
+			break;
+		}
+
+		uint64_t sync = 0;
+		const char *header = p;
+		if (mp_typeof(*header) != MP_MAP) {
+			return false;
+		}
+		uint32_t keys_number = mp_decode_map(&header);
+		for (uint32_t k = 0; k < keys_number; ++k) {
+			uint64_t key = mp_decode_uint(&header);
+			if (key == iproto_sync) {
+				sync = mp_decode_uint(&header);
+			} else {
+				mp_next(&header);
+			}
+		}
+
+		auto waiting = up.waiting.find(sync);
+		if (waiting != up.waiting.end()) {
+			waiting->second->reply.assign(begin, prefix + length);
+			waiting->second->complete(std::string());
+			up.waiting.erase(waiting);
+		}
+		offset += prefix + length;
+	}
+	up.input.erase(0, offset);
+	return true;
+}
+
+IoLoop::worker_status_t IoLoop::Worker::status() const
+{
+	worker_status_t status;
+	status.queued = queued.load(std::memory_order_relaxed);
+	std::lock_guard<std::mutex> guard(upstreams_mutex);
+	for (const auto &up: upstreams) {
+		status.upstreams.push_back({
+				up.first,
+				up.second.waiting_count.load(std::memory_order_relaxed),
+				up.second.output_bytes.load(std::memory_order_relaxed)
+			});
+	}
+	return status;
+}
+
+void IoLoop::Worker::run()
+{
+	std::vector<struct pollfd> pfds;
+	std::vector<std::string> endpoints;
+	while (!stopping) {
+		pfds.clear();
+		endpoints.clear();
+		pfds.push_back({ wakeup_pipe[0], POLLIN, 0 });
+		// nothing can time out while no request is pending
+		int timeout_ms = connecting.empty() ? -1 : expire_interval_ms;
+		for (auto &up: upstreams) {
+			short events = POLLIN;
+			if (!up.second.output.empty()) {
+				events |= POLLOUT;
+			}
+			if (!up.second.waiting.empty()) {
+				timeout_ms = expire_interval_ms;
+			}
+			pfds.push_back({ up.second.fd, events, 0 });
+			endpoints.push_back(up.first);
+		}
+
+		if (poll(pfds.data(), pfds.size(), timeout_ms) < 0 && errno != EINTR) {
+			break;
+		}
+
+		if (pfds[0].revents & POLLIN) {
+			char bytes[256];
+			while (read(wakeup_pipe[0], bytes, sizeof bytes) > 0) {
+			}
+		}
+		for (std::size_t i = 1; i < pfds.size(); ++i) {
+			if (!pfds[i].revents) {
+				continue;
+			}
+			upstream_t &up = upstreams.find(endpoints[i - 1])->second;
+			short revents = pfds[i].revents;
+			// read what is left before noticing a hang-up
+			bool ok = !(revents & POLLIN) || receive(up);
+			if (ok && (revents & POLLOUT)) {
+				ok = flush(up);
+			}
+			if (revents & (POLLERR | POLLNVAL)) {
+				ok = false;
+			} else if ((revents & POLLHUP) && !(revents & POLLIN)) {
+				ok = false;
+			}
+			if (!ok) {
+				closeUpstream(endpoints[i - 1], "connection lost");
+			}
+		}
+
+		finishConnects(false);
+		drainQueue();
+		int64_t now_ms = nowMs();
+		if (now_ms - expired_ms >= expire_interval_ms) {
+			expireRequests();
+			expired_ms = now_ms;
+		}
+		for (auto it = upstreams.begin(); it != upstreams.end(); ) {
+			auto current = it++;
+			if (!flush(current->second)) {
+				closeUpstream(current->first, "write failed");
+				continue;
+			}
+			current->second.waiting_count.store(current->second.waiting.size(), std::memory_order_relaxed);
+			current->second.output_bytes.store(current->second.output.size(), std::memory_order_relaxed);
+		}
+	}
+
+	drainQueue();
+	finishConnects(true);
+	while (!upstreams.empty()) {
+		closeUpstream(upstreams.begin()->first, "I/O thread stopped");
+	}
+}
+
+}
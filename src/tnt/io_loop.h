@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct tnt_stream;
+
+namespace tnt {
+
+/**
+ * Engine-owned I/O threads that own the Tarantool sockets.
+ *
+ * Session threads encode a request, push it onto the loop's lock-free
+ * multi-producer queue and park on the request until its reply arrives.
+ * Each endpoint is served by one socket of one loop thread, so requests of
+ * many sessions that arrive together leave in a single write() and Tarantool
+ * sees a handful of connections instead of one per MySQL session.
+ *
+ * Connecting (greeting and authentication included) happens on a helper
+ * thread, so an unreachable endpoint holds up only its own requests; after
+ * a failed attempt the endpoint is skipped for a delay that doubles with
+ * every further failure. Every request fails once its timeout has passed,
+ * whether or not the endpoint ever answers.
+ */
+class IoLoop
+{
+public:
+	class Request {
+	public:
+		/// Blocks until the reply arrived, the request failed or its timeout passed
+		bool wait(std::string &error);
+		/// Whole iproto packet, length prefix included
+		std::string reply;
+	private:
+		friend class IoLoop;
+		std::string endpoint;
+		std::string data;
+		uint64_t sync = 0;
+		std::chrono::steady_clock::time_point deadline;
+		bool done = false;
+		std::string error;
+		std::mutex mutex;
+		std::condition_variable condition;
+
+		void complete(const std::string &failure);
+	};
+
+	/// Occupancy of one socket
+	struct upstream_status_t {
+		std::string endpoint;
+		std::size_t waiting;      // requests sent, no reply yet
+		std::size_t output_bytes; // requests not written to the socket yet
+	};
+	struct worker_status_t {
+		std::size_t queued; // submitted, not taken by the thread yet
+		std::vector<upstream_status_t> upstreams;
+	};
+
+	/// request_timeout_ms of 0 lets requests wait for as long as it takes
+	static bool start(unsigned threads_number, uint64_t request_timeout_ms);
+	static void stop();
+	/// nullptr unless started
+	static IoLoop *instance();
+
+	/// Syncs are unique across the process since sessions share sockets
+	uint64_t nextSync();
+	std::shared_ptr<Request> submit(const std::string &endpoint, const char *data, std::size_t size, uint64_t sync);
+
+	/// Read while the threads run; socket counters are refreshed once per poll round
+	std::vector<worker_status_t> status() const;
+private:
+	struct node_t {
+		std::shared_ptr<Request> request;
+		node_t *next;
+	};
+	/// A connect in progress and the requests waiting for it
+	struct connect_t {
+		std::thread thread;
+		std::atomic<bool> finished{false};
+		struct tnt_stream *stream = nullptr; // set on success
+		std::string error;
+		std::vector<std::shared_ptr<Request>> queued;
+	};
+	/// An endpoint skipped after failed connects
+	struct backoff_t {
+		int64_t until_ms = 0;
+		int64_t delay_ms = 0;
+		std::string error;
+	};
+	struct upstream_t {
+		struct tnt_stream *stream = nullptr; // owns the socket and did the handshake
+		int fd = -1;
+		std::string output;
+		std::string input;
+		std::map<uint64_t, std::shared_ptr<Request>> waiting;
+		std::atomic<std::size_t> waiting_count{0};
+		std::atomic<std::size_t> output_bytes{0};
+	};
+	class Worker {
+	public:
+		Worker();
+		~Worker();
+		bool start();
+		void stop();
+		void push(node_t *node);
+		worker_status_t status() const;
+	private:
+		std::atomic<node_t*> head;
+		std::atomic<std::size_t> queued;
+		std::atomic<bool> stopping;
+		int wakeup_pipe[2];
+		std::thread thread;
+		std::map<std::string, upstream_t> upstreams;
+		mutable std::mutex upstreams_mutex; // insertions and erasures, for status()
+		std::map<std::string, std::unique_ptr<connect_t>> connecting;
+		std::map<std::string, backoff_t> backoffs;
+		int64_t expired_ms = 0; // when expireRequests() last ran
+
+		void run();
+		void drainQueue();
+		void startConnect(const std::string &endpoint, const std::shared_ptr<Request> &request);
+		void connectUpstream(connect_t *attempt, std::string endpoint);
+		void finishConnects(bool wait);
+		void expireRequests();
+		void send(upstream_t &up, const std::shared_ptr<Request> &request);
+		void closeUpstream(const std::string &endpoint, const std::string &error);
+		bool flush(upstream_t &up);
+		bool receive(upstream_t &up);
+	};
+
+	static std::atomic<IoLoop*> running;
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::atomic<uint64_t> sync_counter;
+	uint64_t request_timeout_ms = 0;
+
+	IoLoop();
+};
+
+}
@@ -1,5 +1,7 @@
 #include "iterator.h"
 
+#include <cstring>
+
 #include <msgpuck.h>
 
 #include <tarantool/tarantool.h>
@@ -9,10 +11,8 @@
 #include <tarantool/tnt_stream.h>
 #include <tarantool/tnt_request.h>
 
-#include <cassert>
-#include <stdexcept>
-
 #include "row.h"
+#include "buffer_pool.h"
 
 
 namespace tnt {
@@ -23,32 +23,54 @@ Iterator::Iterator():
 {
 }
 
-std::shared_ptr<Iterator> Iterator::makeFromStream(struct tnt_stream *tnt)
+Iterator::~Iterator()
 {
-	std::shared_ptr<Iterator> iter = std::shared_ptr<Iterator>(new Iterator);
+}
 
-	iter->reply_holder.reset(
-			new struct tnt_reply,
+std::shared_ptr<struct tnt_reply> Iterator::allocateReply()
+{
+	std::shared_ptr<struct tnt_reply> reply(
+			BufferPool::create<struct tnt_reply>(),
 			&Iterator::deleteReply
 		);
-	iter->reply = iter->reply_holder.get();
+	tnt_reply_init(reply.get());
+	return reply;
+}
 
-	tnt_reply_init(iter->reply);
-	if (tnt->read_reply(tnt, iter->reply) == -1) {
-		throw new std::runtime_error("Failed to read reply"); // TODO: add moar info into error message
+std::shared_ptr<Iterator> Iterator::makeFromReply(std::shared_ptr<struct tnt_reply> reply)
+{
+	if (!reply->data || mp_typeof(*reply->data) != MP_ARRAY) {
+		return std::shared_ptr<Iterator>();
 	}
+	std::shared_ptr<Iterator> iter = std::shared_ptr<Iterator>(new Iterator);
+	iter->reply_holder = reply;
+	iter->reply = iter->reply_holder.get();
 	iter->tuples_data = iter->reply->data;
-	assert(mp_typeof(*iter->tuples_data) == MP_ARRAY);
 	iter->rowsNumber = mp_decode_array(&iter->tuples_data);
 
 	return iter;
 }
 
+std::shared_ptr<Iterator> Iterator::makeFromData(const std::string &tuples)
+{
+	auto reply = allocateReply();
+	// tnt_reply_free() releases the buffer along with the reply
+	char *buffer = static_cast<char*>(tnt_mem_alloc(tuples.size()));
+	if (!buffer) {
+		return std::shared_ptr<Iterator>();
+	}
+	memcpy(buffer, tuples.data(), tuples.size());
+	reply->buf = buffer;
+	reply->data = buffer;
+	reply->data_end = buffer + tuples.size();
+	return makeFromReply(reply);
+}
+
 void Iterator::deleteReply(struct tnt_reply *reply)
 {
 	if (reply) {
 		tnt_reply_free(reply);
-		delete reply;
+		BufferPool::destroy(reply);
 	}
 }
 
@@ -66,9 +88,31 @@ std::shared_ptr<Row> Iterator::nextRow()
 	}
 }
 
+std::shared_ptr<Iterator> Iterator::clone() const
+{
+	if (!reply_holder) {
+		return std::shared_ptr<Iterator>();
+	}
+	return makeFromReply(reply_holder);
+}
+
+std::string Iterator::encodedTuples() const
+{
+	if (!reply || !reply->data) {
+		return std::string();
+	}
+	return std::string(reply->data, reply->data_end);
+}
+
 Iterator::operator bool() const
 {
 	return tuples_data != reply->data_end;
 }
 
+const std::string &Iterator::lastError() const
+{
+	static const std::string none;
+	return none; // a reply in hand can't fail half way
+}
+
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <string>
 // #include "row.h"
 
 struct tnt_reply;
@@ -12,11 +13,25 @@ class Row;
 
 class Iterator
 {
+protected:
 	Iterator();
 public:
-	static std::shared_ptr<Iterator> makeFromStream(struct tnt_stream *tnt);
-	std::shared_ptr<Row> nextRow();
-	operator bool() const;
+	virtual ~Iterator();
+
+	/// Reply structure drawn from the buffer pool
+	static std::shared_ptr<struct tnt_reply> allocateReply();
+	/// nullptr if the reply doesn't carry a tuple array
+	static std::shared_ptr<Iterator> makeFromReply(std::shared_ptr<struct tnt_reply> reply);
+	/// Iterator over a copy of a msgpack array of tuples, e.g. from encodedTuples()
+	static std::shared_ptr<Iterator> makeFromData(const std::string &tuples);
+	virtual std::shared_ptr<Row> nextRow();
+	virtual operator bool() const;
+	/// Another cursor over the same reply, from its first row; nullptr if not reply-backed
+	virtual std::shared_ptr<Iterator> clone() const;
+	/// The reply's array of tuples as received; empty if not reply-backed
+	virtual std::string encodedTuples() const;
+	/// Why the rows ran out early, empty when they simply ended
+	virtual const std::string &lastError() const;
 private:
 	std::shared_ptr<struct tnt_reply> reply_holder;
 	struct tnt_reply *reply;
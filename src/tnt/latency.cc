@@ -0,0 +1,166 @@
+#include "latency.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace tnt {
+
+namespace {
+
+thread_local LatencySet *current_table = nullptr;
+
+LatencySet global_set;
+
+}
+
+std::mutex Latency::tables_mutex;
+std::map<std::string, std::shared_ptr<LatencySet>> Latency::tables;
+
+const char *latencyOpName(latency_op_t op)
+{
+	static const char *names[LATENCY_OPS] = {
+		"select", "insert", "replace", "delete", "eval", "connect"
+	};
+	return op < LATENCY_OPS ? names[op] : "unknown";
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+	reset();
+}
+
+int LatencyHistogram::bucketOf(uint64_t us)
+{
+	if (us < static_cast<uint64_t>(sub_buckets)) {
+		return static_cast<int>(us);
+	}
+	int exponent = 63 - __builtin_clzll(us);
+	if (exponent > max_exponent) {
+		return buckets_number - 1;
+	}
+	int sub = static_cast<int>(us >> (exponent - sub_bits)) - sub_buckets;
+	return sub_buckets * (exponent - sub_bits + 1) + sub;
+}
+
+uint64_t LatencyHistogram::highestEquivalent(int bucket)
+{
+	if (bucket < sub_buckets) {
+		return static_cast<uint64_t>(bucket);
+	}
+	int exponent = bucket / sub_buckets + sub_bits - 1;
+	uint64_t sub = static_cast<uint64_t>(bucket % sub_buckets + sub_buckets);
+	return ((sub + 1) << (exponent - sub_bits)) - 1;
+}
+
+void LatencyHistogram::record(uint64_t us)
+{
+	buckets[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+	total.fetch_add(1, std::memory_order_relaxed);
+	sum.fetch_add(us, std::memory_order_relaxed);
+	uint64_t seen = max.load(std::memory_order_relaxed);
+	while (us > seen && !max.compare_exchange_weak(seen, us, std::memory_order_relaxed)) {
+	}
+}
+
+void LatencyHistogram::reset()
+{
+	for (auto &bucket: buckets) {
+		bucket.store(0, std::memory_order_relaxed);
+	}
+	total.store(0, std::memory_order_relaxed);
+	sum.store(0, std::memory_order_relaxed);
+	max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::count() const
+{
+	return total.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::maxUs() const
+{
+	return max.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::sumUs() const
+{
+	return sum.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentileUs(double percentile) const
+{
+	// the buckets are summed instead of trusting total, which may run ahead
+	uint64_t counts[buckets_number];
+	uint64_t recorded = 0;
+	for (int n = 0; n < buckets_number; ++n) {
+		counts[n] = buckets[n].load(std::memory_order_relaxed);
+		recorded += counts[n];
+	}
+	if (recorded == 0) {
+		return 0;
+	}
+	uint64_t rank = static_cast<uint64_t>(std::ceil(percentile / 100.0 * recorded));
+	if (rank == 0) {
+		rank = 1;
+	}
+	uint64_t seen = 0;
+	for (int n = 0; n < buckets_number; ++n) {
+		seen += counts[n];
+		if (seen >= rank) {
+			return std::min(highestEquivalent(n), maxUs());
+		}
+	}
+	return maxUs();
+}
+
+void LatencySet::reset()
+{
+	for (auto &op: ops) {
+		op.reset();
+	}
+}
+
+Latency::Scope::Scope(LatencySet *table):
+	previous(current_table)
+{
+	current_table = table;
+}
+
+Latency::Scope::~Scope()
+{
+	current_table = previous;
+}
+
+void Latency::record(latency_op_t op, uint64_t us)
+{
+	global_set.ops[op].record(us);
+	if (current_table) {
+		current_table->ops[op].record(us);
+	}
+}
+
+LatencySet &Latency::global()
+{
+	return global_set;
+}
+
+std::shared_ptr<LatencySet> Latency::forTable(const std::string &name)
+{
+	std::lock_guard<std::mutex> guard(tables_mutex);
+	std::shared_ptr<LatencySet> &set = tables[name];
+	if (!set) {
+		set = std::make_shared<LatencySet>();
+	}
+	return set;
+}
+
+void Latency::resetAll()
+{
+	global_set.reset();
+	std::lock_guard<std::mutex> guard(tables_mutex);
+	for (auto &table: tables) {
+		table.second->reset();
+	}
+}
+
+}
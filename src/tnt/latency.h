@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace tnt {
+
+enum latency_op_t {
+	LATENCY_SELECT,
+	LATENCY_INSERT,
+	LATENCY_REPLACE,
+	LATENCY_DELETE,
+	LATENCY_EVAL,     // batched and transactional writes
+	LATENCY_CONNECT,
+	LATENCY_OPS
+};
+
+const char *latencyOpName(latency_op_t op);
+
+/**
+ * Log-linear histogram of microseconds, HDR-style: every power of two is
+ * split into 16 linear buckets, so any recorded value is reported within
+ * 1/16 of itself up to about 12 days. Recording is one relaxed increment
+ * and never locks; reading while others record gives a slightly mixed
+ * but never torn picture.
+ */
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+
+	void record(uint64_t us);
+	void reset();
+
+	uint64_t count() const;
+	uint64_t maxUs() const;
+	uint64_t sumUs() const;
+	/// Highest value equivalent to the one at the percentile, 0 if empty
+	uint64_t percentileUs(double percentile) const;
+private:
+	static const int sub_bits = 4;
+	static const int sub_buckets = 1 << sub_bits;
+	static const int max_exponent = 40;
+	static const int buckets_number = sub_buckets * (max_exponent - sub_bits + 2);
+
+	std::atomic<uint64_t> buckets[buckets_number];
+	std::atomic<uint64_t> total;
+	std::atomic<uint64_t> sum;
+	std::atomic<uint64_t> max;
+
+	static int bucketOf(uint64_t us);
+	static uint64_t highestEquivalent(int bucket);
+};
+
+/// One histogram per operation, for the whole engine or one table
+struct LatencySet
+{
+	LatencyHistogram ops[LATENCY_OPS];
+	void reset();
+};
+
+/**
+ * Round trips of tnt::Connection go to the global set and to the set of
+ * the table the calling thread works for, see Scope.
+ */
+class Latency
+{
+public:
+	/// Makes the thread's round trips count for a table while it lives
+	class Scope {
+	public:
+		explicit Scope(LatencySet *table);
+		~Scope();
+	private:
+		LatencySet *previous;
+	};
+
+	static void record(latency_op_t op, uint64_t us);
+	static LatencySet &global();
+	/// Registered set of a table, created on first use and kept until exit
+	static std::shared_ptr<LatencySet> forTable(const std::string &name);
+	/// Calls visit(name, set) for every table
+	template<class Visit>
+	static void eachTable(Visit visit)
+	{
+		std::lock_guard<std::mutex> guard(tables_mutex);
+		for (auto &table: tables) {
+			visit(table.first, *table.second);
+		}
+	}
+	static void resetAll();
+private:
+	static std::mutex tables_mutex;
+	static std::map<std::string, std::shared_ptr<LatencySet>> tables;
+};
+
+}
@@ -0,0 +1,113 @@
+#include "merge_iterator.h"
+
+#include <cstring>
+
+#include "row.h"
+
+namespace tnt {
+
+namespace {
+
+int rank(const Row &row)
+{
+	if (row.getFieldNum() == 0 || row.isNull(0)) {
+		return 0;
+	} else if (row.isBool(0)) {
+		return 1;
+	} else if (row.isInt(0) || row.isFloatingPoint(0)) {
+		return 2;
+	}
+	return 3;
+}
+
+}
+
+MergeIterator::MergeIterator(std::vector<std::shared_ptr<Iterator>> iterators, bool ordered):
+	ordered(ordered)
+{
+	for (auto &iterator: iterators) {
+		source_t source;
+		source.iterator = iterator;
+		if (ordered) {
+			source.head = iterator->nextRow();
+		}
+		sources.push_back(source);
+	}
+}
+
+int MergeIterator::compareFirstField(const Row &a, const Row &b)
+{
+	int rank_a = rank(a);
+	int rank_b = rank(b);
+	if (rank_a != rank_b) {
+		return rank_a < rank_b ? -1 : 1;
+	}
+	switch (rank_a) {
+	case 1:
+		return int(a.getBool(0)) - int(b.getBool(0));
+	case 2:
+		if (a.isInt(0) && b.isInt(0)) {
+			int64_t x = a.getInt(0);
+			int64_t y = b.getInt(0);
+			return x < y ? -1 : (x > y ? 1 : 0);
+		} else {
+			double x = a.isInt(0) ? a.getInt(0) : a.getDouble(0);
+			double y = b.isInt(0) ? b.getInt(0) : b.getDouble(0);
+			return x < y ? -1 : (x > y ? 1 : 0);
+		}
+	case 3:
+		return a.getString(0).compare(b.getString(0));
+	default:
+		return 0;
+	}
+}
+
+std::shared_ptr<Row> MergeIterator::nextRow()
+{
+	if (!ordered) {
+		while (current < sources.size()) {
+			auto row = sources[current].iterator->nextRow();
+			if (row) {
+				return row;
+			}
+			++current;
+		}
+		return std::shared_ptr<Row>();
+	}
+
+	source_t *smallest = nullptr;
+	for (auto &source: sources) {
+		if (source.head && (!smallest || compareFirstField(*source.head, *smallest->head) < 0)) {
+			smallest = &source;
+		}
+	}
+	if (!smallest) {
+		return std::shared_ptr<Row>();
+	}
+	auto row = smallest->head;
+	smallest->head = smallest->iterator->nextRow();
+	return row;
+}
+
+const std::string &MergeIterator::lastError() const
+{
+	for (auto &source: sources) {
+		const std::string &error = source.iterator->lastError();
+		if (!error.empty()) {
+			return error;
+		}
+	}
+	return Iterator::lastError();
+}
+
+MergeIterator::operator bool() const
+{
+	for (std::size_t i = ordered ? 0 : current; i < sources.size(); ++i) {
+		if (sources[i].head || *sources[i].iterator) {
+			return true;
+		}
+	}
+	return false;
+}
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "iterator.h"
+
+namespace tnt {
+
+/**
+ * Combines the replies of several shards into one stream. Unordered merges
+ * return the sources one after another; ordered ones do a k-way merge on the
+ * first field, which is where every shard keeps its primary key.
+ */
+class MergeIterator: public Iterator
+{
+public:
+	MergeIterator(std::vector<std::shared_ptr<Iterator>> sources, bool ordered);
+
+	std::shared_ptr<Row> nextRow() override;
+	operator bool() const override;
+	/// The first error of the sources
+	const std::string &lastError() const override;
+
+	/// Tarantool's order of scalars: numbers before strings, then by value
+	static int compareFirstField(const Row &a, const Row &b);
+private:
+	struct source_t {
+		std::shared_ptr<Iterator> iterator;
+		std::shared_ptr<Row> head;
+	};
+	std::vector<source_t> sources;
+	bool ordered;
+	std::size_t current = 0;
+};
+
+}
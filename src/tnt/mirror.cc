@@ -0,0 +1,817 @@
+#include "mirror.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+
+#include <tarantool/tarantool.h>
+#include <tarantool/tnt_net.h>
+#include <tarantool/tnt_opt.h>
+
+#include <msgpuck.h>
+
+#include "connection.h"
+#include "iterator.h"
+#include "tuple_builder.h"
+
+namespace tnt {
+
+namespace {
+
+// iproto request and row types
+const uint32_t iproto_ok = 0;
+const uint32_t iproto_insert = 2;
+const uint32_t iproto_replace = 3;
+const uint32_t iproto_update = 4;
+const uint32_t iproto_delete = 5;
+const uint32_t iproto_upsert = 9;
+const uint32_t iproto_subscribe = 66;
+const uint32_t iproto_fetch_snapshot = 69;
+const uint32_t iproto_type_error = 0x8000;
+
+// header keys
+const uint64_t iproto_request_type = 0x00;
+const uint64_t iproto_sync = 0x01;
+const uint64_t iproto_replica_id = 0x02;
+const uint64_t iproto_lsn = 0x03;
+const uint64_t iproto_timestamp = 0x04;
+
+// body keys
+const uint64_t iproto_space_id = 0x10;
+const uint64_t iproto_key = 0x20;
+const uint64_t iproto_tuple = 0x21;
+const uint64_t iproto_instance_uuid = 0x24;
+const uint64_t iproto_cluster_uuid = 0x25;
+const uint64_t iproto_vclock = 0x26;
+const uint64_t iproto_error = 0x31;
+const uint64_t iproto_replica_anon = 0x50;
+
+const int ack_interval_ms = 1000;
+const int retry_interval_ms = 1000;
+const long io_timeout_s = 10;
+
+int64_t nowUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+}
+
+std::string randomUuid()
+{
+	std::random_device device;
+	std::mt19937_64 generator(device());
+	uint64_t high = generator(), low = generator();
+	high = (high & ~0xf000ULL) | 0x4000ULL;                   // version 4
+	low = (low & ~(0xc0ULL << 56)) | (0x80ULL << 56);         // RFC 4122 variant
+	char text[37];
+	snprintf(text, sizeof text, "%08x-%04x-%04x-%04x-%012llx",
+			static_cast<unsigned>(high >> 32), static_cast<unsigned>((high >> 16) & 0xffff),
+			static_cast<unsigned>(high & 0xffff), static_cast<unsigned>(low >> 48),
+			static_cast<unsigned long long>(low & 0xffffffffffffULL));
+	return text;
+}
+
+// nil < bool < number < string < anything else, as MergeIterator orders them
+int scalarRank(const char *p)
+{
+	switch (mp_typeof(*p)) {
+	case MP_NIL:
+		return 0;
+	case MP_BOOL:
+		return 1;
+	case MP_UINT:
+	case MP_INT:
+	case MP_FLOAT:
+	case MP_DOUBLE:
+		return 2;
+	case MP_STR:
+		return 3;
+	default:
+		return 4;
+	}
+}
+
+double decodeNumber(const char *p)
+{
+	switch (mp_typeof(*p)) {
+	case MP_UINT:
+		return static_cast<double>(mp_decode_uint(&p));
+	case MP_INT:
+		return static_cast<double>(mp_decode_int(&p));
+	case MP_FLOAT:
+		return mp_decode_float(&p);
+	default:
+		return mp_decode_double(&p);
+	}
+}
+
+// Encoded first field of an encoded array, empty if there is none
+std::string firstField(const char *array)
+{
+	if (mp_typeof(*array) != MP_ARRAY || mp_decode_array(&array) == 0) {
+		return std::string();
+	}
+	const char *end = array;
+	mp_next(&end);
+	return std::string(array, end);
+}
+
+std::mutex registry_mutex; // guards Mirror::streams
+
+}
+
+bool Mirror::key_less_t::operator()(const std::string &a, const std::string &b) const
+{
+	const char *pa = a.data(), *pb = b.data();
+	int ra = scalarRank(pa), rb = scalarRank(pb);
+	if (ra != rb) {
+		return ra < rb;
+	}
+	switch (ra) {
+	case 0:
+		return false;
+	case 1:
+		return mp_decode_bool(&pa) < mp_decode_bool(&pb);
+	case 2:
+		if (mp_typeof(*pa) == MP_UINT && mp_typeof(*pb) == MP_UINT) {
+			return mp_decode_uint(&pa) < mp_decode_uint(&pb);
+		}
+		if (mp_typeof(*pa) == MP_INT && mp_typeof(*pb) == MP_INT) {
+			return mp_decode_int(&pa) < mp_decode_int(&pb);
+		}
+		if (mp_typeof(*pa) == MP_INT && mp_typeof(*pb) == MP_UINT) {
+			return true;
+		}
+		if (mp_typeof(*pa) == MP_UINT && mp_typeof(*pb) == MP_INT) {
+			return false;
+		}
+		return decodeNumber(pa) < decodeNumber(pb);
+	case 3: {
+		uint32_t la = 0, lb = 0;
+		const char *sa = mp_decode_str(&pa, &la);
+		const char *sb = mp_decode_str(&pb, &lb);
+		int c = memcmp(sa, sb, std::min(la, lb));
+		return c < 0 || (c == 0 && la < lb);
+	}
+	default:
+		return a < b;
+	}
+}
+
+std::map<std::string, std::shared_ptr<Mirror::Stream>> Mirror::streams;
+
+Mirror::Mirror(int space_id):
+	space_id(space_id),
+	loaded(false),
+	last_contact_us(0),
+	rows_applied(0)
+{
+}
+
+std::shared_ptr<Mirror> Mirror::get(const std::string &endpoint, int space_id)
+{
+	std::lock_guard<std::mutex> guard(registry_mutex);
+	auto &stream = streams[endpoint];
+	if (!stream) {
+		stream.reset(new Stream(endpoint));
+	}
+	std::shared_ptr<Mirror> mirror = stream->mirror(space_id);
+	if (!stream->thread.joinable()) {
+		stream->thread = std::thread(&Stream::run, stream.get());
+	}
+	return mirror;
+}
+
+void Mirror::stopAll()
+{
+	std::map<std::string, std::shared_ptr<Stream>> stopped;
+	{
+		std::lock_guard<std::mutex> guard(registry_mutex);
+		stopped.swap(streams);
+	}
+	for (auto &stream: stopped) {
+		stream.second->stopping = true;
+	}
+	// the last reference joins the thread, outside of the registry lock
+}
+
+uint64_t Mirror::maxStalenessUs()
+{
+	std::lock_guard<std::mutex> guard(registry_mutex);
+	uint64_t result = 0;
+	for (auto &stream: streams) {
+		std::lock_guard<std::mutex> mirrors_guard(stream.second->mirrors_mutex);
+		for (auto &mirror: stream.second->mirrors) {
+			result = std::max(result, mirror.second->stalenessUs());
+		}
+	}
+	return result;
+}
+
+uint64_t Mirror::totalRowsApplied()
+{
+	std::lock_guard<std::mutex> guard(registry_mutex);
+	uint64_t result = 0;
+	for (auto &stream: streams) {
+		std::lock_guard<std::mutex> mirrors_guard(stream.second->mirrors_mutex);
+		for (auto &mirror: stream.second->mirrors) {
+			result += mirror.second->rows_applied.load(std::memory_order_relaxed);
+		}
+	}
+	return result;
+}
+
+std::size_t Mirror::count()
+{
+	std::lock_guard<std::mutex> guard(registry_mutex);
+	std::size_t result = 0;
+	for (auto &stream: streams) {
+		std::lock_guard<std::mutex> mirrors_guard(stream.second->mirrors_mutex);
+		result += stream.second->mirrors.size();
+	}
+	return result;
+}
+
+bool Mirror::ready() const
+{
+	return loaded.load();
+}
+
+uint64_t Mirror::stalenessUs() const
+{
+	int64_t contact = last_contact_us.load(std::memory_order_relaxed);
+	if (contact == 0) {
+		return UINT64_MAX;
+	}
+	return static_cast<uint64_t>(std::max<int64_t>(nowUs() - contact, 0));
+}
+
+std::size_t Mirror::size() const
+{
+	std::shared_lock<std::shared_timed_mutex> lock(mutex);
+	return tuples.size();
+}
+
+std::shared_ptr<Iterator> Mirror::select(const TupleBuilder &key, int iterator) const
+{
+	std::string field = firstField(key.ptr());
+	std::vector<const std::string*> found;
+
+	std::shared_lock<std::shared_timed_mutex> lock(mutex);
+	if (field.empty() || iterator == ITER_ALL) {
+		for (auto &tuple: tuples) {
+			found.push_back(&tuple.second);
+		}
+	} else {
+		switch (iterator) {
+		case ITER_EQ:
+		case ITER_REQ: {
+			auto match = tuples.find(field);
+			if (match != tuples.end()) {
+				found.push_back(&match->second);
+			}
+			break;
+		}
+		case ITER_GE:
+		case ITER_GT: {
+			auto it = iterator == ITER_GE ? tuples.lower_bound(field) : tuples.upper_bound(field);
+			for (; it != tuples.end(); ++it) {
+				found.push_back(&it->second);
+			}
+			break;
+		}
+		case ITER_LE:
+		case ITER_LT: {
+			auto end = iterator == ITER_LE ? tuples.upper_bound(field) : tuples.lower_bound(field);
+			for (auto it = tuples.begin(); it != end; ++it) {
+				found.push_back(&it->second);
+			}
+			std::reverse(found.begin(), found.end());
+			break;
+		}
+		}
+	}
+
+	std::string data;
+	char header[8];
+	data.append(header, mp_encode_array(header, found.size()) - header);
+	for (auto tuple: found) {
+		data.append(*tuple);
+	}
+	lock.unlock();
+	return Iterator::makeFromData(data);
+}
+
+void Mirror::apply(uint32_t type, const char *key, const char *tuple, tuples_t &target)
+{
+	switch (type) {
+	case iproto_insert:
+	case iproto_replace:
+		if (tuple) {
+			std::string field = firstField(tuple);
+			const char *end = tuple;
+			mp_next(&end);
+			if (!field.empty()) {
+				target[field].assign(tuple, end);
+			}
+		}
+		break;
+	case iproto_delete:
+		if (key) {
+			target.erase(firstField(key));
+		}
+		break;
+	case iproto_update:
+		// only the operations are replicated, so read the resulting tuple
+		if (key) {
+			refetch.push_back(firstField(key));
+		}
+		break;
+	case iproto_upsert:
+		if (tuple) {
+			refetch.push_back(firstField(tuple));
+		}
+		break;
+	default:
+		return; // NOP, raft and other service rows
+	}
+	rows_applied.fetch_add(1, std::memory_order_relaxed);
+}
+
+Mirror::Stream::Stream(const std::string &endpoint):
+	endpoint(endpoint),
+	stopping(false),
+	resync(false),
+	instance_uuid(randomUuid()),
+	fetcher(new Connection)
+{
+}
+
+Mirror::Stream::~Stream()
+{
+	stopping = true;
+	if (thread.joinable()) {
+		thread.join();
+	}
+	closeStream();
+}
+
+std::shared_ptr<Mirror> Mirror::Stream::mirror(int space_id)
+{
+	std::lock_guard<std::mutex> guard(mirrors_mutex);
+	auto &mirror = mirrors[space_id];
+	if (!mirror) {
+		mirror.reset(new Mirror(space_id));
+		resync = true; // the space's current rows are only in a snapshot
+	}
+	return mirror;
+}
+
+void Mirror::Stream::run()
+{
+	while (!stopping) {
+		std::string error;
+		replicate(error);
+		closeStream();
+		for (int waited = 0; waited < retry_interval_ms && !stopping && !resync; waited += 100) {
+			usleep(100 * 1000);
+		}
+	}
+}
+
+bool Mirror::Stream::replicate(std::string &error)
+{
+	{
+		std::lock_guard<std::mutex> guard(mirrors_mutex);
+		fed = mirrors;
+		resync = false;
+	}
+	return connectStream(error) && fetchSnapshot(error) && subscribe(error);
+}
+
+bool Mirror::Stream::connectStream(std::string &error)
+{
+	stream = tnt_net(NULL);
+	tnt_set(stream, TNT_OPT_URI, endpoint.c_str());
+	tnt_set(stream, TNT_OPT_SEND_BUF, 0);
+	tnt_set(stream, TNT_OPT_RECV_BUF, 0);
+	// bounds the handshake and the replica set UUID query, which stopAll() can't interrupt
+	struct timeval timeout = { io_timeout_s, 0 };
+	tnt_set(stream, TNT_OPT_TMOUT_CONNECT, &timeout);
+	tnt_set(stream, TNT_OPT_TMOUT_RECV, &timeout);
+	if (tnt_connect(stream) != 0) {
+		error = tnt_strerror(stream);
+		return false;
+	}
+	fd = TNT_SNET_CAST(stream)->fd;
+	input.clear();
+	return true;
+}
+
+void Mirror::Stream::closeStream()
+{
+	if (stream) {
+		tnt_close(stream);
+		tnt_stream_free(stream);
+		stream = nullptr;
+	}
+	fd = -1;
+}
+
+bool Mirror::Stream::sendPacket(uint32_t type, const std::string &body, std::string &error)
+{
+	char header[32];
+	char *p = mp_encode_map(header, 2);
+	p = mp_encode_uint(p, iproto_request_type);
+	p = mp_encode_uint(p, type);
+	p = mp_encode_uint(p, iproto_sync);
+	p = mp_encode_uint(p, 0);
+
+	// a fixed-size uint32 length, as Tarantool itself frames packets
+	uint32_t length = static_cast<uint32_t>((p - header) + body.size());
+	std::string packet(1, static_cast<char>(0xce));
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		packet.push_back(static_cast<char>((length >> shift) & 0xff));
+	}
+	packet.append(header, p - header);
+	packet.append(body);
+
+	for (std::size_t sent = 0; sent < packet.size(); ) {
+		ssize_t n = write(fd, packet.data() + sent, packet.size() - sent);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			error = strerror(errno);
+			return false;
+		}
+		sent += n;
+	}
+	return true;
+}
+
+bool Mirror::Stream::readPacket(std::string &packet, int timeout_ms, std::string &error)
+{
+	error.clear();
+	for (;;) {
+		if (!input.empty()) {
+			const char *begin = input.data();
+			const char *p = begin;
+			if (mp_typeof(*p) != MP_UINT) {
+				error = "Malformed packet length";
+				return false;
+			}
+			if (mp_check_uint(p, begin + input.size()) <= 0) {
+				uint64_t length = mp_decode_uint(&p);
+				std::size_t prefix = p - begin;
+				if (input.size() >= prefix + length) {
+					packet.assign(p, length);
+					input.erase(0, prefix + length);
+					return true;
+				}
+			}
+		}
+
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		int ready = poll(&pfd, 1, timeout_ms);
+		if (ready < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ready == 0 || stopping) {
+			return false; // timeout, error stays empty
+		}
+		char chunk[64 * 1024];
+		ssize_t n = read(fd, chunk, sizeof chunk);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			error = n == 0 ? "Connection closed" : strerror(errno);
+			return false;
+		}
+		input.append(chunk, n);
+	}
+}
+
+void Mirror::Stream::sendAck()
+{
+	std::string body;
+	char buf[32];
+	body.append(buf, mp_encode_map(buf, 1) - buf);
+	body.append(buf, mp_encode_uint(buf, iproto_vclock) - buf);
+	body.append(buf, mp_encode_map(buf, vclock.size()) - buf);
+	for (auto &component: vclock) {
+		body.append(buf, mp_encode_uint(buf, component.first) - buf);
+		body.append(buf, mp_encode_uint(buf, component.second) - buf);
+	}
+	std::string error;
+	sendPacket(iproto_ok, body, error);
+}
+
+std::string Mirror::Stream::replicasetUuid(std::string &error)
+{
+	static const std::string expression = "return box.info.cluster.uuid";
+	static const char no_arguments[] = { '\x90' };
+	struct tnt_stream *args = tnt_object_as(NULL, const_cast<char*>(no_arguments), sizeof no_arguments);
+	int rc = tnt_eval(stream, expression.data(), expression.size(), args);
+	tnt_stream_free(args);
+	if (rc == -1 || tnt_flush(stream) == -1) {
+		error = tnt_strerror(stream);
+		return std::string();
+	}
+	struct tnt_reply reply;
+	tnt_reply_init(&reply);
+	std::string uuid;
+	if (stream->read_reply(stream, &reply) == -1 || reply.code != 0) {
+		error = "Can't read the replica set UUID";
+	} else {
+		const char *p = reply.data;
+		if (p && mp_typeof(*p) == MP_ARRAY && mp_decode_array(&p) > 0 && mp_typeof(*p) == MP_STR) {
+			uint32_t length = 0;
+			const char *str = mp_decode_str(&p, &length);
+			uuid.assign(str, length);
+		}
+	}
+	tnt_reply_free(&reply);
+	return uuid;
+}
+
+namespace {
+
+struct row_t {
+	uint32_t type = 0;
+	uint32_t replica_id = 0;
+	uint64_t lsn = 0;
+	const char *body = nullptr;
+};
+
+bool decodeRow(const std::string &packet, row_t &row, std::string &error)
+{
+	const char *p = packet.data();
+	const char *end = p + packet.size();
+	if (mp_typeof(*p) != MP_MAP) {
+		error = "Malformed row header";
+		return false;
+	}
+	uint32_t keys = mp_decode_map(&p);
+	for (uint32_t i = 0; i < keys; ++i) {
+		uint64_t key = mp_typeof(*p) == MP_UINT ? mp_decode_uint(&p) : (mp_next(&p), UINT64_MAX);
+		if (key == iproto_request_type && mp_typeof(*p) == MP_UINT) {
+			row.type = static_cast<uint32_t>(mp_decode_uint(&p));
+		} else if (key == iproto_replica_id && mp_typeof(*p) == MP_UINT) {
+			row.replica_id = static_cast<uint32_t>(mp_decode_uint(&p));
+		} else if (key == iproto_lsn && mp_typeof(*p) == MP_UINT) {
+			row.lsn = mp_decode_uint(&p);
+		} else {
+			mp_next(&p); // sync, timestamp and the rest
+		}
+	}
+	row.body = p < end ? p : nullptr;
+	if (row.type & iproto_type_error) {
+		error = "Replication error";
+		const char *b = row.body;
+		if (b && mp_typeof(*b) == MP_MAP) {
+			uint32_t n = mp_decode_map(&b);
+			for (uint32_t i = 0; i < n; ++i) {
+				if (mp_typeof(*b) == MP_UINT && mp_decode_uint(&b) == iproto_error && mp_typeof(*b) == MP_STR) {
+					uint32_t length = 0;
+					const char *str = mp_decode_str(&b, &length);
+					error.assign(str, length);
+					break;
+				}
+				mp_next(&b);
+			}
+		}
+		return false;
+	}
+	return true;
+}
+
+bool decodeVclock(const char *body, std::map<uint32_t, uint64_t> &vclock)
+{
+	if (!body || mp_typeof(*body) != MP_MAP) {
+		return false;
+	}
+	uint32_t keys = mp_decode_map(&body);
+	for (uint32_t i = 0; i < keys; ++i) {
+		if (mp_typeof(*body) == MP_UINT && mp_decode_uint(&body) == iproto_vclock &&
+				mp_typeof(*body) == MP_MAP) {
+			vclock.clear();
+			uint32_t components = mp_decode_map(&body);
+			for (uint32_t c = 0; c < components; ++c) {
+				uint32_t id = static_cast<uint32_t>(mp_decode_uint(&body));
+				vclock[id] = mp_decode_uint(&body);
+			}
+			return true;
+		}
+		mp_next(&body);
+	}
+	return false;
+}
+
+
+// Space, key and tuple of a DML row body; false if it has no space
+bool decodeDml(const char *body, int64_t &space, const char *&key, const char *&tuple)
+{
+	space = -1;
+	key = tuple = nullptr;
+	if (!body || mp_typeof(*body) != MP_MAP) {
+		return false;
+	}
+	uint32_t keys = mp_decode_map(&body);
+	for (uint32_t i = 0; i < keys; ++i) {
+		uint64_t name = mp_typeof(*body) == MP_UINT ? mp_decode_uint(&body) : (mp_next(&body), UINT64_MAX);
+		if (name == iproto_space_id && mp_typeof(*body) == MP_UINT) {
+			space = static_cast<int64_t>(mp_decode_uint(&body));
+			continue;
+		}
+		if (name == iproto_key) {
+			key = body;
+		} else if (name == iproto_tuple) {
+			tuple = body;
+		}
+		mp_next(&body);
+	}
+	return space >= 0;
+}
+
+}
+
+bool Mirror::Stream::fetchSnapshot(std::string &error)
+{
+	std::string uuid = replicasetUuid(error);
+	if (uuid.empty()) {
+		return false;
+	}
+	instance_uuid = randomUuid();
+
+	char buf[8];
+	std::string body(buf, mp_encode_map(buf, 0) - buf);
+	if (!sendPacket(iproto_fetch_snapshot, body, error)) {
+		return false;
+	}
+
+	// an OK with the snapshot vclock, the snapshot rows, an OK with the final vclock
+	std::map<int, tuples_t> fresh;
+	std::map<uint32_t, uint64_t> snapshot_vclock;
+	int oks = 0;
+	std::string packet;
+	while (oks < 2) {
+		if (!readPacket(packet, ack_interval_ms, error)) {
+			if (!error.empty()) {
+				return false;
+			}
+			if (stopping) {
+				error = "Stopped";
+				return false;
+			}
+			continue;
+		}
+		row_t row;
+		if (!decodeRow(packet, row, error)) {
+			return false;
+		}
+		if (row.type == iproto_ok) {
+			decodeVclock(row.body, snapshot_vclock);
+			++oks;
+			continue;
+		}
+		int64_t space;
+		const char *key, *tuple;
+		if (decodeDml(row.body, space, key, tuple)) {
+			auto mirror = fed.find(static_cast<int>(space));
+			if (mirror != fed.end()) {
+				mirror->second->apply(row.type, key, tuple, fresh[mirror->first]);
+			}
+		}
+	}
+
+	for (auto &fed_mirror: fed) {
+		Mirror &mirror = *fed_mirror.second;
+		{
+			std::unique_lock<std::shared_timed_mutex> lock(mirror.mutex);
+			mirror.tuples.swap(fresh[fed_mirror.first]);
+			mirror.refetch.clear();
+		}
+		mirror.loaded = true;
+	}
+	vclock = snapshot_vclock;
+	cluster_uuid = uuid;
+	return true;
+}
+
+bool Mirror::Stream::subscribe(std::string &error)
+{
+	std::string body;
+	char buf[64];
+	body.append(buf, mp_encode_map(buf, 4) - buf);
+	body.append(buf, mp_encode_uint(buf, iproto_replica_anon) - buf);
+	body.append(buf, mp_encode_bool(buf, true) - buf);
+	body.append(buf, mp_encode_uint(buf, iproto_instance_uuid) - buf);
+	body.append(buf, mp_encode_str(buf, instance_uuid.data(), instance_uuid.size()) - buf);
+	body.append(buf, mp_encode_uint(buf, iproto_cluster_uuid) - buf);
+	body.append(buf, mp_encode_str(buf, cluster_uuid.data(), cluster_uuid.size()) - buf);
+	body.append(buf, mp_encode_uint(buf, iproto_vclock) - buf);
+	body.append(buf, mp_encode_map(buf, vclock.size()) - buf);
+	for (auto &component: vclock) {
+		body.append(buf, mp_encode_uint(buf, component.first) - buf);
+		body.append(buf, mp_encode_uint(buf, component.second) - buf);
+	}
+	if (!sendPacket(iproto_subscribe, body, error)) {
+		return false;
+	}
+
+	int64_t acked_us = nowUs();
+	std::string packet;
+	while (!stopping && !resync) {
+		bool received = readPacket(packet, ack_interval_ms, error);
+		if (!received && !error.empty()) {
+			return false;
+		}
+		if (received) {
+			row_t row;
+			if (!decodeRow(packet, row, error)) {
+				return false;
+			}
+			// only rows and heartbeats after the snapshot mean the mirrors are current
+			int64_t now_us = nowUs();
+			for (auto &mirror: fed) {
+				mirror.second->last_contact_us.store(now_us, std::memory_order_relaxed);
+			}
+			int64_t space;
+			const char *key, *tuple;
+			if (row.type != iproto_ok && decodeDml(row.body, space, key, tuple)) {
+				auto mirror = fed.find(static_cast<int>(space));
+				if (mirror != fed.end()) {
+					Mirror &target = *mirror->second;
+					std::unique_lock<std::shared_timed_mutex> lock(target.mutex);
+					target.apply(row.type, key, tuple, target.tuples);
+				}
+			}
+			if (row.replica_id != 0 && row.lsn != 0) {
+				vclock[row.replica_id] = row.lsn;
+			}
+		}
+		if (!refetchKeys(error)) {
+			return false;
+		}
+		// the master drops replicas it hasn't heard from for a few timeouts
+		if (nowUs() - acked_us >= ack_interval_ms * 1000LL) {
+			sendAck();
+			acked_us = nowUs();
+		}
+	}
+	return true;
+}
+
+bool Mirror::Stream::refetchKeys(std::string &error)
+{
+	for (auto &fed_mirror: fed) {
+		Mirror &mirror = *fed_mirror.second;
+		std::vector<std::string> keys;
+		{
+			std::unique_lock<std::shared_timed_mutex> lock(mirror.mutex);
+			keys.swap(mirror.refetch);
+		}
+		if (keys.empty()) {
+			continue;
+		}
+		if (!fetcher->connected()) {
+			fetcher->connect(endpoint);
+		}
+		for (auto &field: keys) {
+			if (field.empty()) {
+				continue;
+			}
+			TupleBuilder key(1);
+			key.pushEncoded(field.data());
+			auto result = fetcher->select(mirror.space_id, key);
+			if (!result) {
+				// the mirror missed the row's new value, only a new snapshot has it
+				mirror.loaded = false;
+				error = "Can't re-read an updated row";
+				return false;
+			}
+			std::string data = result->encodedTuples();
+			const char *p = data.data();
+			std::unique_lock<std::shared_timed_mutex> lock(mirror.mutex);
+			if (!data.empty() && mp_decode_array(&p) > 0) {
+				const char *end = p;
+				mp_next(&end);
+				mirror.tuples[field].assign(p, end);
+			} else {
+				mirror.tuples.erase(field);
+			}
+		}
+	}
+	return true;
+}
+
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct tnt_stream;
+
+namespace tnt {
+
+class Connection;
+class Iterator;
+class TupleBuilder;
+
+/**
+ * In-process copy of one space, kept up to date by replication.
+ *
+ * All mirrors of an instance share one Stream: a background thread that
+ * joins the instance as an anonymous replica, fetches a snapshot
+ * (FETCH_SNAPSHOT), then subscribes from the snapshot's vclock and applies
+ * the row stream to each space's ordered map of primary key to tuple. A
+ * mirror added later makes the stream fetch the snapshot again. UPDATE and
+ * UPSERT rows only carry operations, so their keys are re-read from the
+ * instance; if that fails the mirrors stop being ready until a new
+ * snapshot is loaded. Reads take a shared lock and copy the matching
+ * tuples out, so they never wait for the network; staleness() tells how
+ * long the stream hasn't heard from the instance.
+ */
+class Mirror
+{
+public:
+	/// Process-wide mirror of the space, started on first use
+	static std::shared_ptr<Mirror> get(const std::string &endpoint, int space_id);
+	static void stopAll();
+	/// Worst staleness among the running mirrors, microseconds
+	static uint64_t maxStalenessUs();
+	static uint64_t totalRowsApplied();
+	static std::size_t count();
+
+	/// True once the snapshot has been loaded
+	bool ready() const;
+	/// Microseconds since the last row or heartbeat from the instance
+	uint64_t stalenessUs() const;
+	std::size_t size() const;
+
+	/// Same semantics as a select by primary key; key is an encoded array
+	std::shared_ptr<Iterator> select(const TupleBuilder &key, int iterator) const;
+private:
+	// primary key values ordered like Tarantool orders scalars
+	struct key_less_t {
+		bool operator()(const std::string &a, const std::string &b) const;
+	};
+	typedef std::map<std::string, std::string, key_less_t> tuples_t;
+
+	// One anonymous replica per endpoint, feeding all the mirrors of its spaces
+	class Stream {
+	public:
+		explicit Stream(const std::string &endpoint);
+		~Stream();
+		/// The space's mirror, added (with a snapshot refetch) if it is new
+		std::shared_ptr<Mirror> mirror(int space_id);
+		void run();
+
+		std::string endpoint;
+		std::atomic<bool> stopping;
+		std::thread thread;
+
+		mutable std::mutex mirrors_mutex;
+		std::map<int, std::shared_ptr<Mirror>> mirrors;
+	private:
+		std::atomic<bool> resync; // a mirror was added while subscribed
+		std::map<int, std::shared_ptr<Mirror>> fed; // run()'s copy of mirrors
+		std::string instance_uuid;
+		std::string cluster_uuid;
+		std::map<uint32_t, uint64_t> vclock;
+		int fd = -1;
+		struct tnt_stream *stream = nullptr;
+		std::string input;
+		std::unique_ptr<Connection> fetcher;
+
+		bool replicate(std::string &error);
+		bool connectStream(std::string &error);
+		void closeStream();
+		bool fetchSnapshot(std::string &error);
+		bool subscribe(std::string &error);
+		bool sendPacket(uint32_t type, const std::string &body, std::string &error);
+		/// Waits for a whole packet up to timeout_ms; false with empty error on timeout
+		bool readPacket(std::string &packet, int timeout_ms, std::string &error);
+		void sendAck();
+		bool refetchKeys(std::string &error);
+		std::string replicasetUuid(std::string &error);
+	};
+
+	int space_id;
+
+	mutable std::shared_timed_mutex mutex;
+	tuples_t tuples;
+	std::vector<std::string> refetch; // keys of UPDATE/UPSERT rows
+
+	std::atomic<bool> loaded;
+	std::atomic<int64_t> last_contact_us; // set by the stream
+	std::atomic<uint64_t> rows_applied;
+
+	explicit Mirror(int space_id);
+	void apply(uint32_t type, const char *key, const char *tuple, tuples_t &target);
+
+	static std::map<std::string, std::shared_ptr<Stream>> streams; // by endpoint
+};
+}
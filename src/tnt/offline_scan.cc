@@ -0,0 +1,200 @@
+#include "offline_scan.h"
+
+#include <dirent.h>
+
+#include <cstdlib>
+
+#include <msgpuck.h>
+
+#include "row.h"
+
+namespace tnt {
+
+namespace {
+
+const uint32_t iproto_insert = 2;
+const uint32_t iproto_replace = 3;
+const uint32_t iproto_update = 4;
+const uint32_t iproto_delete = 5;
+const uint32_t iproto_upsert = 9;
+
+// Files are named after the vclock signature (sum of the lsns) they start from
+std::map<int64_t, std::string> listFiles(const std::string &directory, const std::string &suffix)
+{
+	std::map<int64_t, std::string> files;
+	DIR *dir = opendir(directory.c_str());
+	if (!dir) {
+		return files;
+	}
+	while (struct dirent *entry = readdir(dir)) {
+		std::string name = entry->d_name;
+		if (name.size() <= suffix.size() ||
+				name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+			continue;
+		}
+		char *end = nullptr;
+		long long signature = strtoll(name.c_str(), &end, 10);
+		if (end != name.c_str() + name.size() - suffix.size()) {
+			continue; // e.g. .snap.inprogress
+		}
+		files[signature] = directory + "/" + name;
+	}
+	closedir(dir);
+	return files;
+}
+
+std::string firstField(const char *array)
+{
+	if (!array || mp_typeof(*array) != MP_ARRAY || mp_decode_array(&array) == 0) {
+		return std::string();
+	}
+	const char *end = array;
+	mp_next(&end);
+	return std::string(array, end);
+}
+
+}
+
+OfflineScan::OfflineScan()
+{
+}
+
+std::shared_ptr<OfflineScan> OfflineScan::open(const std::string &directory, int space_id,
+		bool with_xlogs, std::string &error)
+{
+	auto snapshots = listFiles(directory, ".snap");
+	if (snapshots.empty()) {
+		error = "No snapshot in " + directory;
+		return std::shared_ptr<OfflineScan>();
+	}
+	std::shared_ptr<OfflineScan> scan(new OfflineScan);
+	scan->space_id = space_id;
+	auto newest = snapshots.rbegin();
+	if (!scan->snapshot.open(newest->second)) {
+		error = scan->snapshot.lastError();
+		return std::shared_ptr<OfflineScan>();
+	}
+	if (with_xlogs &&
+			!scan->readOverlay(listFiles(directory, ".xlog"), newest->first, error)) {
+		return std::shared_ptr<OfflineScan>();
+	}
+	scan->overlay_pos = scan->overlay.begin();
+	scan->lookahead = scan->fetch();
+	return scan;
+}
+
+bool OfflineScan::readOverlay(const std::map<int64_t, std::string> &xlogs, int64_t snapshot_signature,
+		std::string &error)
+{
+	if (xlogs.empty()) {
+		return true;
+	}
+	// the xlog that was being written when the snapshot was taken, and all after it
+	auto first = xlogs.upper_bound(snapshot_signature);
+	if (first != xlogs.begin()) {
+		--first;
+	}
+	const std::map<uint32_t, int64_t> &taken = snapshot.vclock();
+
+	for (auto file = first; file != xlogs.end(); ++file) {
+		XlogReader xlog;
+		if (!xlog.open(file->second)) {
+			error = xlog.lastError();
+			return false;
+		}
+		XlogReader::row_t row;
+		while (xlog.next(row)) {
+			if (row.space_id != space_id) {
+				continue;
+			}
+			auto component = taken.find(row.replica_id);
+			if (component != taken.end() && row.lsn <= component->second) {
+				continue; // already in the snapshot
+			}
+			switch (row.type) {
+			case iproto_insert:
+			case iproto_replace:
+				if (row.tuple) {
+					const char *end = row.tuple;
+					mp_next(&end);
+					overlay[firstField(row.tuple)].assign(row.tuple, end);
+				}
+				break;
+			case iproto_delete:
+				overlay[firstField(row.key)].clear();
+				break;
+			case iproto_update:
+			case iproto_upsert:
+				error = file->second + ": UPDATE/UPSERT rows can't be applied offline, "
+					"scan a fresh snapshot without xlogs instead";
+				return false;
+			}
+		}
+		if (!xlog.lastError().empty()) {
+			error = file->second + ": " + xlog.lastError();
+			return false;
+		}
+	}
+	return true;
+}
+
+std::shared_ptr<Row> OfflineScan::fetch()
+{
+	XlogReader::row_t row;
+	while (!snapshot_done) {
+		if (!snapshot.next(row)) {
+			snapshot_done = true;
+			last_error = snapshot.lastError();
+			if (last_error.empty() && !snapshot.complete()) {
+				last_error = "the snapshot ends without its EOF marker";
+			}
+			if (!last_error.empty()) {
+				// the rest of the snapshot is lost, the overlay can't make up for it
+				overlay_pos = overlay.end();
+				return std::shared_ptr<Row>();
+			}
+			break;
+		}
+		if (row.space_id != space_id || !row.tuple) {
+			continue;
+		}
+		if (!overlay.empty() && overlay.count(firstField(row.tuple))) {
+			continue; // superseded by the xlogs
+		}
+		const char *end = row.tuple;
+		mp_next(&end);
+		lookahead_tuple.assign(row.tuple, end);
+		const char *p = lookahead_tuple.data();
+		return Row::eatData(p);
+	}
+	while (overlay_pos != overlay.end()) {
+		const std::string &tuple = (overlay_pos++)->second;
+		if (!tuple.empty()) {
+			const char *p = tuple.data();
+			return Row::eatData(p);
+		}
+	}
+	return std::shared_ptr<Row>();
+}
+
+std::shared_ptr<Row> OfflineScan::nextRow()
+{
+	std::shared_ptr<Row> row = lookahead;
+	if (row) {
+		returned_tuple.swap(lookahead_tuple); // the row's data, until the next call
+		lookahead = fetch();
+	}
+	return row;
+}
+
+OfflineScan::operator bool() const
+{
+	return lookahead != nullptr;
+}
+
+const std::string &OfflineScan::lastError() const
+{
+	return last_error;
+}
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "iterator.h"
+#include "xlog_reader.h"
+
+namespace tnt {
+
+/**
+ * Full scan of a space from the files of a Tarantool instance, no network.
+ *
+ * Streams the newest .snap of the directory. With xlogs, rows written after
+ * the snapshot are first collected from the .xlog files into an overlay of
+ * primary key to latest tuple (or deletion); snapshot tuples whose key is
+ * in the overlay are skipped and the overlay's tuples follow the snapshot.
+ * UPDATE and UPSERT rows can't be replayed without Tarantool, so a scan
+ * hitting one fails instead of returning stale data.
+ */
+class OfflineScan: public Iterator
+{
+public:
+	static std::shared_ptr<OfflineScan> open(const std::string &directory, int space_id,
+			bool with_xlogs, std::string &error);
+
+	std::shared_ptr<Row> nextRow() override;
+	operator bool() const override;
+	/// Set when the scan stopped early because a file is damaged
+	const std::string &lastError() const override;
+private:
+	XlogReader snapshot;
+	int space_id = -1;
+	std::map<std::string, std::string> overlay; // empty tuple for a deleted key
+	std::map<std::string, std::string>::const_iterator overlay_pos;
+	bool snapshot_done = false;
+	std::shared_ptr<Row> lookahead;
+	// snapshot tuples of lookahead and of the row last returned: rows point
+	// into their tuple, and reading on reuses the reader's buffer
+	std::vector<char> lookahead_tuple;
+	std::vector<char> returned_tuple;
+	std::string last_error;
+
+	OfflineScan();
+	bool readOverlay(const std::map<int64_t, std::string> &xlogs, int64_t snapshot_signature,
+			std::string &error);
+	std::shared_ptr<Row> fetch();
+};
+
+}
@@ -0,0 +1,217 @@
+#include "paged_scan.h"
+
+#include <atomic>
+
+#include <msgpuck.h>
+
+#include "connection.h"
+#include "probes.h"
+#include "row.h"
+#include "tuple_builder.h"
+
+namespace tnt {
+
+namespace {
+
+std::atomic<std::size_t> max_prefetchers(16);
+std::atomic<std::size_t> prefetchers(0); // scans with a helper thread
+
+bool acquirePrefetcher()
+{
+	std::size_t running = prefetchers.load();
+	do {
+		if (running >= max_prefetchers.load(std::memory_order_relaxed)) {
+			return false;
+		}
+	} while (!prefetchers.compare_exchange_weak(running, running + 1));
+	return true;
+}
+
+// Number of tuples in the page and the first field of its last one
+uint32_t inspectPage(const std::string &tuples, std::string &last_key)
+{
+	const char *p = tuples.data();
+	if (tuples.empty() || mp_typeof(*p) != MP_ARRAY) {
+		return 0;
+	}
+	uint32_t count = mp_decode_array(&p);
+	for (uint32_t n = 0; n + 1 < count; ++n) {
+		mp_next(&p);
+	}
+	if (count > 0 && mp_typeof(*p) == MP_ARRAY && mp_decode_array(&p) > 0) {
+		const char *end = p;
+		mp_next(&end);
+		last_key.assign(p, end);
+	}
+	return count;
+}
+
+}
+
+PagedScan::PagedScan(ReplicaSet &shard, int space_id, const ReplicaSet::read_options_t &read_options,
+		const options_t &options):
+	shard(shard),
+	space_id(space_id),
+	read_options(read_options),
+	options(options)
+{
+	if (this->options.page_size == 0) {
+		this->options.page_size = 1;
+	}
+	if (options.prefetch_depth > 0 && acquirePrefetcher()) {
+		// the helper reads from the instance a synchronous scan would have used
+		Connection *reader = shard.reader(read_options);
+		if (!reader) {
+			prefetchers.fetch_sub(1);
+			last_error = shard.lastError();
+			last_page = true;
+			return;
+		}
+		fetcher = std::thread(&PagedScan::prefetch, this, reader->endpoint());
+	}
+	lookahead = fetch();
+}
+
+PagedScan::~PagedScan()
+{
+	if (fetcher.joinable()) {
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			stopping = true;
+		}
+		page_taken.notify_all();
+		fetcher.join();
+		prefetchers.fetch_sub(1);
+	}
+}
+
+void PagedScan::setMaxPrefetchers(std::size_t max)
+{
+	max_prefetchers = max;
+}
+
+std::shared_ptr<Iterator> PagedScan::fetchPage(Connection &conn, std::string &error)
+{
+	TupleBuilder key(last_key.empty() ? 0 : 1);
+	if (!last_key.empty()) {
+		key.pushEncoded(last_key.data());
+	}
+	int iterator = last_key.empty() ? ITER_ALL : ITER_GT;
+	int64_t sync = conn.sendSelect(space_id, 0, key, options.page_size, 0, iterator);
+	std::shared_ptr<Iterator> result;
+	if (sync != -1) {
+		result = conn.receiveSelect(sync);
+	}
+	if (!result) {
+		error = "Can't fetch the next page of space " + std::to_string(space_id) +
+			" from " + conn.endpoint();
+		return result;
+	}
+	if (inspectPage(result->encodedTuples(), last_key) < options.page_size) {
+		last_page = true;
+	}
+	return result;
+}
+
+void PagedScan::prefetch(std::string endpoint)
+{
+	Connection conn;
+	conn.connect(endpoint);
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> guard(mutex);
+			page_taken.wait(guard, [this] { return stopping || queue.size() < options.prefetch_depth; });
+			if (stopping) {
+				return;
+			}
+		}
+		// last_key and last_page belong to this thread while it runs
+		std::string error;
+		std::shared_ptr<Iterator> result = fetchPage(conn, error);
+
+		std::lock_guard<std::mutex> guard(mutex);
+		if (result) {
+			queue.push_back(result);
+		}
+		if (!result || last_page) {
+			fetcher_error = error;
+			fetcher_done = true;
+			page_ready.notify_one();
+			return;
+		}
+		page_ready.notify_one();
+	}
+}
+
+std::shared_ptr<Iterator> PagedScan::nextPage()
+{
+	if (fetcher.joinable()) {
+		std::unique_lock<std::mutex> guard(mutex);
+		if (queue.empty() && !fetcher_done) {
+			Probes::stage(Probes::STAGE_WAITING);
+		}
+		page_ready.wait(guard, [this] { return !queue.empty() || fetcher_done; });
+		Probes::stage(Probes::STAGE_CONVERTING);
+		if (queue.empty()) {
+			last_error = fetcher_error;
+			return std::shared_ptr<Iterator>();
+		}
+		std::shared_ptr<Iterator> result = queue.front();
+		queue.pop_front();
+		page_taken.notify_one();
+		return result;
+	}
+
+	if (last_page) {
+		return std::shared_ptr<Iterator>();
+	}
+	Connection *conn = shard.reader(read_options);
+	if (!conn) {
+		last_error = shard.lastError();
+		return std::shared_ptr<Iterator>();
+	}
+	ReplicaSet::Request request(shard, conn);
+	std::shared_ptr<Iterator> result = fetchPage(*conn, last_error);
+	if (!result) {
+		shard.failed(conn, read_options);
+	}
+	// the reply left the stage at decoding, the caller converts the page's rows
+	Probes::stage(Probes::STAGE_CONVERTING);
+	return result;
+}
+
+std::shared_ptr<Row> PagedScan::fetch()
+{
+	for (;;) {
+		if (page && *page) {
+			return page->nextRow();
+		}
+		page = nextPage();
+		if (!page) {
+			return std::shared_ptr<Row>();
+		}
+	}
+}
+
+std::shared_ptr<Row> PagedScan::nextRow()
+{
+	std::shared_ptr<Row> row = lookahead;
+	if (row) {
+		// the row points into its page's reply, which the lookahead may drop
+		returned_page = page;
+		lookahead = fetch();
+	}
+	return row;
+}
+
+PagedScan::operator bool() const
+{
+	return lookahead != nullptr;
+}
+
+const std::string &PagedScan::lastError() const
+{
+	return last_error;
+}
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "iterator.h"
+#include "replica_set.h"
+
+namespace tnt {
+
+/**
+ * Full scan of one shard fetched in pages of the primary index: the first
+ * page is an ALL select, every next one a GT select from the first field of
+ * the last tuple, so no page is ever returned twice and a single reply never
+ * holds the whole space.
+ *
+ * With a prefetch depth, a helper thread on its own connection fetches up
+ * to that many pages ahead while the caller decodes the current one, so a
+ * scan takes about max(network, CPU) instead of their sum. Without it the
+ * pages are fetched through the replica set when the previous one runs out.
+ * Since every helper costs a thread and a connection, only
+ * setMaxPrefetchers() scans in the process read ahead at once; the others
+ * fetch on demand.
+ */
+class PagedScan: public Iterator
+{
+public:
+	struct options_t {
+		uint32_t page_size = 1000;
+		std::size_t prefetch_depth = 0;   // pages fetched ahead, 0 to fetch on demand
+	};
+
+	PagedScan(ReplicaSet &shard, int space_id, const ReplicaSet::read_options_t &read_options,
+			const options_t &options);
+	~PagedScan();
+
+	static void setMaxPrefetchers(std::size_t max);
+
+	std::shared_ptr<Row> nextRow() override;
+	operator bool() const override;
+	/// Set when the scan stopped because a page couldn't be fetched
+	const std::string &lastError() const override;
+private:
+	ReplicaSet &shard;
+	int space_id;
+	ReplicaSet::read_options_t read_options;
+	options_t options;
+
+	std::shared_ptr<Iterator> page;
+	std::shared_ptr<Iterator> returned_page; // holds the data of the row last returned
+	std::shared_ptr<Row> lookahead;
+	std::string last_key;     // encoded first field of the last tuple fetched
+	bool last_page = false;
+	std::string last_error;
+
+	// read-ahead state, guarded by mutex
+	std::mutex mutex;
+	std::condition_variable page_ready;
+	std::condition_variable page_taken;
+	std::deque<std::shared_ptr<Iterator>> queue;
+	bool fetcher_done = false;
+	bool stopping = false;
+	std::string fetcher_error;
+	std::thread fetcher;
+
+	std::shared_ptr<Iterator> fetchPage(Connection &conn, std::string &error);
+	std::shared_ptr<Iterator> nextPage();
+	void prefetch(std::string endpoint);
+	std::shared_ptr<Row> fetch();
+};
+
+}
@@ -0,0 +1,47 @@
+#include "probes.h"
+
+namespace tnt {
+
+std::atomic<const Probes::hooks_t*> Probes::hooks(nullptr);
+
+void Probes::install(const hooks_t *installed)
+{
+	hooks.store(installed, std::memory_order_release);
+}
+
+void *Probes::socketOpen(int fd)
+{
+	const hooks_t *h = hooks.load(std::memory_order_acquire);
+	return h ? h->socket_open(fd) : nullptr;
+}
+
+void Probes::socketClose(void *socket)
+{
+	const hooks_t *h = hooks.load(std::memory_order_acquire);
+	if (h && socket) {
+		h->socket_close(socket);
+	}
+}
+
+Probes::Io::Io(void *socket, io_t io):
+	installed(socket ? hooks.load(std::memory_order_relaxed) : nullptr)
+{
+	if (installed) {
+		token = installed->io_start(socket, io, state);
+	}
+}
+
+Probes::Io::~Io()
+{
+	done(0);
+}
+
+void Probes::Io::done(std::size_t bytes)
+{
+	if (token) {
+		installed->io_end(token, bytes);
+		token = nullptr;
+	}
+}
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace tnt {
+
+/**
+ * Hooks through which the engine reports where a request spends its time,
+ * e.g. to performance_schema. Until hooks are installed every probe is a
+ * single load of a null pointer.
+ */
+class Probes
+{
+public:
+	enum stage_t {
+		STAGE_ENCODING,
+		STAGE_WAITING,    // for Tarantool: socket I/O or the I/O thread
+		STAGE_DECODING,
+		STAGE_CONVERTING, // rows into MySQL records
+		STAGES_NUMBER
+	};
+	enum io_t {
+		IO_SEND,
+		IO_RECEIVE
+	};
+	/// Bytes of per-wait state the hooks may use, see Io
+	static const std::size_t state_size = 256;
+
+	struct hooks_t {
+		void (*stage)(stage_t stage);
+		/// Handle of a connection's socket; fd is -1 when an I/O thread owns it
+		void *(*socket_open)(int fd);
+		void (*socket_close)(void *socket);
+		/// Token handed to io_end(), may be nullptr when the wait isn't timed
+		void *(*io_start)(void *socket, io_t io, void *state);
+		void (*io_end)(void *token, std::size_t bytes);
+	};
+
+	/// The hooks must outlive every connection; nullptr uninstalls them
+	static void install(const hooks_t *hooks);
+
+	static void stage(stage_t stage)
+	{
+		const hooks_t *h = hooks.load(std::memory_order_relaxed);
+		if (h) {
+			h->stage(stage);
+		}
+	}
+	static void *socketOpen(int fd);
+	static void socketClose(void *socket);
+
+	/// Times one send or receive on a socket until done() or destruction
+	class Io {
+	public:
+		Io(void *socket, io_t io);
+		~Io();
+		void done(std::size_t bytes);
+	private:
+		const hooks_t *installed;
+		void *token = nullptr;
+		alignas(16) char state[state_size];
+	};
+private:
+	static std::atomic<const hooks_t*> hooks;
+};
+
+}
@@ -0,0 +1,372 @@
+#include "replica_set.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+
+#include <errno.h>
+#include <poll.h>
+
+#include "connection.h"
+#include "hedging.h"
+#include "iterator.h"
+#include "session.h"
+#include "tuple_builder.h"
+
+namespace tnt {
+
+namespace {
+
+int64_t nowMs()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+}
+
+int64_t nowUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+}
+
+std::mutex registry_mutex;
+std::map<std::string, std::shared_ptr<EndpointState>> registry;
+
+}
+
+EndpointState::EndpointState(const std::string &uri):
+	uri(uri),
+	outstanding(0),
+	down_until_ms(0),
+	lag_checked_ms(0),
+	lag(0)
+{
+}
+
+std::shared_ptr<EndpointState> EndpointState::get(const std::string &uri)
+{
+	std::lock_guard<std::mutex> guard(registry_mutex);
+	auto &state = registry[uri];
+	if (!state) {
+		state = std::make_shared<EndpointState>(uri);
+	}
+	return state;
+}
+
+int64_t EndpointState::downForMs() const
+{
+	return std::max<int64_t>(down_until_ms.load(std::memory_order_relaxed) - nowMs(), 0);
+}
+
+std::vector<std::shared_ptr<EndpointState>> EndpointState::all()
+{
+	std::vector<std::shared_ptr<EndpointState>> states;
+	std::lock_guard<std::mutex> guard(registry_mutex);
+	for (const auto &state: registry) {
+		states.push_back(state.second);
+	}
+	return states;
+}
+
+ReplicaSet::Request::Request(ReplicaSet &set, Connection *conn)
+{
+	member_t *member = set.memberOf(conn);
+	if (member) {
+		state = member->state;
+		state->outstanding.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+ReplicaSet::Request::~Request()
+{
+	if (state) {
+		state->outstanding.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
+
+ReplicaSet::ReplicaSet(const std::vector<std::string> &uris)
+{
+	for (const auto &uri: uris) {
+		member_t member;
+		member.state = EndpointState::get(uri);
+		member.own.reset(new Connection);
+		member.connection = member.own.get();
+		members.push_back(std::move(member));
+	}
+}
+
+void ReplicaSet::bind(Session *session)
+{
+	for (auto &member: members) {
+		member.connection = session ?
+			session->connection(member.state->uri) : member.own.get();
+	}
+}
+
+ReplicaSet::~ReplicaSet()
+{
+}
+
+std::size_t ReplicaSet::size() const
+{
+	return members.size();
+}
+
+const std::string &ReplicaSet::masterEndpoint() const
+{
+	static const std::string none;
+	return members.empty() ? none : members[0].state->uri;
+}
+
+const std::string &ReplicaSet::lastError() const
+{
+	return last_error;
+}
+
+Connection *ReplicaSet::connectMember(member_t &member, const read_options_t &options)
+{
+	if (member.connection->connected()) {
+		return member.connection;
+	}
+	member.connection->connect(member.state->uri);
+	if (!member.connection->connected()) {
+		last_error = member.state->uri + ": " + member.connection->lastError();
+		member.state->down_until_ms = nowMs() + options.retry_interval_ms;
+		return nullptr;
+	}
+	member.state->down_until_ms = 0;
+	return member.connection;
+}
+
+void ReplicaSet::refreshLag(member_t &member, const read_options_t &options)
+{
+	int64_t now = nowMs();
+	if (now - member.state->lag_checked_ms < options.lag_check_interval_ms) {
+		return;
+	}
+	// one session per interval does the check, the rest use its result
+	int64_t checked = member.state->lag_checked_ms;
+	if (!member.state->lag_checked_ms.compare_exchange_strong(checked, now)) {
+		return;
+	}
+	double lag = 0;
+	if (member.connection->replicationLag(lag)) {
+		member.state->lag = lag;
+	} else if (!member.connection->connected()) {
+		member.state->down_until_ms = now + options.retry_interval_ms;
+	}
+}
+
+ReplicaSet::member_t *ReplicaSet::memberOf(Connection *conn)
+{
+	for (auto &member: members) {
+		if (member.connection == conn) {
+			return &member;
+		}
+	}
+	return nullptr;
+}
+
+Connection *ReplicaSet::master()
+{
+	last_error.clear();
+	if (members.empty()) {
+		last_error = "No Tarantool endpoints configured";
+		return nullptr;
+	}
+	// writes must not be routed elsewhere, so don't honour down_until here
+	return connectMember(members[0], read_options_t());
+}
+
+Connection *ReplicaSet::reader(const read_options_t &options)
+{
+	last_error.clear();
+	if (members.empty()) {
+		last_error = "No Tarantool endpoints configured";
+		return nullptr;
+	}
+	if (!options.use_replicas || members.size() == 1) {
+		return connectMember(members[0], options);
+	}
+
+	int64_t now = nowMs();
+	std::vector<member_t*> candidates;
+	for (std::size_t i = 1; i < members.size(); ++i) {
+		if (members[i].state->down_until_ms <= now) {
+			candidates.push_back(&members[i]);
+		}
+	}
+	// least outstanding requests first; stable, so ties keep config order
+	std::stable_sort(candidates.begin(), candidates.end(),
+			[](const member_t *a, const member_t *b) {
+				return a->state->outstanding.load(std::memory_order_relaxed) <
+					b->state->outstanding.load(std::memory_order_relaxed);
+			}
+		);
+
+	for (member_t *member: candidates) {
+		Connection *conn = connectMember(*member, options);
+		if (!conn) {
+			continue;
+		}
+		refreshLag(*member, options);
+		if (!conn->connected() || member->state->lag > options.max_lag) {
+			continue;
+		}
+		return conn;
+	}
+	return connectMember(members[0], options);
+}
+
+void ReplicaSet::failed(Connection *conn, const read_options_t &options)
+{
+	member_t *member = memberOf(conn);
+	if (member) {
+		member->state->down_until_ms = nowMs() + options.retry_interval_ms;
+	}
+}
+
+std::shared_ptr<Iterator> ReplicaSet::select(int space_id, int index_id, const TupleBuilder &key,
+		int iterator, const read_options_t &options, uint32_t limit)
+{
+	for (std::size_t attempt = 0; attempt < members.size(); ++attempt) {
+		Connection *conn = reader(options);
+		if (!conn) {
+			return std::shared_ptr<Iterator>();
+		}
+		std::shared_ptr<Iterator> result;
+		{
+			Request request(*this, conn);
+			int64_t sync = conn->sendSelect(space_id, index_id, key, limit, 0, iterator);
+			if (sync != -1) {
+				result = conn->receiveSelect(sync);
+			}
+		}
+		if (result || conn->connected()) {
+			// query errors are not retried on another instance
+			if (!result) {
+				last_error = conn->lastError();
+			}
+			return result;
+		}
+		last_error = conn->endpoint() + ": " + conn->lastError();
+		failed(conn, options);
+	}
+	return std::shared_ptr<Iterator>();
+}
+
+Connection *ReplicaSet::hedgeTarget(Connection *primary, const read_options_t &options)
+{
+	int64_t now = nowMs();
+	member_t *best = nullptr;
+	for (auto &member: members) {
+		if (member.connection == primary || member.state->down_until_ms > now) {
+			continue;
+		}
+		if (&member != &members[0] && member.state->lag > options.max_lag) {
+			continue;
+		}
+		if (!best || member.state->outstanding.load(std::memory_order_relaxed) <
+				best->state->outstanding.load(std::memory_order_relaxed)) {
+			best = &member;
+		}
+	}
+	return best ? connectMember(*best, options) : nullptr;
+}
+
+std::shared_ptr<Iterator> ReplicaSet::hedgedSelect(int space_id, int index_id, const TupleBuilder &key,
+		int iterator, const read_options_t &options, HedgePolicy &policy,
+		double percentile, uint64_t min_delay_us)
+{
+	Connection *primary = reader(options);
+	if (!primary) {
+		return std::shared_ptr<Iterator>();
+	}
+	if (primary->fd() < 0) {
+		// replies come through the shared I/O thread, there is no socket to poll
+		return select(space_id, index_id, key, iterator, options);
+	}
+	int64_t started_us = nowUs();
+	Request primary_request(*this, primary);
+	int64_t primary_sync = primary->sendSelect(space_id, index_id, key, UINT32_MAX, 0, iterator);
+	if (primary_sync == -1) {
+		failed(primary, options);
+		return select(space_id, index_id, key, iterator, options);
+	}
+
+	Connection *winner = primary;
+	int64_t winner_sync = primary_sync;
+	Connection *loser = nullptr;
+	int64_t loser_sync = -1;
+	std::unique_ptr<Request> secondary_request;
+
+	// round up: a zero delay would hedge every read
+	int delay_ms = static_cast<int>((policy.delayUs(percentile, min_delay_us) + 999) / 1000);
+	if (!primary->waitReply(primary_sync, delay_ms)) {
+		Connection *secondary = hedgeTarget(primary, options);
+		int64_t secondary_sync = -1;
+		if (secondary) {
+			secondary_request.reset(new Request(*this, secondary));
+			secondary_sync = secondary->sendSelect(space_id, index_id, key, UINT32_MAX, 0, iterator);
+		}
+		if (secondary_sync != -1) {
+			policy.hedged();
+			// whichever has its whole reply first wins, readable sockets alone prove nothing
+			int64_t deadline_ms = nowMs() + options.hedge_timeout_ms;
+			bool primary_done = false, secondary_done = false;
+			for (;;) {
+				primary_done = primary->waitReply(primary_sync, 0);
+				secondary_done = !primary_done && secondary->waitReply(secondary_sync, 0);
+				int64_t remaining_ms = deadline_ms - nowMs();
+				if (primary_done || secondary_done || remaining_ms <= 0) {
+					break;
+				}
+				struct pollfd pfds[2] = {
+					{ primary->fd(), POLLIN, 0 },
+					{ secondary->fd(), POLLIN, 0 }
+				};
+				if (poll(pfds, 2, static_cast<int>(remaining_ms)) < 0 && errno != EINTR) {
+					break;
+				}
+			}
+			if (!primary_done && !secondary_done) {
+				primary->discardReply(primary_sync);
+				secondary->discardReply(secondary_sync);
+				last_error = "Hedged read timed out on " + primary->endpoint() + " and " +
+					secondary->endpoint();
+				return std::shared_ptr<Iterator>();
+			}
+			if (secondary_done) {
+				policy.won();
+				winner = secondary;
+				winner_sync = secondary_sync;
+				loser = primary;
+				loser_sync = primary_sync;
+			} else {
+				loser = secondary;
+				loser_sync = secondary_sync;
+			}
+		}
+	}
+
+	auto result = winner->receiveSelect(winner_sync);
+	if (!result && !winner->connected() && loser) {
+		// the faster instance broke down, the slower one is still due to answer
+		last_error = winner->endpoint() + ": " + winner->lastError();
+		failed(winner, options);
+		result = loser->receiveSelect(loser_sync);
+	} else if (loser) {
+		loser->discardReply(loser_sync);
+	}
+	if (result) {
+		policy.record(static_cast<uint64_t>(nowUs() - started_us));
+	} else {
+		last_error = winner->lastError();
+	}
+	return result;
+}
+
+}
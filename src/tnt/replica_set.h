@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace tnt {
+
+class Connection;
+class HedgePolicy;
+class Iterator;
+class Session;
+class TupleBuilder;
+
+/**
+ * Health and load of one Tarantool instance, shared by every handler in the
+ * process that talks to it.
+ */
+struct EndpointState {
+	std::string uri;
+	std::atomic<int> outstanding;       // requests currently in flight
+	std::atomic<int64_t> down_until_ms; // don't try before this moment
+	std::atomic<int64_t> lag_checked_ms;
+	std::atomic<double> lag;            // seconds behind the master
+
+	explicit EndpointState(const std::string &uri);
+	static std::shared_ptr<EndpointState> get(const std::string &uri);
+	/// How long the endpoint is still skipped for, 0 while it is up
+	int64_t downForMs() const;
+	/// Every endpoint the process has talked to
+	static std::vector<std::shared_ptr<EndpointState>> all();
+};
+
+/**
+ * A master and its read replicas. Writes go to the first endpoint; reads go
+ * to the replica with the fewest outstanding requests among those lagging no
+ * more than max_lag, and fail over to the next candidate (and finally the
+ * master) when an instance is unreachable.
+ */
+class ReplicaSet
+{
+public:
+	struct read_options_t {
+		bool use_replicas = true;
+		double max_lag = 1.0;              // seconds
+		int64_t retry_interval_ms = 1000;  // how long a failed endpoint is skipped
+		int64_t lag_check_interval_ms = 1000;
+		int64_t hedge_timeout_ms = 30000;  // how long a hedged read waits for either reply
+	};
+
+	/// Counts a request as outstanding on the endpoint for its lifetime
+	class Request {
+	public:
+		Request(ReplicaSet &set, Connection *conn);
+		~Request();
+	private:
+		std::shared_ptr<EndpointState> state;
+	};
+
+	explicit ReplicaSet(const std::vector<std::string> &uris);
+	~ReplicaSet();
+
+	std::size_t size() const;
+	const std::string &masterEndpoint() const;
+
+	/// Borrow the session's connections; nullptr returns to the set's own ones
+	void bind(Session *session);
+
+	/// Connected master or nullptr, see lastError()
+	Connection *master();
+	/// Least loaded acceptable replica; the master if there is none
+	Connection *reader(const read_options_t &options);
+	/// Marks the connection's endpoint as down after a transport error
+	void failed(Connection *conn, const read_options_t &options);
+
+	/// Select with failover across readers
+	std::shared_ptr<Iterator> select(int space_id, int index_id, const TupleBuilder &key,
+			int iterator, const read_options_t &options, uint32_t limit = UINT32_MAX);
+
+	/**
+	 * Point read that is repeated on a second instance if the first one
+	 * hasn't answered within the policy's delay; the first whole reply wins
+	 * and the other one is discarded when it arrives. Fails after
+	 * options.hedge_timeout_ms without either. Connections of the I/O
+	 * threads have no socket to wait on, so it is a plain select there.
+	 */
+	std::shared_ptr<Iterator> hedgedSelect(int space_id, int index_id, const TupleBuilder &key,
+			int iterator, const read_options_t &options, HedgePolicy &policy,
+			double percentile, uint64_t min_delay_us);
+
+	const std::string &lastError() const;
+private:
+	struct member_t {
+		std::shared_ptr<EndpointState> state;
+		std::unique_ptr<Connection> own; // used while no session is bound
+		Connection *connection;
+	};
+	std::vector<member_t> members;
+	std::string last_error;
+
+	Connection *connectMember(member_t &member, const read_options_t &options);
+	void refreshLag(member_t &member, const read_options_t &options);
+	member_t *memberOf(Connection *conn);
+	Connection *hedgeTarget(Connection *primary, const read_options_t &options);
+};
+
+}
@@ -1,4 +1,6 @@
+#include <cassert>
 #include <cstdint>
+#include <stdexcept>
 #include <string>
 #include <iostream>
 
@@ -0,0 +1,201 @@
+#include "row_cache.h"
+
+#include <chrono>
+#include <functional>
+
+#include <msgpuck.h>
+
+namespace tnt {
+
+namespace {
+
+int64_t nowUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+}
+
+std::atomic<uint64_t> total_hits(0);
+std::atomic<uint64_t> total_misses(0);
+std::atomic<std::size_t> total_bytes(0);
+
+}
+
+RowCache::RowCache():
+	used_bytes(0),
+	hits(0),
+	misses(0)
+{
+}
+
+RowCache::~RowCache()
+{
+	total_bytes.fetch_sub(used_bytes.load(), std::memory_order_relaxed);
+}
+
+std::string RowCache::keyOf(int space_id, const char *tuple)
+{
+	std::string key(reinterpret_cast<const char*>(&space_id), sizeof space_id);
+	if (mp_typeof(*tuple) != MP_ARRAY || mp_decode_array(&tuple) == 0) {
+		return key;
+	}
+	// lookups send the key as a one-field array, so encode it the same way
+	char header[8];
+	key.append(header, mp_encode_array(header, 1) - header);
+	const char *end = tuple;
+	mp_next(&end);
+	key.append(tuple, end - tuple);
+	return key;
+}
+
+RowCache::shard_t &RowCache::shardOf(const std::string &key)
+{
+	return shards[std::hash<std::string>()(key) % shards_number];
+}
+
+bool RowCache::find(const std::string &key, uint64_t ttl_us, std::string &tuples)
+{
+	shard_t &shard = shardOf(key);
+	std::lock_guard<std::mutex> guard(shard.mutex);
+	auto found = shard.index.find(key);
+	if (found != shard.index.end()) {
+		entry_t &entry = shard.slots[found->second];
+		if (static_cast<uint64_t>(nowUs() - entry.stored_us) <= ttl_us) {
+			entry.referenced = true;
+			tuples = entry.tuples;
+			hits.fetch_add(1, std::memory_order_relaxed);
+			total_hits.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+		evict(shard, found->second);
+	}
+	misses.fetch_add(1, std::memory_order_relaxed);
+	total_misses.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+uint64_t RowCache::generation(const std::string &key)
+{
+	shard_t &shard = shardOf(key);
+	std::lock_guard<std::mutex> guard(shard.mutex);
+	return shard.generation;
+}
+
+void RowCache::store(const std::string &key, const std::string &tuples,
+		uint64_t generation, std::size_t capacity_bytes)
+{
+	std::size_t size = key.size() + tuples.size();
+	std::size_t shard_capacity = capacity_bytes / shards_number;
+	if (size > shard_capacity) {
+		return;
+	}
+	shard_t &shard = shardOf(key);
+	std::lock_guard<std::mutex> guard(shard.mutex);
+	if (shard.generation != generation) {
+		return; // the key may have been written while it was being read
+	}
+	auto found = shard.index.find(key);
+	if (found != shard.index.end()) {
+		evict(shard, found->second);
+	}
+	while (shard.bytes + size > shard_capacity && evictOne(shard)) {
+	}
+
+	std::size_t slot;
+	if (shard.free_slots.empty()) {
+		slot = shard.slots.size();
+		shard.slots.emplace_back();
+	} else {
+		slot = shard.free_slots.back();
+		shard.free_slots.pop_back();
+	}
+	entry_t &entry = shard.slots[slot];
+	entry.key = key;
+	entry.tuples = tuples;
+	entry.stored_us = nowUs();
+	entry.referenced = false;
+	entry.used = true;
+	shard.index[key] = slot;
+	shard.bytes += size;
+	used_bytes.fetch_add(size, std::memory_order_relaxed);
+	total_bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+void RowCache::invalidate(const std::string &key)
+{
+	shard_t &shard = shardOf(key);
+	std::lock_guard<std::mutex> guard(shard.mutex);
+	++shard.generation;
+	auto found = shard.index.find(key);
+	if (found != shard.index.end()) {
+		evict(shard, found->second);
+	}
+}
+
+void RowCache::evict(shard_t &shard, std::size_t slot)
+{
+	entry_t &entry = shard.slots[slot];
+	std::size_t size = entry.key.size() + entry.tuples.size();
+	shard.index.erase(entry.key);
+	shard.bytes -= size;
+	used_bytes.fetch_sub(size, std::memory_order_relaxed);
+	total_bytes.fetch_sub(size, std::memory_order_relaxed);
+	entry = entry_t();
+	shard.free_slots.push_back(slot);
+}
+
+bool RowCache::evictOne(shard_t &shard)
+{
+	if (shard.index.empty()) {
+		return false;
+	}
+	// at most two sweeps: the first one may only clear reference bits
+	for (std::size_t step = 0; step < 2 * shard.slots.size(); ++step) {
+		std::size_t slot = shard.hand;
+		shard.hand = (shard.hand + 1) % shard.slots.size();
+		entry_t &entry = shard.slots[slot];
+		if (!entry.used) {
+			continue;
+		}
+		if (entry.referenced) {
+			entry.referenced = false;
+			continue;
+		}
+		evict(shard, slot);
+		return true;
+	}
+	return false;
+}
+
+std::size_t RowCache::bytes() const
+{
+	return used_bytes.load(std::memory_order_relaxed);
+}
+
+uint64_t RowCache::hitCount() const
+{
+	return hits.load(std::memory_order_relaxed);
+}
+
+uint64_t RowCache::missCount() const
+{
+	return misses.load(std::memory_order_relaxed);
+}
+
+uint64_t RowCache::totalHits()
+{
+	return total_hits.load(std::memory_order_relaxed);
+}
+
+uint64_t RowCache::totalMisses()
+{
+	return total_misses.load(std::memory_order_relaxed);
+}
+
+std::size_t RowCache::totalBytes()
+{
+	return total_bytes.load(std::memory_order_relaxed);
+}
+
+}
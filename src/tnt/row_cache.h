@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tnt {
+
+/**
+ * Encoded select results of primary key lookups of one table.
+ *
+ * The cache is split into shards with a lock each and bounded by the bytes
+ * of keys and values; when a shard is full, a CLOCK hand evicts entries not
+ * looked up since it last passed them. Entries expire after a TTL given at
+ * lookup, and the engine drops a key whenever it writes it. A lookup that
+ * raced with such a write is not stored: store() compares the shard's
+ * write generation with the one taken before the request was sent.
+ */
+class RowCache
+{
+public:
+	RowCache();
+	~RowCache();
+
+	/// Cache key for the first field of a msgpack tuple or key
+	static std::string keyOf(int space_id, const char *tuple);
+
+	bool find(const std::string &key, uint64_t ttl_us, std::string &tuples);
+	/// Write generation to hand to store() once the lookup completes
+	uint64_t generation(const std::string &key);
+	void store(const std::string &key, const std::string &tuples,
+			uint64_t generation, std::size_t capacity_bytes);
+	void invalidate(const std::string &key);
+
+	std::size_t bytes() const;
+	uint64_t hitCount() const;
+	uint64_t missCount() const;
+	/// Across all tables
+	static uint64_t totalHits();
+	static uint64_t totalMisses();
+	static std::size_t totalBytes();
+private:
+	struct entry_t {
+		std::string key;
+		std::string tuples;
+		int64_t stored_us = 0;
+		bool referenced = false;
+		bool used = false;
+	};
+	struct shard_t {
+		std::mutex mutex;
+		std::vector<entry_t> slots;
+		std::vector<std::size_t> free_slots;
+		std::unordered_map<std::string, std::size_t> index;
+		std::size_t hand = 0;
+		std::size_t bytes = 0;
+		uint64_t generation = 0;
+	};
+	static const int shards_number = 16;
+	shard_t shards[shards_number];
+	std::atomic<std::size_t> used_bytes;
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> misses;
+
+	shard_t &shardOf(const std::string &key);
+	void evict(shard_t &shard, std::size_t slot);
+	bool evictOne(shard_t &shard);
+};
+
+}
@@ -0,0 +1,303 @@
+#include "schema_cache.h"
+
+#include <msgpuck.h>
+
+namespace tnt {
+
+namespace {
+
+std::string decodeString(const char *&p)
+{
+	if (mp_typeof(*p) != MP_STR) {
+		mp_next(&p);
+		return std::string();
+	}
+	uint32_t len = 0;
+	const char *data = mp_decode_str(&p, &len);
+	return std::string(data, len);
+}
+
+bool decodeUint(const char *&p, uint64_t &value)
+{
+	if (mp_typeof(*p) != MP_UINT) {
+		mp_next(&p);
+		return false;
+	}
+	value = mp_decode_uint(&p);
+	return true;
+}
+
+// format: [{name = 'id', type = 'unsigned'}, ...]
+void decodeFormat(const char *&p, std::vector<FieldFormat> &format)
+{
+	if (mp_typeof(*p) != MP_ARRAY) {
+		mp_next(&p);
+		return;
+	}
+	uint32_t fields_number = mp_decode_array(&p);
+	format.reserve(fields_number);
+	for (uint32_t i = 0; i < fields_number; ++i) {
+		FieldFormat field;
+		if (mp_typeof(*p) != MP_MAP) {
+			mp_next(&p);
+			format.push_back(field);
+			continue;
+		}
+		uint32_t keys_number = mp_decode_map(&p);
+		for (uint32_t k = 0; k < keys_number; ++k) {
+			const std::string &key = decodeString(p);
+			if (key == "name") {
+				field.name = decodeString(p);
+			} else if (key == "type") {
+				field.type = decodeString(p);
+			} else {
+				mp_next(&p);
+			}
+		}
+		format.push_back(field);
+	}
+}
+
+// parts: [[0, 'unsigned'], ...] (1.6) or [{field = 0, type = 'unsigned'}, ...] (1.7+)
+void decodeParts(const char *&p, std::vector<uint32_t> &parts)
+{
+	if (mp_typeof(*p) != MP_ARRAY) {
+		mp_next(&p);
+		return;
+	}
+	uint32_t parts_number = mp_decode_array(&p);
+	for (uint32_t i = 0; i < parts_number; ++i) {
+		uint64_t field_no = 0;
+		if (mp_typeof(*p) == MP_ARRAY) {
+			uint32_t elements = mp_decode_array(&p);
+			for (uint32_t e = 0; e < elements; ++e) {
+				if (e == 0) {
+					decodeUint(p, field_no);
+				} else {
+					mp_next(&p);
+				}
+			}
+		} else if (mp_typeof(*p) == MP_MAP) {
+			uint32_t keys_number = mp_decode_map(&p);
+			for (uint32_t k = 0; k < keys_number; ++k) {
+				if (decodeString(p) == "field") {
+					decodeUint(p, field_no);
+				} else {
+					mp_next(&p);
+				}
+			}
+		} else {
+			mp_next(&p);
+		}
+		parts.push_back(static_cast<uint32_t>(field_no));
+	}
+}
+
+}
+
+int SpaceInfo::indexId(const std::string &index_name) const
+{
+	for (const auto &index: indexes) {
+		if (index.name == index_name) {
+			return index.id;
+		}
+	}
+	return -1;
+}
+
+const IndexInfo *SpaceInfo::index(int index_id) const
+{
+	for (const auto &index: indexes) {
+		if (index.id == index_id) {
+			return &index;
+		}
+	}
+	return nullptr;
+}
+
+// _vspace: [id, owner, name, engine, field_count, flags, format]
+bool decodeSpaceTuple(const char *p, SpaceInfo &space)
+{
+	if (mp_typeof(*p) != MP_ARRAY) {
+		return false;
+	}
+	uint32_t fields_number = mp_decode_array(&p);
+	if (fields_number < 3) {
+		return false;
+	}
+	uint64_t id = 0;
+	for (uint32_t i = 0; i < fields_number; ++i) {
+		switch (i) {
+		case 0:
+			if (!decodeUint(p, id)) {
+				return false;
+			}
+			space.id = static_cast<int>(id);
+			break;
+		case 2:
+			space.name = decodeString(p);
+			break;
+		case 6:
+			decodeFormat(p, space.format);
+			break;
+		default:
+			mp_next(&p);
+		}
+	}
+	return true;
+}
+
+// _vindex: [space_id, index_id, name, type, opts, parts]
+bool decodeIndexTuple(const char *p, IndexInfo &index)
+{
+	if (mp_typeof(*p) != MP_ARRAY) {
+		return false;
+	}
+	uint32_t fields_number = mp_decode_array(&p);
+	if (fields_number < 3) {
+		return false;
+	}
+	uint64_t id = 0;
+	for (uint32_t i = 0; i < fields_number; ++i) {
+		switch (i) {
+		case 1:
+			if (!decodeUint(p, id)) {
+				return false;
+			}
+			index.id = static_cast<int>(id);
+			break;
+		case 2:
+			index.name = decodeString(p);
+			break;
+		case 5:
+			decodeParts(p, index.parts);
+			break;
+		default:
+			mp_next(&p);
+		}
+	}
+	return true;
+}
+
+SchemaCache::SchemaCache():
+	endpoints(std::make_shared<endpoints_t>()),
+	reload_count(0)
+{
+}
+
+SchemaCache &SchemaCache::instance()
+{
+	static SchemaCache cache;
+	return cache;
+}
+
+std::shared_ptr<SchemaCache::Endpoint> SchemaCache::endpoint(const std::string &name) const
+{
+	auto all = std::atomic_load(&endpoints);
+	auto it = all->find(name);
+	if (it == all->end()) {
+		return std::shared_ptr<Endpoint>();
+	}
+	return it->second;
+}
+
+// write_mutex must be held
+std::shared_ptr<SchemaCache::Endpoint> SchemaCache::endpointForUpdate(const std::string &name)
+{
+	auto result = endpoint(name);
+	if (result) {
+		return result;
+	}
+	result = std::make_shared<Endpoint>();
+	result->snapshot = std::make_shared<Snapshot>();
+
+	auto updated = std::make_shared<endpoints_t>(*std::atomic_load(&endpoints));
+	(*updated)[name] = result;
+	std::atomic_store(&endpoints, std::shared_ptr<const endpoints_t>(updated));
+	return result;
+}
+
+std::shared_ptr<const SpaceInfo> SchemaCache::find(const std::string &endpoint_name, const std::string &space) const
+{
+	auto e = endpoint(endpoint_name);
+	if (!e) {
+		return std::shared_ptr<const SpaceInfo>();
+	}
+	auto snapshot = std::atomic_load(&e->snapshot);
+	auto it = snapshot->spaces.find(space);
+	if (it == snapshot->spaces.end()) {
+		return std::shared_ptr<const SpaceInfo>();
+	}
+	return it->second;
+}
+
+std::vector<SchemaCache::endpoint_status_t> SchemaCache::status() const
+{
+	std::vector<endpoint_status_t> all;
+	for (const auto &e: *std::atomic_load(&endpoints)) {
+		auto snapshot = std::atomic_load(&e.second->snapshot);
+		all.push_back({e.first, snapshot->version, snapshot->spaces.size()});
+	}
+	return all;
+}
+
+uint64_t SchemaCache::version(const std::string &endpoint_name) const
+{
+	auto e = endpoint(endpoint_name);
+	if (!e) {
+		return 0;
+	}
+	return std::atomic_load(&e->snapshot)->version;
+}
+
+void SchemaCache::store(const std::string &endpoint_name, uint64_t schema_version, std::shared_ptr<const SpaceInfo> space)
+{
+	std::lock_guard<std::mutex> guard(write_mutex);
+
+	auto e = endpointForUpdate(endpoint_name);
+	auto current = std::atomic_load(&e->snapshot);
+	if (schema_version < current->version) {
+		return; // fetched before a change another session has already seen
+	}
+	std::shared_ptr<Snapshot> updated;
+	if (current->version == schema_version) {
+		updated = std::make_shared<Snapshot>(*current);
+	} else {
+		// the space was fetched under another version: start over from it
+		updated = std::make_shared<Snapshot>();
+		updated->version = schema_version;
+	}
+	updated->spaces[space->name] = space;
+	std::atomic_store(&e->snapshot, std::shared_ptr<const Snapshot>(updated));
+}
+
+void SchemaCache::observe(const std::string &endpoint_name, uint64_t schema_version)
+{
+	if (schema_version == 0) {
+		return; // server doesn't report it
+	}
+	auto e = endpoint(endpoint_name);
+	if (e && std::atomic_load(&e->snapshot)->version == schema_version) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> guard(write_mutex);
+	e = endpointForUpdate(endpoint_name);
+	auto current = std::atomic_load(&e->snapshot);
+	if (current->version == schema_version) {
+		return;
+	}
+	if (!current->spaces.empty()) {
+		reload_count.fetch_add(1, std::memory_order_relaxed);
+	}
+	auto updated = std::make_shared<Snapshot>();
+	updated->version = schema_version;
+	std::atomic_store(&e->snapshot, std::shared_ptr<const Snapshot>(updated));
+}
+
+uint64_t SchemaCache::reloads() const
+{
+	return reload_count.load(std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tnt {
+
+struct FieldFormat {
+	std::string name;
+	std::string type;
+};
+
+struct IndexInfo {
+	int id;
+	std::string name;
+	std::vector<uint32_t> parts; // zero-based field numbers
+};
+
+struct SpaceInfo {
+	int id = -1;
+	std::string name;
+	std::vector<FieldFormat> format;
+	std::vector<IndexInfo> indexes;
+
+	/// -1 if the space has no index with this name
+	int indexId(const std::string &index_name) const;
+	const IndexInfo *index(int index_id) const;
+};
+
+/// Decoders for tuples of the _vspace and _vindex system views
+bool decodeSpaceTuple(const char *tuple, SpaceInfo &space);
+bool decodeIndexTuple(const char *tuple, IndexInfo &index);
+
+/**
+ * Process-wide cache of Tarantool space and index definitions, one per
+ * endpoint (host:port).
+ *
+ * Readers copy the pointer to an immutable snapshot with std::atomic_load,
+ * which takes a short internal lock rather than being lock-free, but never
+ * wait while a writer builds the next snapshot. Every reply carries the
+ * server's schema_version; when it differs from the snapshot, the snapshot
+ * is dropped and spaces are re-fetched one at a time on their next lookup
+ * instead of reloading the whole catalogue.
+ */
+class SchemaCache
+{
+public:
+	static SchemaCache &instance();
+
+	/// nullptr if the space has not been fetched under the current version
+	std::shared_ptr<const SpaceInfo> find(const std::string &endpoint, const std::string &space) const;
+
+	/// 0 until the first reply from the endpoint has been seen
+	uint64_t version(const std::string &endpoint) const;
+
+	void store(const std::string &endpoint, uint64_t schema_version, std::shared_ptr<const SpaceInfo> space);
+
+	/// Called for every reply; cheap when the version is unchanged.
+	void observe(const std::string &endpoint, uint64_t schema_version);
+
+	/// Number of times a version change invalidated an endpoint's snapshot
+	uint64_t reloads() const;
+
+	struct endpoint_status_t {
+		std::string endpoint;
+		uint64_t version;
+		std::size_t spaces; // fetched under that version
+	};
+	std::vector<endpoint_status_t> status() const;
+private:
+	struct Snapshot {
+		uint64_t version = 0;
+		std::map<std::string, std::shared_ptr<const SpaceInfo>> spaces;
+	};
+	struct Endpoint {
+		std::shared_ptr<const Snapshot> snapshot;
+	};
+	using endpoints_t = std::map<std::string, std::shared_ptr<Endpoint>>;
+
+	std::shared_ptr<const endpoints_t> endpoints;
+	mutable std::mutex write_mutex;
+	std::atomic<uint64_t> reload_count;
+
+	SchemaCache();
+	std::shared_ptr<Endpoint> endpoint(const std::string &name) const;
+	std::shared_ptr<Endpoint> endpointForUpdate(const std::string &name);
+};
+
+}
@@ -0,0 +1,29 @@
+#include "session.h"
+
+#include "connection.h"
+
+namespace tnt {
+
+Session::Session()
+{
+}
+
+Session::~Session()
+{
+}
+
+Connection *Session::connection(const std::string &endpoint)
+{
+	auto &c = connections[endpoint];
+	if (!c) {
+		c.reset(new Connection);
+	}
+	return c.get();
+}
+
+std::size_t Session::size() const
+{
+	return connections.size();
+}
+
+}
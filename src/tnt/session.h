@@ -0,0 +1,31 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+
+namespace tnt {
+
+class Connection;
+
+/**
+ * Connections of one MySQL session, one per endpoint.
+ *
+ * Every handler the session locks borrows its connections from here, so a
+ * join over several Tarantool tables talks through one warm socket per
+ * instance and keeps it across statements until the session ends.
+ */
+class Session
+{
+public:
+	Session();
+	~Session();
+
+	/// The session's connection to the endpoint, created on first use; may be disconnected
+	Connection *connection(const std::string &endpoint);
+	std::size_t size() const;
+private:
+	std::map<std::string, std::unique_ptr<Connection>> connections;
+};
+
+}
@@ -0,0 +1,81 @@
+#include "single_flight.h"
+
+#include <msgpuck.h>
+
+#include "iterator.h"
+
+namespace tnt {
+
+SingleFlight::SingleFlight():
+	coalesced(0)
+{
+}
+
+SingleFlight &SingleFlight::instance()
+{
+	static SingleFlight single_flight;
+	return single_flight;
+}
+
+uint64_t SingleFlight::coalescedCount() const
+{
+	return coalesced.load(std::memory_order_relaxed);
+}
+
+std::string SingleFlight::keyOf(const std::string &endpoint, int space_id, const char *tuple)
+{
+	std::string key = endpoint + "/" + std::to_string(space_id) + "/";
+	if (mp_typeof(*tuple) != MP_ARRAY || mp_decode_array(&tuple) == 0) {
+		return key;
+	}
+	const char *end = tuple;
+	mp_next(&end);
+	key.append(tuple, end - tuple);
+	return key;
+}
+
+void SingleFlight::forget(const std::string &key)
+{
+	stripe_t &stripe = stripes[std::hash<std::string>()(key) % stripes_number];
+	std::lock_guard<std::mutex> lock(stripe.mutex);
+	// its waiters still get its result when it completes
+	stripe.calls.erase(key);
+}
+
+std::shared_ptr<Iterator> SingleFlight::run(const std::string &key, const fetch_t &fetch)
+{
+	stripe_t &stripe = stripes[std::hash<std::string>()(key) % stripes_number];
+	std::unique_lock<std::mutex> lock(stripe.mutex);
+
+	auto found = stripe.calls.find(key);
+	if (found != stripe.calls.end()) {
+		std::shared_ptr<call_t> call = found->second;
+		stripe.condition.wait(lock, [&] { return call->done; });
+		lock.unlock();
+		if (call->result) {
+			coalesced.fetch_add(1, std::memory_order_relaxed);
+			return call->result->clone();
+		}
+		// the leader failed; its error belongs to its own connection
+		return fetch();
+	}
+
+	auto call = std::make_shared<call_t>();
+	stripe.calls[key] = call;
+	lock.unlock();
+
+	std::shared_ptr<Iterator> result = fetch();
+
+	lock.lock();
+	call->result = result ? result->clone() : std::shared_ptr<Iterator>();
+	call->done = true;
+	// unless forget() has made way for a newer request under the same key
+	auto registered = stripe.calls.find(key);
+	if (registered != stripe.calls.end() && registered->second == call) {
+		stripe.calls.erase(registered);
+	}
+	stripe.condition.notify_all();
+	return result;
+}
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace tnt {
+
+class Iterator;
+
+/**
+ * Coalesces identical concurrent reads.
+ *
+ * The first caller for a key runs the request; callers arriving while it
+ * is in flight wait for it instead of sending their own, and each of them
+ * gets its own cursor over the same decoded reply. Nothing is kept once
+ * the request completes, so this never returns data older than a read
+ * that was already under way when the caller asked. Writers call forget()
+ * once their write is acknowledged: a read started before the write could
+ * miss it, so later callers, the writer's own session included, send a
+ * request of their own instead of joining that one.
+ */
+class SingleFlight
+{
+public:
+	typedef std::function<std::shared_ptr<Iterator>()> fetch_t;
+
+	static SingleFlight &instance();
+
+	/// Key of a primary key lookup: the first field of tuple, a key or a whole row
+	static std::string keyOf(const std::string &endpoint, int space_id, const char *tuple);
+
+	/// fetch() or the shared result of an identical request in flight
+	std::shared_ptr<Iterator> run(const std::string &key, const fetch_t &fetch);
+	/// Detaches the request in flight for key, if any, from callers arriving later
+	void forget(const std::string &key);
+	/// Reads answered by another session's request
+	uint64_t coalescedCount() const;
+private:
+	struct call_t {
+		bool done = false;
+		std::shared_ptr<Iterator> result; // pristine cursor, cloned for each waiter
+	};
+	struct stripe_t {
+		std::mutex mutex;
+		std::condition_variable condition;
+		std::unordered_map<std::string, std::shared_ptr<call_t>> calls;
+	};
+	static const int stripes_number = 16;
+	stripe_t stripes[stripes_number];
+	std::atomic<uint64_t> coalesced;
+
+	SingleFlight();
+};
+
+}
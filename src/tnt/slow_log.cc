@@ -0,0 +1,246 @@
+#include "slow_log.h"
+
+#include <chrono>
+#include <ctime>
+
+#include <msgpuck.h>
+
+namespace tnt {
+
+namespace {
+
+thread_local uint64_t current_query_id = 0;
+
+// Renders what is complete of a msgpack value cut at end
+void appendValue(std::string &out, const char *&p, const char *end, int depth)
+{
+	const char *check = p;
+	bool complete = mp_check(&check, end) == 0;
+	if (!complete && mp_typeof(*p) != MP_ARRAY) {
+		out += "...";
+		p = end;
+		return;
+	}
+	char number[32];
+	switch (mp_typeof(*p)) {
+	case MP_NIL:
+		mp_decode_nil(&p);
+		out += "null";
+		break;
+	case MP_BOOL:
+		out += mp_decode_bool(&p) ? "true" : "false";
+		break;
+	case MP_UINT:
+		snprintf(number, sizeof number, "%llu", (unsigned long long) mp_decode_uint(&p));
+		out += number;
+		break;
+	case MP_INT:
+		snprintf(number, sizeof number, "%lld", (long long) mp_decode_int(&p));
+		out += number;
+		break;
+	case MP_FLOAT:
+		snprintf(number, sizeof number, "%g", mp_decode_float(&p));
+		out += number;
+		break;
+	case MP_DOUBLE:
+		snprintf(number, sizeof number, "%g", mp_decode_double(&p));
+		out += number;
+		break;
+	case MP_STR: {
+		uint32_t length = 0;
+		const char *str = mp_decode_str(&p, &length);
+		out += '"';
+		out.append(str, length);
+		out += '"';
+		break;
+	}
+	case MP_ARRAY: {
+		uint8_t marker = static_cast<uint8_t>(*p);
+		long header = marker <= 0x9f ? 1 : (marker == 0xdc ? 3 : 5);
+		if (end - p < header) {
+			out += "...";
+			p = end;
+			return;
+		}
+		uint32_t size = mp_decode_array(&p);
+		out += '[';
+		for (uint32_t n = 0; n < size && p < end && depth < 4; ++n) {
+			if (n > 0) {
+				out += ", ";
+			}
+			appendValue(out, p, end, depth + 1);
+		}
+		out += ']';
+		break;
+	}
+	default:
+		mp_next(&p);
+		out += "?";
+	}
+}
+
+}
+
+std::atomic<SlowLog*> SlowLog::running(nullptr);
+std::atomic<uint64_t> SlowLog::threshold(0);
+std::atomic<uint64_t> SlowLog::logged(0);
+std::atomic<uint64_t> SlowLog::dropped(0);
+
+SlowLog::SlowLog(std::size_t capacity):
+	enqueue_pos(0),
+	stopping(false)
+{
+	std::size_t size = 1;
+	while (size < capacity) {
+		size <<= 1;
+	}
+	slots.reset(new slot_t[size]);
+	for (std::size_t n = 0; n < size; ++n) {
+		slots[n].sequence.store(n, std::memory_order_relaxed);
+	}
+	mask = size - 1;
+}
+
+bool SlowLog::start(const std::string &path, std::size_t capacity)
+{
+	std::unique_ptr<SlowLog> log(new SlowLog(capacity));
+	log->file = fopen(path.c_str(), "a");
+	if (!log->file) {
+		return false;
+	}
+	log->writer = std::thread(&SlowLog::run, log.get());
+	running.store(log.release(), std::memory_order_release);
+	return true;
+}
+
+void SlowLog::stop()
+{
+	SlowLog *log = running.exchange(nullptr);
+	if (!log) {
+		return;
+	}
+	log->stopping = true;
+	log->wakeup.notify_one();
+	log->writer.join();
+	fclose(log->file);
+	delete log;
+}
+
+void SlowLog::setThresholdUs(uint64_t threshold_us)
+{
+	threshold.store(threshold_us, std::memory_order_relaxed);
+}
+
+void SlowLog::setQueryId(uint64_t query_id)
+{
+	current_query_id = query_id;
+}
+
+uint64_t SlowLog::queryId()
+{
+	return current_query_id;
+}
+
+void SlowLog::record(const entry_t &entry)
+{
+	SlowLog *log = running.load(std::memory_order_acquire);
+	if (!log) {
+		return;
+	}
+	if (!log->push(entry)) {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	logged.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t SlowLog::loggedCount()
+{
+	return logged.load(std::memory_order_relaxed);
+}
+
+uint64_t SlowLog::droppedCount()
+{
+	return dropped.load(std::memory_order_relaxed);
+}
+
+// Bounded multi-producer queue: a slot's sequence tells whose turn it is
+bool SlowLog::push(const entry_t &entry)
+{
+	uint64_t pos = enqueue_pos.load(std::memory_order_relaxed);
+	for (;;) {
+		slot_t &slot = slots[pos & mask];
+		uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+		int64_t diff = static_cast<int64_t>(sequence) - static_cast<int64_t>(pos);
+		if (diff == 0) {
+			if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				slot.entry = entry;
+				slot.sequence.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+		} else if (diff < 0) {
+			return false; // full
+		} else {
+			pos = enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+bool SlowLog::pop(entry_t &entry)
+{
+	slot_t &slot = slots[dequeue_pos & mask];
+	if (slot.sequence.load(std::memory_order_acquire) != dequeue_pos + 1) {
+		return false;
+	}
+	entry = slot.entry;
+	slot.sequence.store(dequeue_pos + mask + 1, std::memory_order_release);
+	++dequeue_pos;
+	return true;
+}
+
+void SlowLog::run()
+{
+	entry_t entry;
+	for (;;) {
+		bool wrote = false;
+		while (pop(entry)) {
+			write(entry);
+			wrote = true;
+		}
+		if (wrote) {
+			fflush(file);
+		}
+		if (stopping) {
+			break;
+		}
+		// sessions don't notify, so a busy log is drained every 100ms
+		std::unique_lock<std::mutex> lock(mutex);
+		wakeup.wait_for(lock, std::chrono::milliseconds(100));
+	}
+}
+
+void SlowLog::write(const entry_t &entry)
+{
+	time_t seconds = static_cast<time_t>(entry.time_us / 1000000);
+	struct tm local;
+	localtime_r(&seconds, &local);
+	char when[32];
+	strftime(when, sizeof when, "%Y-%m-%d %H:%M:%S", &local);
+
+	std::string key;
+	const char *p = entry.key;
+	if (entry.key_size > 0) {
+		appendValue(key, p, entry.key + entry.key_size, 0);
+	}
+	fprintf(file, "%s.%06lld query_id=%llu endpoint=%.*s type=%s space=%d index=%d "
+			"key=%s rows=%llu bytes=%llu rtt_us=%llu\n",
+			when, (long long) (entry.time_us % 1000000),
+			(unsigned long long) entry.query_id,
+			(int) sizeof entry.endpoint, entry.endpoint,
+			latencyOpName(entry.op), entry.space_id, entry.index_id,
+			key.empty() ? "-" : key.c_str(),
+			(unsigned long long) entry.rows, (unsigned long long) entry.bytes,
+			(unsigned long long) entry.rtt_us);
+}
+
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "latency.h"
+
+namespace tnt {
+
+/**
+ * Log of Tarantool requests slower than a threshold.
+ *
+ * Sessions put fixed-size entries into a bounded lock-free ring and never
+ * wait: when the ring is full the entry is counted as dropped. A writer
+ * thread formats the entries and appends them to the file, so neither
+ * formatting nor disk latency is paid by the request that was slow.
+ */
+class SlowLog
+{
+public:
+	static const std::size_t key_prefix_size = 32;
+
+	struct entry_t {
+		int64_t time_us;           // wall clock
+		uint64_t query_id;
+		int space_id;
+		int index_id;
+		latency_op_t op;
+		uint64_t rows;
+		uint64_t bytes;            // sent and received
+		uint64_t rtt_us;
+		char endpoint[64];
+		uint8_t key_size;          // bytes of key, possibly cut in the middle of a value
+		char key[key_prefix_size]; // msgpack key, or tuple for inserts and replaces
+	};
+
+	/// Starts the writer; false if the file can't be opened
+	static bool start(const std::string &path, std::size_t capacity);
+	static void stop();
+
+	/// 0 disables the log
+	static void setThresholdUs(uint64_t threshold_us);
+	static uint64_t thresholdUs()
+	{
+		return threshold.load(std::memory_order_relaxed);
+	}
+	/// Query of the calling session thread, see Entry::query_id
+	static void setQueryId(uint64_t query_id);
+	static uint64_t queryId();
+
+	/// Never blocks; a no-op while the log isn't started
+	static void record(const entry_t &entry);
+
+	static uint64_t loggedCount();
+	static uint64_t droppedCount();
+private:
+	struct slot_t {
+		std::atomic<uint64_t> sequence;
+		entry_t entry;
+	};
+
+	std::unique_ptr<slot_t[]> slots;
+	std::size_t mask;
+	std::atomic<uint64_t> enqueue_pos;
+	uint64_t dequeue_pos = 0;   // writer thread only
+	FILE *file = nullptr;
+	std::atomic<bool> stopping;
+	std::mutex mutex;           // for the writer's sleep only
+	std::condition_variable wakeup;
+	std::thread writer;
+
+	static std::atomic<SlowLog*> running;
+	static std::atomic<uint64_t> threshold;
+	static std::atomic<uint64_t> logged;
+	static std::atomic<uint64_t> dropped;
+
+	SlowLog(std::size_t capacity);
+	bool push(const entry_t &entry);
+	bool pop(entry_t &entry);
+	void run();
+	void write(const entry_t &entry);
+};
+
+}
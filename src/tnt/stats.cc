@@ -0,0 +1,26 @@
+#include "stats.h"
+
+namespace tnt {
+
+Stats::shard_t Stats::shards[Stats::shards_number];
+
+Stats::shard_t &Stats::shard()
+{
+	// threads take shards round-robin; more threads than shards just share
+	static std::atomic<unsigned> next_shard(0);
+	static thread_local shard_t *own =
+		&shards[next_shard.fetch_add(1, std::memory_order_relaxed) % shards_number];
+	return *own;
+}
+
+int64_t Stats::get(counter_t counter)
+{
+	// unsigned sums wrap, so decrements made on other shards cancel out
+	uint64_t sum = 0;
+	for (const shard_t &s: shards) {
+		sum += s.counters[counter].load(std::memory_order_relaxed);
+	}
+	return static_cast<int64_t>(sum);
+}
+
+}
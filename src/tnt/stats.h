@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace tnt {
+
+/**
+ * Engine-wide event counters for SHOW STATUS.
+ *
+ * Threads are spread over cache-line-aligned shards, each with a full set of
+ * counters, so counting on the request path is a relaxed add to a line that
+ * other threads rarely write. Reading sums every shard, which makes a value
+ * exact only once the counted operations have finished.
+ */
+class Stats
+{
+public:
+	enum counter_t {
+		SELECTS,
+		INSERTS,
+		REPLACES,
+		DELETES,
+		EVALS,
+		ROWS_READ,
+		ROWS_WRITTEN,
+		BYTES_SENT,
+		BYTES_RECEIVED,
+		CONNECTS,
+		RECONNECTS,
+		SCHEMA_RELOADS,
+		POOL_WAITS,       // waits for a reply on a shared I/O thread socket
+		IN_FLIGHT,        // requests sent and not answered yet
+		COUNTERS_NUMBER
+	};
+
+	/// Negative amounts are allowed, e.g. for IN_FLIGHT
+	static void add(counter_t counter, int64_t amount = 1)
+	{
+		shard().counters[counter].fetch_add(static_cast<uint64_t>(amount),
+				std::memory_order_relaxed);
+	}
+	static int64_t get(counter_t counter);
+private:
+	struct alignas(64) shard_t {
+		std::atomic<uint64_t> counters[COUNTERS_NUMBER];
+	};
+	static const int shards_number = 64;
+	static shard_t shards[shards_number];
+
+	static shard_t &shard();
+};
+
+}
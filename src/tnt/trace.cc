@@ -0,0 +1,188 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+namespace tnt {
+
+namespace {
+
+struct record_t {
+	int64_t time_us;
+	const char *format; // string literal
+	int64_t args[3];
+	uint8_t level;
+	bool has_text;
+	char text[46];
+};
+
+struct ring_t {
+	static const std::size_t size = 1024; // power of two
+	record_t records[size];
+	std::atomic<uint64_t> written;
+	unsigned thread_number;
+
+	ring_t(): written(0), thread_number(0) {}
+};
+
+std::mutex rings_mutex;
+std::set<ring_t*> rings;
+unsigned threads_seen = 0;
+
+// Registers the thread's ring on first use and drops it when the thread exits
+struct ring_owner_t {
+	ring_t *ring = nullptr;
+
+	ring_t &get()
+	{
+		if (!ring) {
+			ring = new ring_t;
+			std::lock_guard<std::mutex> guard(rings_mutex);
+			ring->thread_number = ++threads_seen;
+			rings.insert(ring);
+		}
+		return *ring;
+	}
+	~ring_owner_t()
+	{
+		if (ring) {
+			std::lock_guard<std::mutex> guard(rings_mutex);
+			rings.erase(ring);
+			delete ring;
+		}
+	}
+};
+
+thread_local ring_owner_t own_ring;
+
+int64_t wallUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::system_clock::now().time_since_epoch()
+		).count();
+}
+
+record_t &nextRecord(uint64_t &position)
+{
+	ring_t &ring = own_ring.get();
+	position = ring.written.load(std::memory_order_relaxed);
+	return ring.records[position & (ring_t::size - 1)];
+}
+
+void publish(uint64_t position)
+{
+	own_ring.get().written.store(position + 1, std::memory_order_release);
+}
+
+const char *levelName(int level)
+{
+	static const char *names[] = {"off", "error", "warning", "info", "debug"};
+	return level >= 0 && level <= TRACE_DEBUG ? names[level] : "?";
+}
+
+}
+
+std::atomic<int> Trace::current_level(TRACE_OFF);
+
+void Trace::setLevel(trace_level_t level)
+{
+	current_level.store(level, std::memory_order_relaxed);
+}
+
+void Trace::record(trace_level_t level, const char *format, int64_t a, int64_t b, int64_t c)
+{
+	uint64_t position;
+	record_t &r = nextRecord(position);
+	r.time_us = wallUs();
+	r.format = format;
+	r.args[0] = a;
+	r.args[1] = b;
+	r.args[2] = c;
+	r.level = static_cast<uint8_t>(level);
+	r.has_text = false;
+	publish(position);
+}
+
+void Trace::recordText(trace_level_t level, const char *format, const std::string &text,
+		int64_t a, int64_t b)
+{
+	uint64_t position;
+	record_t &r = nextRecord(position);
+	r.time_us = wallUs();
+	r.format = format;
+	r.args[0] = a;
+	r.args[1] = b;
+	r.args[2] = 0;
+	r.level = static_cast<uint8_t>(level);
+	r.has_text = true;
+	std::size_t size = std::min(text.size(), sizeof r.text - 1);
+	memcpy(r.text, text.data(), size);
+	r.text[size] = '\0';
+	publish(position);
+}
+
+std::string Trace::dump(std::size_t max_records)
+{
+	struct copy_t {
+		record_t record;
+		unsigned thread_number;
+	};
+	std::vector<copy_t> copies;
+	{
+		std::lock_guard<std::mutex> guard(rings_mutex);
+		for (ring_t *ring: rings) {
+			uint64_t end = ring->written.load(std::memory_order_acquire);
+			uint64_t begin = end > ring_t::size ? end - ring_t::size : 0;
+			std::size_t first = copies.size();
+			for (uint64_t n = begin; n < end; ++n) {
+				copies.push_back({ring->records[n & (ring_t::size - 1)], ring->thread_number});
+			}
+			// records the owner overwrote while they were copied are dropped
+			uint64_t now = ring->written.load(std::memory_order_acquire);
+			uint64_t valid_from = now > ring_t::size ? now - ring_t::size + 1 : 0;
+			if (valid_from > begin) {
+				std::size_t stale = std::min<uint64_t>(valid_from - begin, end - begin);
+				copies.erase(copies.begin() + first, copies.begin() + first + stale);
+			}
+		}
+	}
+	std::sort(copies.begin(), copies.end(), [](const copy_t &x, const copy_t &y) {
+			return x.record.time_us < y.record.time_us;
+		});
+	if (copies.size() > max_records) {
+		copies.erase(copies.begin(), copies.end() - max_records);
+	}
+
+	std::string out;
+	char line[512];
+	for (const copy_t &copy: copies) {
+		const record_t &r = copy.record;
+		time_t seconds = static_cast<time_t>(r.time_us / 1000000);
+		struct tm local;
+		localtime_r(&seconds, &local);
+		int length = static_cast<int>(strftime(line, sizeof line, "%H:%M:%S", &local));
+		length += snprintf(line + length, sizeof line - length, ".%06lld [%u] %s: ",
+				(long long) (r.time_us % 1000000), copy.thread_number, levelName(r.level));
+		if (length < static_cast<int>(sizeof line)) {
+			if (r.has_text) {
+				snprintf(line + length, sizeof line - length, r.format, r.text,
+						(long long) r.args[0], (long long) r.args[1]);
+			} else {
+				snprintf(line + length, sizeof line - length, r.format,
+						(long long) r.args[0], (long long) r.args[1], (long long) r.args[2]);
+			}
+		}
+		out += line;
+		out += '\n';
+	}
+	return out;
+}
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace tnt {
+
+enum trace_level_t {
+	TRACE_OFF,
+	TRACE_ERROR,
+	TRACE_WARNING,
+	TRACE_INFO,
+	TRACE_DEBUG
+};
+
+/**
+ * In-memory trace of engine events.
+ *
+ * Each thread writes fixed-size binary records (a format string literal
+ * and its arguments, nothing is formatted) into a ring of its own, so
+ * tracing never locks and never touches the error log; rings keep the
+ * last records of each thread and are formatted only when dumped. Below
+ * the current level a trace point costs a relaxed load and a branch.
+ */
+class Trace
+{
+public:
+	static void setLevel(trace_level_t level);
+	static bool enabled(trace_level_t level)
+	{
+		return level <= current_level.load(std::memory_order_relaxed);
+	}
+
+	/// format takes up to three long long arguments (%lld)
+	static void record(trace_level_t level, const char *format,
+			int64_t a = 0, int64_t b = 0, int64_t c = 0);
+	/// format starts with a %s for text, which is cut to a few dozen bytes
+	static void recordText(trace_level_t level, const char *format, const std::string &text,
+			int64_t a = 0, int64_t b = 0);
+
+	/// Newest records of all threads, oldest first, one per line
+	static std::string dump(std::size_t max_records);
+private:
+	static std::atomic<int> current_level;
+};
+
+}
+
+/// Trace point that evaluates its arguments only when the level is on
+#define TNT_TRACE(level, ...) \
+	do { \
+		if (tnt::Trace::enabled(level)) \
+			tnt::Trace::record(level, __VA_ARGS__); \
+	} while (0)
+
+#define TNT_TRACE_TEXT(level, ...) \
+	do { \
+		if (tnt::Trace::enabled(level)) \
+			tnt::Trace::recordText(level, __VA_ARGS__); \
+	} while (0)
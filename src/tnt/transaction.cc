@@ -0,0 +1,294 @@
+#include "transaction.h"
+
+#include <algorithm>
+
+#include <msgpuck.h>
+
+#include "connection.h"
+#include "iterator.h"
+#include "row.h"
+#include "session.h"
+#include "tuple_builder.h"
+
+namespace tnt {
+
+namespace {
+
+// A failed statement rolls the whole write set back
+const std::string commit_expression =
+	"box.begin() "
+	"for _, op in ipairs({...}) do "
+		"local space = box.space[op[2]] "
+		"if space == nil then "
+			"box.rollback() "
+			"return {'Space ' .. op[2] .. ' does not exist'} "
+		"end "
+		"local ok, err = pcall(space[op[1]], space, op[3]) "
+		"if not ok then "
+			"box.rollback() "
+			"return {tostring(err)} "
+		"end "
+	"end "
+	"box.commit() "
+	"return {''}";
+
+/// The msgpack of the first field of an array, empty when there is none
+std::string firstField(const char *tuple)
+{
+	if (mp_typeof(*tuple) != MP_ARRAY || mp_decode_array(&tuple) == 0) {
+		return std::string();
+	}
+	const char *end = tuple;
+	mp_next(&end);
+	return std::string(tuple, end);
+}
+
+// The scan with the latest write to each primary key laid over it
+class OverlayIterator: public Iterator
+{
+public:
+	OverlayIterator(std::shared_ptr<Iterator> scan, std::map<std::string, std::string> written):
+		scan(scan),
+		written(std::move(written)),
+		pending(this->written.begin())
+	{
+	}
+
+	std::shared_ptr<Row> nextRow() override
+	{
+		while (!scan_done) {
+			std::shared_ptr<Row> row = scan->nextRow();
+			if (!row) {
+				scan_done = true;
+				break;
+			}
+			if (!written.count(keyOf(*row))) {
+				return row;
+			}
+		}
+		if (!scan->lastError().empty()) {
+			return std::shared_ptr<Row>(); // the scan fails, don't pass the rest for all of it
+		}
+		while (pending != written.end()) {
+			const std::string &tuple = (pending++)->second;
+			if (!tuple.empty()) {
+				const char *p = tuple.data();
+				return Row::eatData(p);
+			}
+		}
+		return std::shared_ptr<Row>();
+	}
+
+	operator bool() const override
+	{
+		if (!scan_done && *scan) {
+			return true;
+		}
+		for (auto it = pending; it != written.end(); ++it) {
+			if (!it->second.empty()) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	const std::string &lastError() const override
+	{
+		return scan->lastError();
+	}
+private:
+	std::shared_ptr<Iterator> scan;
+	std::map<std::string, std::string> written; // empty tuple for a deleted key
+	std::map<std::string, std::string>::const_iterator pending;
+	bool scan_done = false;
+
+	// encoded like the handler encodes fields, so it matches firstField() of a write
+	static std::string keyOf(const Row &row)
+	{
+		TupleBuilder key(1);
+		if (row.getFieldNum() == 0 || row.isNull(0)) {
+			key.pushNull();
+		} else if (row.isInt(0)) {
+			key.push(row.getInt(0));
+		} else if (row.isString(0)) {
+			key.push(row.getString(0));
+		} else if (row.isBool(0)) {
+			key.push(row.getBool(0));
+		} else {
+			return std::string(); // no key of a write is encoded this way
+		}
+		return firstField(key.ptr());
+	}
+};
+
+}
+
+Transaction::Transaction()
+{
+}
+
+Transaction::~Transaction()
+{
+}
+
+void Transaction::add(const std::string &endpoint, write_op_t op, int space_id, const TupleBuilder &tuple)
+{
+	write_t write;
+	write.op = op;
+	write.space_id = space_id;
+	write.tuple.assign(tuple.ptr(), tuple.size());
+	writes[endpoint].push_back(write);
+}
+
+Transaction::lookup_t Transaction::find(const std::string &endpoint, int space_id,
+		const TupleBuilder &key, std::string &tuple) const
+{
+	auto found = writes.find(endpoint);
+	if (found == writes.end()) {
+		return NOT_WRITTEN;
+	}
+	std::string field = firstField(key.ptr());
+	if (field.empty()) {
+		return NOT_WRITTEN;
+	}
+	const std::vector<write_t> &endpoint_writes = found->second;
+	for (auto write = endpoint_writes.rbegin(); write != endpoint_writes.rend(); ++write) {
+		if (write->space_id != space_id || firstField(write->tuple.data()) != field) {
+			continue;
+		}
+		if (write->op == WRITE_DELETE) {
+			return DELETED;
+		}
+		tuple = write->tuple;
+		return WRITTEN;
+	}
+	return NOT_WRITTEN;
+}
+
+std::shared_ptr<Iterator> Transaction::overlay(const std::vector<std::string> &endpoints, int space_id,
+		std::shared_ptr<Iterator> scan) const
+{
+	std::map<std::string, std::string> written;
+	for (auto &endpoint: endpoints) {
+		auto found = writes.find(endpoint);
+		if (found == writes.end()) {
+			continue;
+		}
+		for (auto &write: found->second) {
+			if (write.space_id != space_id) {
+				continue;
+			}
+			std::string &latest = written[firstField(write.tuple.data())];
+			if (write.op == WRITE_DELETE) {
+				latest.clear();
+			} else {
+				latest = write.tuple;
+			}
+		}
+	}
+	if (written.empty() || !scan) {
+		return scan;
+	}
+	return std::make_shared<OverlayIterator>(scan, std::move(written));
+}
+
+bool Transaction::empty() const
+{
+	return writes.empty();
+}
+
+std::size_t Transaction::size() const
+{
+	std::size_t result = 0;
+	for (auto &endpoint: writes) {
+		result += endpoint.second.size();
+	}
+	return result;
+}
+
+void Transaction::onCommit(std::function<void()> hook)
+{
+	commit_hooks.push_back(hook);
+}
+
+void Transaction::startStatement(uint64_t statement_id)
+{
+	if (statement_id == this->statement_id) {
+		return;
+	}
+	this->statement_id = statement_id;
+	statement_writes.clear();
+	for (auto &endpoint: writes) {
+		statement_writes[endpoint.first] = endpoint.second.size();
+	}
+	statement_hooks = commit_hooks.size();
+}
+
+void Transaction::rollbackStatement()
+{
+	for (auto it = writes.begin(); it != writes.end(); ) {
+		auto mark = statement_writes.find(it->first);
+		std::size_t keep = mark == statement_writes.end() ? 0 : mark->second;
+		if (keep == 0) {
+			it = writes.erase(it);
+		} else {
+			it->second.resize(std::min(keep, it->second.size()));
+			++it;
+		}
+	}
+	commit_hooks.resize(std::min(statement_hooks, commit_hooks.size()));
+}
+
+void Transaction::rollback()
+{
+	writes.clear();
+	commit_hooks.clear();
+	statement_writes.clear();
+	statement_hooks = 0;
+}
+
+bool Transaction::commit(Session &session, std::string &error)
+{
+	error.clear();
+	for (auto &endpoint: writes) {
+		Connection *c = session.connection(endpoint.first);
+		if (!c->connected()) {
+			c->connect(endpoint.first);
+		}
+		if (!c->connected()) {
+			error = endpoint.first + ": " + c->lastError();
+			break;
+		}
+
+		std::string arguments;
+		char header[8];
+		arguments.append(header, mp_encode_array(header, endpoint.second.size()) - header);
+		for (auto &write: endpoint.second) {
+			encodeWrite(arguments, write.op, write.space_id, write.tuple);
+		}
+
+		auto result = c->eval(commit_expression, arguments.data(), arguments.size());
+		if (!result) {
+			error = c->lastError();
+			break;
+		}
+		// {error}, empty when the write set was committed
+		auto row = result->nextRow();
+		if (row && row->getFieldNum() > 0 && row->isString(0)) {
+			error = row->getString(0);
+		}
+		if (!error.empty()) {
+			break;
+		}
+	}
+	writes.clear();
+	for (auto &hook: commit_hooks) {
+		hook();
+	}
+	commit_hooks.clear();
+	statement_writes.clear();
+	statement_hooks = 0;
+	return error.empty();
+}
+
+}
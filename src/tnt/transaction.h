@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "group_commit.h"
+
+namespace tnt {
+
+class Iterator;
+class Session;
+class TupleBuilder;
+
+/**
+ * Write set of a multi-statement MySQL transaction.
+ *
+ * Writes are buffered per master endpoint and applied at COMMIT with one
+ * box.begin()..box.commit() eval per endpoint, so a transaction costs one
+ * write round trip per shard and ROLLBACK is just dropping the buffer.
+ * Primary key lookups see the transaction's own buffered writes through
+ * find(), scans through overlay(). A transaction spanning several shards
+ * commits on each of them independently. A failed statement is undone by
+ * cutting the write set back to where the statement started.
+ *
+ * Isolation is weaker than InnoDB's REPEATABLE READ: reads see what other
+ * sessions have committed so far, and the write set is applied at COMMIT
+ * without checking that the rows it changes are still as they were read.
+ * Two transactions updating the same row both commit and the later one
+ * wins, so a read-modify-write that must not lose updates belongs in
+ * autocommit statements.
+ */
+class Transaction
+{
+public:
+	Transaction();
+	~Transaction();
+
+	/// What the write set says about one primary key
+	enum lookup_t {
+		NOT_WRITTEN, // read it from Tarantool
+		DELETED,
+		WRITTEN      // tuple holds its latest version
+	};
+
+	void add(const std::string &endpoint, write_op_t op, int space_id, const TupleBuilder &tuple);
+	/// The latest write to the primary key (the first field) of key, a key or a whole tuple
+	lookup_t find(const std::string &endpoint, int space_id, const TupleBuilder &key,
+			std::string &tuple) const;
+	/// A scan of space_id on the endpoints with the writes made to them applied:
+	/// rows written or deleted are skipped, written ones follow the scanned rows
+	std::shared_ptr<Iterator> overlay(const std::vector<std::string> &endpoints, int space_id,
+			std::shared_ptr<Iterator> scan) const;
+	/// Runs once the write set has been sent at COMMIT, whatever the outcome
+	void onCommit(std::function<void()> hook);
+	bool empty() const;
+	std::size_t size() const;
+
+	/// Marks where statement_id starts; later calls for the same statement do nothing
+	void startStatement(uint64_t statement_id);
+	/// Drops the writes added since the current statement started
+	void rollbackStatement();
+
+	/// Applies and clears the write set over the session's connections
+	bool commit(Session &session, std::string &error);
+	void rollback();
+private:
+	struct write_t {
+		write_op_t op;
+		int space_id;
+		std::string tuple;
+	};
+	std::map<std::string, std::vector<write_t>> writes;
+	std::vector<std::function<void()>> commit_hooks;
+
+	uint64_t statement_id = 0;
+	std::map<std::string, std::size_t> statement_writes; // per endpoint, at the mark
+	std::size_t statement_hooks = 0;
+};
+
+}
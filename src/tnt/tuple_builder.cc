@@ -1,5 +1,7 @@
 #include "tuple_builder.h"
 
+#include <cstring>
+
 #include <msgpuck.h>
 
 namespace tnt {
@@ -47,6 +49,14 @@ void TupleBuilder::pushNull()
 	p = mp_encode_nil(p);
 }
 
+void TupleBuilder::pushEncoded(const char *value)
+{
+	const char *end = value;
+	mp_next(&end);
+	memcpy(p, value, end - value);
+	p += end - value;
+}
+
 std::size_t TupleBuilder::size() const
 {
 	return p - &data[0];
@@ -57,4 +67,13 @@ const char *TupleBuilder::ptr() const
 	return &data[0];
 }
 
+const char *TupleBuilder::firstField() const
+{
+	const char *field = data;
+	if (mp_decode_array(&field) == 0 || field == p) {
+		return nullptr;
+	}
+	return field;
+}
+
 }
@@ -16,9 +16,13 @@ public:
 	void push(const char *str, std::size_t length);
 	void push(const bool &b);
 	void pushNull();
+	/// Appends one already encoded msgpack value
+	void pushEncoded(const char *value);
 
 	std::size_t size() const;
 	const char *ptr() const;
+	/// Encoded first field, where tables keep their primary key; nullptr if there is none
+	const char *firstField() const;
 private:
 	char data[1024]; // TODO: grow dynamically
 	char *p;
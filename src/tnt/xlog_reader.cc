@@ -0,0 +1,305 @@
+#include "xlog_reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <msgpuck.h>
+
+namespace tnt {
+
+namespace {
+
+const uint32_t row_marker = 0xd5ba0bab;
+const uint32_t zrow_marker = 0xd5ba0bba;
+const uint32_t eof_marker = 0xd510aded;
+const std::size_t fixheader_size = 19;
+
+const uint32_t iproto_nop = 12;
+
+// header keys
+const uint64_t iproto_request_type = 0x00;
+const uint64_t iproto_replica_id = 0x02;
+const uint64_t iproto_lsn = 0x03;
+
+// body keys
+const uint64_t iproto_space_id = 0x10;
+const uint64_t iproto_key = 0x20;
+const uint64_t iproto_tuple = 0x21;
+
+uint32_t loadU32(const char *p)
+{
+	const unsigned char *u = reinterpret_cast<const unsigned char*>(p);
+	return (uint32_t(u[0]) << 24) | (uint32_t(u[1]) << 16) | (uint32_t(u[2]) << 8) | uint32_t(u[3]);
+}
+
+}
+
+XlogReader::XlogReader()
+{
+}
+
+XlogReader::~XlogReader()
+{
+	close();
+#ifdef HAVE_ZSTD
+	if (zstd) {
+		ZSTD_freeDStream(static_cast<ZSTD_DStream*>(zstd));
+	}
+#endif
+}
+
+void XlogReader::close()
+{
+	if (data) {
+		munmap(data, size);
+		data = nullptr;
+	}
+	if (fd >= 0) {
+		::close(fd);
+		fd = -1;
+	}
+	pos = end = tx_pos = tx_end = nullptr;
+}
+
+const std::map<uint32_t, int64_t> &XlogReader::vclock() const
+{
+	return meta_vclock;
+}
+
+const std::string &XlogReader::lastError() const
+{
+	return last_error;
+}
+
+bool XlogReader::complete() const
+{
+	return eof_seen;
+}
+
+bool XlogReader::open(const std::string &path)
+{
+	close();
+	last_error.clear();
+	eof_seen = false;
+	fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		last_error = path + ": " + strerror(errno);
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		last_error = path + ": empty or unreadable";
+		close();
+		return false;
+	}
+	size = static_cast<std::size_t>(st.st_size);
+	void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mapped == MAP_FAILED) {
+		last_error = path + ": " + strerror(errno);
+		close();
+		return false;
+	}
+	data = static_cast<char*>(mapped);
+	madvise(data, size, MADV_SEQUENTIAL);
+	pos = data;
+	end = data + size;
+	if (!readMeta()) {
+		last_error = path + ": " + last_error;
+		close();
+		return false;
+	}
+	return true;
+}
+
+// "SNAP\n0.13\nVersion: ...\nInstance: ...\nVClock: {1: 42, 2: 7}\n\n"
+bool XlogReader::readMeta()
+{
+	const char *meta_end = static_cast<const char*>(memmem(pos, end - pos, "\n\n", 2));
+	if (!meta_end) {
+		last_error = "no meta block";
+		return false;
+	}
+	std::string meta(pos, meta_end + 1);
+	pos = meta_end + 2;
+
+	meta_vclock.clear();
+	std::size_t line = meta.find("VClock: {");
+	if (line == std::string::npos) {
+		return true;
+	}
+	const char *p = meta.c_str() + line + strlen("VClock: {");
+	while (*p && *p != '}') {
+		char *next = nullptr;
+		unsigned long id = strtoul(p, &next, 10);
+		if (next == p || *next != ':') {
+			break;
+		}
+		long long lsn = strtoll(next + 1, &next, 10);
+		meta_vclock[static_cast<uint32_t>(id)] = lsn;
+		p = next;
+		while (*p == ',' || *p == ' ') {
+			++p;
+		}
+	}
+	return true;
+}
+
+bool XlogReader::readTx()
+{
+	if (end - pos < 4) {
+		return false; // a file still being written has no EOF marker
+	}
+	uint32_t magic = loadU32(pos);
+	if (magic == eof_marker) {
+		eof_seen = true;
+		return false;
+	}
+	if (magic != row_marker && magic != zrow_marker) {
+		last_error = "bad transaction magic";
+		return false;
+	}
+	if (static_cast<std::size_t>(end - pos) < fixheader_size) {
+		last_error = "truncated fixheader";
+		return false;
+	}
+	const char *p = pos + 4;
+	if (mp_typeof(*p) != MP_UINT) {
+		last_error = "bad transaction length";
+		return false;
+	}
+	uint64_t length = mp_decode_uint(&p);
+	const char *payload = pos + fixheader_size; // crc32p, crc32c and padding are skipped
+	if (length > static_cast<uint64_t>(end - payload)) {
+		last_error = "truncated transaction";
+		return false;
+	}
+	pos = payload + length;
+
+	const char *tx_begin = payload;
+	const char *tx_limit = payload + length;
+	if (magic == zrow_marker) {
+		if (!unpack(payload, length)) {
+			return false;
+		}
+		tx_begin = unpacked.data();
+		tx_limit = tx_begin + unpacked.size();
+	}
+	// rows are a header map and a body map each, all of them within the transaction
+	for (const char *p = tx_begin; p < tx_limit; ) {
+		if (mp_check(&p, tx_limit) != 0) {
+			last_error = "damaged transaction";
+			return false;
+		}
+	}
+	tx_pos = tx_begin;
+	tx_end = tx_limit;
+	return true;
+}
+
+bool XlogReader::unpack(const char *payload, std::size_t length)
+{
+#ifdef HAVE_ZSTD
+	if (!zstd) {
+		zstd = ZSTD_createDStream();
+	}
+	ZSTD_DStream *stream = static_cast<ZSTD_DStream*>(zstd);
+	ZSTD_initDStream(stream);
+	unpacked.clear();
+	ZSTD_inBuffer in = { payload, length, 0 };
+	char chunk[128 * 1024];
+	for (;;) {
+		ZSTD_outBuffer out = { chunk, sizeof chunk, 0 };
+		size_t rc = ZSTD_decompressStream(stream, &out, &in);
+		if (ZSTD_isError(rc)) {
+			last_error = ZSTD_getErrorName(rc);
+			return false;
+		}
+		unpacked.append(chunk, out.pos);
+		if (rc == 0 || (in.pos == in.size && out.pos < out.size)) {
+			return true;
+		}
+	}
+#else
+	(void) payload;
+	(void) length;
+	last_error = "compressed rows need the engine built with zstd";
+	return false;
+#endif
+}
+
+bool XlogReader::next(row_t &row)
+{
+	if (!data) {
+		return false;
+	}
+	while (tx_pos == tx_end) {
+		if (!readTx()) {
+			return false;
+		}
+	}
+
+	row = row_t();
+	if (mp_typeof(*tx_pos) != MP_MAP) {
+		last_error = "bad row header";
+		return false;
+	}
+	uint32_t keys = mp_decode_map(&tx_pos);
+	for (uint32_t i = 0; i < keys; ++i) {
+		uint64_t key = UINT64_MAX;
+		if (mp_typeof(*tx_pos) == MP_UINT) {
+			key = mp_decode_uint(&tx_pos);
+		} else {
+			mp_next(&tx_pos);
+		}
+		if (key == iproto_request_type && mp_typeof(*tx_pos) == MP_UINT) {
+			row.type = static_cast<uint32_t>(mp_decode_uint(&tx_pos));
+		} else if (key == iproto_replica_id && mp_typeof(*tx_pos) == MP_UINT) {
+			row.replica_id = static_cast<uint32_t>(mp_decode_uint(&tx_pos));
+		} else if (key == iproto_lsn && mp_typeof(*tx_pos) == MP_UINT) {
+			row.lsn = static_cast<int64_t>(mp_decode_uint(&tx_pos));
+		} else {
+			mp_next(&tx_pos);
+		}
+	}
+	// as in xrow_header_decode(): every row but NOP has a body
+	if (tx_pos == tx_end || row.type == iproto_nop) {
+		return true;
+	}
+	const char *body = tx_pos;
+	mp_next(&tx_pos);
+	if (mp_typeof(*body) != MP_MAP) {
+		return true;
+	}
+	keys = mp_decode_map(&body);
+	for (uint32_t i = 0; i < keys; ++i) {
+		uint64_t key = UINT64_MAX;
+		if (mp_typeof(*body) == MP_UINT) {
+			key = mp_decode_uint(&body);
+		} else {
+			mp_next(&body);
+		}
+		if (key == iproto_space_id && mp_typeof(*body) == MP_UINT) {
+			row.space_id = static_cast<int64_t>(mp_decode_uint(&body));
+			continue;
+		}
+		if (key == iproto_key) {
+			row.key = body;
+		} else if (key == iproto_tuple) {
+			row.tuple = body;
+		}
+		mp_next(&body);
+	}
+	return true;
+}
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace tnt {
+
+/**
+ * Sequential reader of a Tarantool .snap or .xlog file.
+ *
+ * The file is mapped into memory and decoded in place: after the text meta
+ * block every transaction starts with a 19-byte fixheader (magic, length,
+ * two checksums, padding) followed by its rows, each a header map and a
+ * body map. Compressed transactions are unpacked with zstd when the engine
+ * is built with HAVE_ZSTD. Every transaction is checked to be complete
+ * msgpack within its length before any of it is decoded, so a damaged or
+ * half-copied file fails with an error rather than reading past the
+ * mapping; checksums are not verified.
+ */
+class XlogReader
+{
+public:
+	struct row_t {
+		uint32_t type = 0;
+		uint32_t replica_id = 0;
+		int64_t lsn = 0;
+		int64_t space_id = -1;
+		const char *key = nullptr;   // msgpack array or nullptr
+		const char *tuple = nullptr; // msgpack array or nullptr
+	};
+
+	XlogReader();
+	~XlogReader();
+
+	bool open(const std::string &path);
+	/// False at the end of the file or on error, see lastError()
+	bool next(row_t &row);
+	/// VClock of the meta block: what the file starts from (or contains, for a snapshot)
+	const std::map<uint32_t, int64_t> &vclock() const;
+	const std::string &lastError() const;
+	/// Whether next() has reached the EOF marker, which a finished snapshot always has
+	bool complete() const;
+private:
+	int fd = -1;
+	char *data = nullptr;
+	std::size_t size = 0;
+	const char *pos = nullptr;
+	const char *end = nullptr;
+	const char *tx_pos = nullptr;
+	const char *tx_end = nullptr;
+	std::string unpacked;
+	void *zstd = nullptr;
+	std::map<uint32_t, int64_t> meta_vclock;
+	std::string last_error;
+	bool eof_seen = false;
+
+	void close();
+	bool readMeta();
+	bool readTx();
+	bool unpack(const char *payload, std::size_t length);
+};
+
+}